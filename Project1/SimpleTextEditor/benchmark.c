@@ -0,0 +1,1038 @@
+/*
+ * 简易文本编辑器 - 性能基准测试实现
+ */
+
+#include <time.h>
+#include "benchmark.h"
+#include "text_editor.h"
+#include "text_simd.h"
+#include "text_thread.h"
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+    const char *description;
+} Benchmark;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *label, int ops, double seconds) {
+    printf("  %-28s %8d 次  %9.3f ms  %8.1f ns/次\n",
+           label, ops, seconds * 1000.0, ops > 0 ? seconds * 1e9 / ops : 0.0);
+}
+
+/* 简单的线性同余随机数，保证各平台结果一致 */
+static unsigned int bench_rand(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 16) & 0x7FFF;
+}
+
+/* ========================== 行插入/删除 ========================== */
+
+static void fill_lines(TextBuffer *buf, int lines) {
+    for (int i = 0; i < lines; i++) {
+        insert_line(buf, buf->line_count, "2026-01-11 12:00:00 INFO request handled in 12ms");
+    }
+}
+
+/*
+ * 规模从 25k 翻倍到 100k 行：若单次操作耗时基本不变，说明插入/删除为 O(1) 均摊
+ */
+static void bench_lines(void) {
+    const int sizes[] = { 25000, 50000, 100000 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        TextBuffer buf;
+        double t;
+        printf("\n[%d 行]\n", n);
+
+        buffer_init(&buf);
+        t = now_seconds();
+        fill_lines(&buf, n);
+        report("末尾追加 insert_line", n, now_seconds() - t);
+        buffer_clear(&buf);
+
+        t = now_seconds();
+        for (int i = 0; i < n; i++) {
+            insert_line(&buf, 0, "prepended line");
+        }
+        report("行首插入 insert_line(0)", n, now_seconds() - t);
+
+        t = now_seconds();
+        for (int i = 0; i < n; i++) {
+            delete_line(&buf, 0);
+        }
+        report("行首删除 delete_line(0)", n, now_seconds() - t);
+
+        /* 插件 apply_to_buffer 的访问模式：倒序删空后顺序重建 */
+        fill_lines(&buf, n);
+        t = now_seconds();
+        for (int i = buf.line_count - 1; i >= 0; i--) {
+            delete_line(&buf, i);
+        }
+        for (int i = 0; i < n; i++) {
+            insert_line(&buf, i, "rewritten by plugin");
+        }
+        report("整体重写（倒删+顺插）", 2 * n, now_seconds() - t);
+
+        /* 在同一区域附近反复编辑（光标附近的典型操作） */
+        unsigned int seed = 42;
+        int cursor = n / 2;
+        t = now_seconds();
+        for (int i = 0; i < n; i++) {
+            cursor += (int)(bench_rand(&seed) % 16) - 8;
+            if (cursor < 0) cursor = 0;
+            if (cursor > buf.line_count) cursor = buf.line_count;
+            insert_line(&buf, cursor, "edited near cursor");
+        }
+        report("光标附近插入", n, now_seconds() - t);
+        buffer_clear(&buf);
+    }
+}
+
+/* ========================== UTF-8 计数与校验 ========================== */
+
+static void report_throughput(const char *label, size_t bytes, int rounds, double seconds) {
+    printf("  %-32s %8.2f GB/s\n", label,
+           seconds > 0 ? (double)bytes * rounds / seconds / 1e9 : 0.0);
+}
+
+/*
+ * 中英混排文本（约 1/3 的字节属于多字节字符）上，逐级限制指令集测吞吐
+ */
+static void bench_utf8(void) {
+    const char *samples[] = { "hello, world ", "文本编辑器", "UTF-8 ", "，", "0123456789" };
+    const size_t size = 16 * 1024 * 1024;
+    const int rounds = 8;
+    char *data = (char*)malloc(size);
+    if (data == NULL) return;
+
+    unsigned int seed = 7;
+    size_t used = 0;
+    while (used < size) {
+        const char *s = samples[bench_rand(&seed) % (sizeof(samples) / sizeof(samples[0]))];
+        size_t len = strlen(s);
+        if (used + len > size) break;
+        memcpy(data + used, s, len);
+        used += len;
+    }
+
+    SimdLevel levels[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2 };
+    printf("\n[%.0f MB 中英混排文本]\n", (double)used / (1024.0 * 1024.0));
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        simd_set_max_level(levels[l]);
+        if (simd_level() != levels[l]) continue;  /* CPU 不支持该指令集 */
+        size_t chars = 0;
+        int valid = 0;
+        double t = now_seconds();
+        for (int r = 0; r < rounds; r++) {
+            chars += simd_utf8_count(data, used, &valid);
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "simd_utf8_count (%s)", simd_level_name(levels[l]));
+        report_throughput(label, used, rounds, now_seconds() - t);
+        if (!valid || chars == 0) printf("  校验结果异常\n");
+    }
+    simd_set_max_level(SIMD_LEVEL_AVX2);
+    free(data);
+}
+
+/* ========================== 字符统计 ========================== */
+
+/* 生成约 bytes 字节的文本，每行由 samples 中随机挑选的片段拼成 */
+static void fill_corpus(TextBuffer *buf, const char *const *samples, int sample_count, size_t bytes) {
+    char line[256];
+    unsigned int seed = 11;
+    size_t used = 0;
+    while (used < bytes) {
+        size_t len = 0;
+        for (;;) {
+            const char *s = samples[bench_rand(&seed) % sample_count];
+            size_t n = strlen(s);
+            if (len + n >= 120) break;
+            memcpy(line + len, s, n);
+            len += n;
+        }
+        line[len] = '\0';
+        if (insert_line(buf, buf->line_count, line) != 0) break;
+        used += len + 1;
+    }
+}
+
+static void bench_stats_corpus(const char *title, const char *const *samples, int sample_count) {
+    const size_t bytes = 64 * 1024 * 1024;
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, samples, sample_count, bytes);
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[%s，%.0f MB]\n", title, (double)total / (1024.0 * 1024.0));
+
+    SimdLevel levels[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2 };
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        simd_set_max_level(levels[l]);
+        if (simd_level() != levels[l]) continue;
+        double t = now_seconds();
+        CharStatistics stats = count_characters(&buf);
+        double elapsed = now_seconds() - t;
+        char label[64];
+        snprintf(label, sizeof(label), "count_characters (%s)", simd_level_name(levels[l]));
+        report_throughput(label, total, 1, elapsed);
+        if (stats.total_count <= 0) printf("  统计结果异常\n");
+    }
+    simd_set_max_level(SIMD_LEVEL_AVX2);
+    buffer_clear(&buf);
+}
+
+static void bench_stats(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    static const char *const mixed[] = { "文本编辑器", "，", "hello ", "世界", "。",
+                                         "ＵＴＦ－８ ", "2026 年 ", "（测试）" };
+    bench_stats_corpus("纯 ASCII 日志", ascii, (int)(sizeof(ascii) / sizeof(ascii[0])));
+    bench_stats_corpus("中英混排", mixed, (int)(sizeof(mixed) / sizeof(mixed[0])));
+}
+
+/* ========================== 并行字符统计 ========================== */
+
+/*
+ * 线程数按 1, 2, 4 ... 翻倍到 CPU 数（--threads 指定时到该值），
+ * 加速比 = 单线程耗时 / 多线程耗时
+ */
+static void bench_stats_parallel(void) {
+    static const char *const mixed[] = { "文本编辑器", "，", "hello ", "世界", "。",
+                                         "ＵＴＦ－８ ", "2026 年 ", "（测试）" };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 128 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    int max_threads = text_thread_count();
+    printf("\n[中英混排，%.0f MB，%d 行，最多 %d 线程]\n",
+           (double)total / (1024.0 * 1024.0), buf.line_count, max_threads);
+
+    double single = 0.0;
+    int threads = 1;
+    for (;;) {
+        double t = now_seconds();
+        CharStatistics stats = count_characters_parallel(&buf, threads);
+        double elapsed = now_seconds() - t;
+        if (threads == 1) single = elapsed;
+        printf("  %2d 线程  %9.3f ms  %6.2f GB/s  加速比 %.2fx\n", threads, elapsed * 1000.0,
+               elapsed > 0 ? (double)total / elapsed / 1e9 : 0.0,
+               elapsed > 0 ? single / elapsed : 0.0);
+        if (stats.total_count <= 0) printf("  统计结果异常\n");
+        if (threads >= max_threads) break;
+        threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+    }
+    buffer_clear(&buf);
+}
+
+/* ========================== 并行替换 ========================== */
+
+/*
+ * 每轮重新填充同一份语料再替换，线程数的取法与加速比同 stats-mt；
+ * 统计已建立，合并时的统计增量也计入耗时
+ */
+static void bench_replace_parallel(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    const size_t bytes = 128 * 1024 * 1024;
+    int max_threads = text_thread_count();
+    printf("\n[纯 ASCII 日志，%.0f MB，把 \"user=alice\" 替换为 \"user=<redacted>\"，最多 %d 线程]\n",
+           (double)bytes / (1024.0 * 1024.0), max_threads);
+
+    double single = 0.0;
+    int threads = 1;
+    for (;;) {
+        TextBuffer buf;
+        buffer_init(&buf);
+        fill_corpus(&buf, ascii, (int)(sizeof(ascii) / sizeof(ascii[0])), bytes);
+        size_t total = (size_t)get_total_length(&buf);
+        get_char_statistics(&buf);
+
+        double t = now_seconds();
+        int replaced = replace_all_parallel(&buf, "user=alice", "user=<redacted>", threads);
+        double elapsed = now_seconds() - t;
+        if (threads == 1) single = elapsed;
+        printf("  %2d 线程  %9.3f ms  %6.2f GB/s  加速比 %.2fx  （%d 处）\n", threads, elapsed * 1000.0,
+               elapsed > 0 ? (double)total / elapsed / 1e9 : 0.0,
+               elapsed > 0 ? single / elapsed : 0.0, replaced);
+        buffer_clear(&buf);
+        if (threads >= max_threads) break;
+        threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+    }
+}
+
+/* ========================== 子串查找 ========================== */
+
+static void bench_search(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    static const char *const patterns[] = { "request", "cache hit", "user=alice (cache",
+                                            "request handled in 12ms; user=alice (cache hit) INFO request handled " };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, ascii, (int)(sizeof(ascii) / sizeof(ascii[0])), 64 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[纯 ASCII 日志，%.0f MB]\n", (double)total / (1024.0 * 1024.0));
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        char label[64];
+        printf("  模式 \"%s\"（%u 字节）\n", patterns[p], (unsigned)strlen(patterns[p]));
+
+        /* 各引擎分别计数，再用自动选择的引擎收集位置 */
+        static const SearchEngine engines[] = { SEARCH_ENGINE_KMP, SEARCH_ENGINE_BMH, SEARCH_ENGINE_SIMD };
+        int count = 0;
+        double t;
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            set_search_engine(engines[e]);
+            t = now_seconds();
+            count = find_substring_count(&buf, patterns[p]);
+            snprintf(label, sizeof(label), "find_substring_count (%s)", search_engine_name(engines[e]));
+            report_throughput(label, total, 1, now_seconds() - t);
+        }
+        set_search_engine(SEARCH_ENGINE_AUTO);
+
+        int found = 0;
+        t = now_seconds();
+        SearchResult *all = find_all_occurrences(&buf, patterns[p], &found);
+        double elapsed = now_seconds() - t;
+        snprintf(label, sizeof(label), "find_all_occurrences (%d)", found);
+        report_throughput(label, total, 1, elapsed);
+        free(all);
+        if (found != count) printf("  结果数不一致: %d / %d\n", found, count);
+
+        /* 只要前 100 处：扫描在第 101 处命中时就停止 */
+        SearchResults capped;
+        search_results_init(&capped, 100);
+        t = now_seconds();
+        find_occurrences(&buf, patterns[p], &capped);
+        printf("  %-32s %9.3f ms\n", "find_occurrences (前 100 处)", (now_seconds() - t) * 1000.0);
+        search_results_free(&capped);
+    }
+    buffer_clear(&buf);
+}
+
+/* ========================== 批量编辑 ========================== */
+
+/*
+ * 同样的编辑分别逐个调用和放进一个批次提交：
+ * 分散在各行时差别在于每次编辑的统计与索引维护；集中在一个长行上时
+ * 逐个调用每次都要复制整行，总耗时随编辑数平方增长，批次只写一遍
+ */
+static void bench_batch(void) {
+    static const char *const mixed[] = { "2026-01-11 ", "INFO ", "request handled ", "文本编辑器", "，" };
+    const int spread_edits = 50000;
+    const int long_line_edits = 1000;
+    double t;
+
+    for (int mode = 0; mode < 2; mode++) {
+        TextBuffer single, batched;
+        buffer_init(&single);
+        buffer_init(&batched);
+        if (mode == 0) {
+            fill_corpus(&single, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 8 * 1024 * 1024);
+            fill_corpus(&batched, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 8 * 1024 * 1024);
+            printf("\n[%d 行中英混排，%d 处编辑分散在各行]\n", single.line_count, spread_edits);
+        } else {
+            char *line = (char*)malloc(256 * 1024 + 1);
+            if (line == NULL) return;
+            memset(line, 'x', 256 * 1024);
+            line[256 * 1024] = '\0';
+            insert_line(&single, 0, line);
+            insert_line(&batched, 0, line);
+            free(line);
+            printf("\n[单行 256 KB，%d 处编辑]\n", long_line_edits);
+        }
+        int edits = mode == 0 ? spread_edits : long_line_edits;
+        get_char_statistics(&single);
+        get_char_statistics(&batched);
+        search_index_build(&single);
+        search_index_build(&batched);
+
+        /* 逐个调用时从后往前改，保证各项的列号与批次中的原始坐标一致 */
+        unsigned int seed = 5;
+        t = now_seconds();
+        for (int k = edits - 1; k >= 0; k--) {
+            int line = mode == 0 ? (int)((long long)k * single.line_count / edits) : 0;
+            int col = mode == 0 ? 4 : k * 250;
+            if (bench_rand(&seed) & 1) {
+                insert_substring(&single, line, col, "<ins>");
+            } else {
+                replace_at_position(&single, line, col, 3, "#");
+            }
+        }
+        report("逐个调用", edits, now_seconds() - t);
+
+        EditBatch batch;
+        seed = 5;
+        t = now_seconds();
+        edit_batch_begin(&batch, &batched);
+        for (int k = edits - 1; k >= 0; k--) {
+            int line = mode == 0 ? (int)((long long)k * batched.line_count / edits) : 0;
+            int col = mode == 0 ? 4 : k * 250;
+            if (bench_rand(&seed) & 1) {
+                edit_batch_insert(&batch, line, col, "<ins>");
+            } else {
+                edit_batch_replace(&batch, line, col, 3, "#");
+            }
+        }
+        int applied = edit_batch_commit(&batch);
+        report("批量提交", edits, now_seconds() - t);
+
+        int same = applied == edits && single.line_count == batched.line_count;
+        for (int i = 0; same && i < single.line_count; i++) {
+            same = strcmp(get_line(&single, i), get_line(&batched, i)) == 0;
+        }
+        if (!same) printf("  结果不一致\n");
+        buffer_clear(&single);
+        buffer_clear(&batched);
+    }
+}
+
+/* ========================== 撤销与重做 ========================== */
+
+/*
+ * 全文替换（每行都被改写）之后撤销、重做：日志只记录行片段的新旧指向，
+ * 占用与改动的行数成正比，和文本大小无关；对照组是每步整份复制文本的快照
+ */
+static void bench_undo(void) {
+    static const char *const mixed[] = { "2026-01-11 ", "INFO ", "request handled ", "文本编辑器", "，" };
+    double t;
+
+    for (int journal = 0; journal < 2; journal++) {
+        TextBuffer buf;
+        buffer_init(&buf);
+        fill_corpus(&buf, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 64 * 1024 * 1024);
+        size_t total = (size_t)get_total_length(&buf);
+        get_char_statistics(&buf);
+        undo_clear(&buf);
+        undo_set_limit(&buf, journal ? UNDO_LIMIT_DEFAULT : 0);
+        if (journal == 0) {
+            printf("\n[%d 行中英混排，%.0f MB，把 \"INFO\" 替换为 \"WARN\"]\n",
+                   buf.line_count, (double)total / (1024.0 * 1024.0));
+        }
+
+        t = now_seconds();
+        int replaced = replace_all(&buf, "INFO", "WARN");
+        printf("  %-32s %9.3f ms\n", journal ? "replace_all（记录撤销）" : "replace_all（不记录）",
+               (now_seconds() - t) * 1000.0);
+        if (journal == 0) {
+            buffer_clear(&buf);
+            continue;
+        }
+
+        UndoStats stats;
+        get_undo_stats(&buf, &stats);
+        printf("  撤销日志 %zu 条记录，%.2f MB（整份快照需 %.2f MB），%d 处替换\n", stats.records,
+               (double)stats.memory_bytes / (1024.0 * 1024.0), (double)total / (1024.0 * 1024.0), replaced);
+
+        t = now_seconds();
+        int ok = undo_edit(&buf) == 0;
+        printf("  %-32s %9.3f ms\n", "undo_edit", (now_seconds() - t) * 1000.0);
+        ok = ok && find_substring_count(&buf, "WARN") == 0;
+        t = now_seconds();
+        ok = ok && redo_edit(&buf) == 0;
+        printf("  %-32s %9.3f ms\n", "redo_edit", (now_seconds() - t) * 1000.0);
+        ok = ok && find_substring_count(&buf, "INFO") == 0;
+        if (!ok) printf("  撤销/重做结果不正确\n");
+
+        /* 对照：整份复制一次文本的耗时 */
+        char *copy = (char*)malloc(total + 1);
+        if (copy != NULL) {
+            t = now_seconds();
+            char *dst = copy;
+            for (int i = 0; i < buf.line_count; i++) {
+                const char *line = get_line(&buf, i);
+                size_t len = strlen(line);
+                memcpy(dst, line, len);
+                dst += len;
+            }
+            printf("  %-32s %9.3f ms\n", "整份快照（复制全文）", (now_seconds() - t) * 1000.0);
+            free(copy);
+        }
+        buffer_clear(&buf);
+    }
+}
+
+/* ========================== 只读快照 ========================== */
+
+/* 后台读取线程：在快照上统计、查找并导出全文 */
+typedef struct {
+    TextSnapshot *snap;
+    CharStatistics stats;
+    int hits;
+    size_t bytes;
+    double seconds;
+} SnapshotReader;
+
+static void snapshot_reader(void *arg) {
+    SnapshotReader *reader = (SnapshotReader*)arg;
+    double t = now_seconds();
+    reader->stats = snapshot_statistics(reader->snap);
+    reader->hits = snapshot_find_count(reader->snap, "INFO");
+    size_t size = get_buffer_content(reader->snap, NULL, 0);
+    char *content = (char*)malloc(size + 1);
+    reader->bytes = content != NULL ? get_buffer_content(reader->snap, content, size + 1) : 0;
+    free(content);
+    reader->seconds = now_seconds() - t;
+}
+
+/* 随机行号（bench_rand 只有 15 位） */
+static int random_line(unsigned int *seed, int lines) {
+    unsigned int r = (bench_rand(seed) << 15) | bench_rand(seed);
+    return (int)(r % (unsigned int)lines);
+}
+
+/*
+ * 快照创建为 O(1)；之后第一次改写某一块时才复制这 LINE_CHUNK_SLOTS 个行片段，
+ * 后台线程在快照上读取全文期间，编辑线程不必等待
+ */
+static void bench_snapshot(void) {
+    static const char *const mixed[] = { "2026-01-11 ", "INFO ", "request handled ", "文本编辑器", "，" };
+    const int creates = 10000;
+    const int edits = 20000;
+    unsigned int seed = 7;
+    double t;
+
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 64 * 1024 * 1024);
+    CharStatistics expected = get_char_statistics(&buf);
+    int expected_hits = find_substring_count(&buf, "INFO");
+    undo_set_limit(&buf, 0);
+    printf("\n[%d 行中英混排，%.0f MB]\n", buf.line_count,
+           (double)get_total_length(&buf) / (1024.0 * 1024.0));
+
+    t = now_seconds();
+    for (int i = 0; i < creates; i++) {
+        snapshot_release(snapshot_create(&buf));
+    }
+    report("snapshot_create + release", creates, now_seconds() - t);
+
+    /* 改写分散在各块中的行：无快照、有快照（首次写入各块时复制） */
+    for (int shared = 0; shared < 2; shared++) {
+        TextSnapshot *snap = shared ? snapshot_create(&buf) : NULL;
+        t = now_seconds();
+        for (int i = 0; i < edits; i++) {
+            replace_line(&buf, random_line(&seed, buf.line_count), "2026-01-11 WARN edited line");
+        }
+        report(shared ? "replace_line（快照存在）" : "replace_line（无快照）", edits, now_seconds() - t);
+        snapshot_release(snap);
+    }
+
+    /* 后台线程读取快照，编辑线程同时在光标附近插入/删除/改写 */
+    expected = get_char_statistics(&buf);
+    expected_hits = find_substring_count(&buf, "INFO");
+    size_t expected_bytes = (size_t)get_total_length(&buf) + (size_t)(buf.line_count - 1);
+    SnapshotReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.snap = snapshot_create(&buf);
+    TextThread thread;
+    int started = text_thread_start(&thread, snapshot_reader, &reader) == 0;
+    int done = 0;
+    int cursor = buf.line_count / 2;
+    t = now_seconds();
+    for (; done < edits; done++) {
+        cursor += (int)(bench_rand(&seed) % 16) - 8;
+        if (cursor < 0) cursor = 0;
+        if (cursor >= buf.line_count) cursor = buf.line_count - 1;
+        int line = cursor;
+        switch (done % 3) {
+        case 0: insert_line(&buf, line, "2026-01-11 INFO inserted while reading"); break;
+        case 1: delete_line(&buf, line); break;
+        default: replace_line(&buf, line, "2026-01-11 WARN replaced while reading"); break;
+        }
+    }
+    double edit_seconds = now_seconds() - t;
+    if (started) {
+        text_thread_join(&thread);
+    } else {
+        snapshot_reader(&reader);
+    }
+    report("编辑（后台读取期间）", done, edit_seconds);
+    printf("  %-32s %9.3f ms（统计 + 查找 + 导出 %.0f MB）\n", "后台读取快照", reader.seconds * 1000.0,
+           (double)reader.bytes / (1024.0 * 1024.0));
+    if (memcmp(&reader.stats, &expected, sizeof(expected)) != 0 || reader.hits != expected_hits ||
+        reader.bytes != expected_bytes) {
+        printf("  快照内容与创建时不一致\n");
+    }
+    snapshot_release(reader.snap);
+    buffer_clear(&buf);
+
+    /* 打开别的内容后快照仍在读取原来的映射，覆盖保存该文件必须失败，快照释放后才能保存 */
+    const char *path = "bench_snapshot.tmp";
+    insert_line(&buf, 0, "2026-01-11 INFO mapped line");
+    if (file_save(&buf, path) == 0 && file_open_mapped(&buf, path) == 0) {
+        TextSnapshot *snap = snapshot_create(&buf);
+        buffer_clear(&buf);
+        insert_line(&buf, 0, "2026-01-11 WARN other content");
+        int saved = file_save(&buf, path);
+        int hits = snapshot_find_count(snap, "INFO");
+        snapshot_release(snap);
+        if (snap != NULL && (saved == 0 || hits != 1)) {
+            printf("  覆盖保存了快照仍在读取的映射文件\n");
+        }
+        if (file_save(&buf, path) != 0) printf("  快照释放后仍无法保存\n");
+    }
+    buffer_clear(&buf);
+    remove(path);
+}
+
+/* ========================== 忽略大小写查找 ========================== */
+
+/* 对照组：逐行复制并转小写后再查找（只处理 ASCII），即不做现场折叠时的做法 */
+static int count_lowered_copy(TextBuffer *buf, const char *lowered, size_t m) {
+    char line[256];
+    int count = 0;
+    for (int i = 0; i < buf->line_count; i++) {
+        const char *text = get_line(buf, i);
+        size_t n = strlen(text);
+        if (n >= sizeof(line)) n = sizeof(line) - 1;
+        for (size_t k = 0; k < n; k++) {
+            unsigned char c = (unsigned char)text[k];
+            line[k] = (char)(c >= 'A' && c <= 'Z' ? c | 0x20 : c);
+        }
+        for (size_t from = 0; from + m <= n; ) {
+            size_t pos = simd_find_pattern(line + from, n - from, lowered, m);
+            if (pos >= n - from) break;
+            count++;
+            from += pos + 1;
+        }
+    }
+    return count;
+}
+
+static void bench_nocase(void) {
+    static const char *const mixed_case[] = { "2026-01-11 ", "INFO ", "Info ", "request handled ",
+                                              "Request Handled ", "in 12ms; ", "USER=Alice ",
+                                              "ＵＳＥＲ＝ａｌｉｃｅ ", "(Cache Hit) " };
+    static const char *const patterns[] = { "request handled", "user=alice", "ｕｓｅｒ＝ＡＬＩＣＥ" };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, mixed_case, (int)(sizeof(mixed_case) / sizeof(mixed_case[0])), 64 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[大小写混排日志，%.0f MB]\n", (double)total / (1024.0 * 1024.0));
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        char label[64];
+        double t;
+        printf("  模式 \"%s\"\n", patterns[p]);
+
+        t = now_seconds();
+        int exact = find_substring_count(&buf, patterns[p]);
+        snprintf(label, sizeof(label), "区分大小写 (%d)", exact);
+        report_throughput(label, total, 1, now_seconds() - t);
+
+        int count = 0;
+        for (int level = SIMD_LEVEL_SCALAR; level <= SIMD_LEVEL_AVX2; level++) {
+            simd_set_max_level((SimdLevel)level);
+            if (level > SIMD_LEVEL_SCALAR && simd_level() != (SimdLevel)level) continue;
+            t = now_seconds();
+            count = find_substring_count_nocase(&buf, patterns[p]);
+            snprintf(label, sizeof(label), "忽略大小写 %s (%d)", simd_level_name((SimdLevel)level), count);
+            report_throughput(label, total, 1, now_seconds() - t);
+        }
+        simd_set_max_level(SIMD_LEVEL_AVX2);
+
+        /* 对照组只能折叠 ASCII，全角模式跳过 */
+        if ((unsigned char)patterns[p][0] < 0x80) {
+            t = now_seconds();
+            int lowered = count_lowered_copy(&buf, patterns[p], strlen(patterns[p]));
+            snprintf(label, sizeof(label), "复制转小写后查找 (%d)", lowered);
+            report_throughput(label, total, 1, now_seconds() - t);
+        }
+    }
+
+    {
+        double t = now_seconds();
+        int replaced = replace_all_nocase(&buf, "request handled", "REQ");
+        char label[64];
+        snprintf(label, sizeof(label), "replace_all_nocase (%d)", replaced);
+        report_throughput(label, total, 1, now_seconds() - t);
+    }
+    buffer_clear(&buf);
+}
+
+/* ========================== 全部替换 ========================== */
+
+/* 每行约 line_bytes 字节，由 "key=ab; " 重复组成，一行内有上千处匹配 */
+static void fill_dense(TextBuffer *buf, int lines, size_t line_bytes) {
+    static const char unit[] = "key=ab; ";
+    size_t unit_len = sizeof(unit) - 1;
+    char *line = (char*)malloc(line_bytes + 1);
+    if (line == NULL) return;
+    size_t len = 0;
+    while (len + unit_len <= line_bytes) {
+        memcpy(line + len, unit, unit_len);
+        len += unit_len;
+    }
+    line[len] = '\0';
+    for (int i = 0; i < lines; i++) {
+        if (insert_line(buf, buf->line_count, line) != 0) break;
+    }
+    free(line);
+}
+
+static void bench_replace(void) {
+    static const struct {
+        const char *from;
+        const char *to;
+        const char *label;
+    } cases[] = {
+        { "ab", "x",      "缩短 ab -> x" },
+        { "ab", "cd",     "等长 ab -> cd" },
+        { "ab", "abcdef", "变长 ab -> abcdef" },
+        { "key=ab; ", "", "删除整个单元" },
+        { "no such text", "y", "无匹配（行不复制）" },
+    };
+    const int lines = 2000;
+    const size_t line_bytes = 32 * 1024;
+    printf("\n[%d 行 x %u KB，每行 %u 处匹配]\n", lines, (unsigned)(line_bytes / 1024),
+           (unsigned)(line_bytes / 8));
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        TextBuffer buf;
+        buffer_init(&buf);
+        fill_dense(&buf, lines, line_bytes);
+        size_t total = (size_t)get_total_length(&buf);
+
+        double t = now_seconds();
+        int replaced = replace_all(&buf, cases[c].from, cases[c].to);
+        double elapsed = now_seconds() - t;
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s (%d)", cases[c].label, replaced);
+        report_throughput(label, total, 1, elapsed);
+        buffer_clear(&buf);
+    }
+}
+
+/* ========================== 三元组查找索引 ========================== */
+
+/*
+ * 稀有模式只落在少数行上，索引筛选后只需校验这些行；
+ * 高频模式的候选行接近全部行，此时索引只带来额外的求交开销
+ */
+static void bench_index(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    static const char *const patterns[] = { "trace=7f3a9c", "user=alice", "no such text" };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, ascii, (int)(sizeof(ascii) / sizeof(ascii[0])), 64 * 1024 * 1024);
+    for (int i = 0; i < buf.line_count; i += 5000) {
+        replace_line(&buf, i, "2026-01-11 12:00:00 WARN slow request trace=7f3a9c");
+    }
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[纯 ASCII 日志，%.0f MB，%d 行]\n", (double)total / (1024.0 * 1024.0), buf.line_count);
+
+    if (search_index_build(&buf) != 0) {
+        printf("  索引构建失败（内存不足）\n");
+        buffer_clear(&buf);
+        return;
+    }
+    SearchIndexStats stats;
+    get_search_index_stats(&buf, &stats);
+    printf("  构建 %9.3f ms，%d 个三元组，%zu 个倒排条目，占用 %.1f MB\n",
+           stats.build_seconds * 1000.0, stats.trigrams, stats.postings,
+           (double)stats.memory_bytes / (1024.0 * 1024.0));
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        char label[64];
+        int found = 0;
+        printf("  模式 \"%s\"\n", patterns[p]);
+
+        double t = now_seconds();
+        SearchResult *all = find_all_occurrences(&buf, patterns[p], &found);
+        double indexed = now_seconds() - t;
+        free(all);
+        get_search_index_stats(&buf, &stats);
+        snprintf(label, sizeof(label), "索引 (%d 候选行, %d 处)", stats.last_candidates, found);
+        printf("  %-32s %9.3f ms\n", label, indexed * 1000.0);
+
+        TrigramIndex *saved = buf.search_index;
+        buf.search_index = NULL;
+        t = now_seconds();
+        all = find_all_occurrences(&buf, patterns[p], &found);
+        double scan = now_seconds() - t;
+        free(all);
+        buf.search_index = saved;
+        snprintf(label, sizeof(label), "逐行扫描 (%d 处)", found);
+        printf("  %-32s %9.3f ms  加速比 %.1fx\n", label, scan * 1000.0,
+               indexed > 0 ? scan / indexed : 0.0);
+    }
+
+    /* 增量维护：改写随机行，索引随之登记新内容 */
+    const int edits = 100000;
+    unsigned int seed = 7;
+    double t = now_seconds();
+    for (int i = 0; i < edits; i++) {
+        replace_line(&buf, (int)(bench_rand(&seed) * 32768u + bench_rand(&seed)) % buf.line_count,
+                     "2026-01-11 12:00:01 INFO request rewritten in 3ms; user=bob");
+    }
+    report("replace_line（维护索引）", edits, now_seconds() - t);
+    get_search_index_stats(&buf, &stats);
+    printf("  失效条目 %zu，完整构建 %d 次，占用 %.1f MB\n", stats.stale_postings, stats.builds,
+           (double)stats.memory_bytes / (1024.0 * 1024.0));
+    buffer_clear(&buf);
+}
+
+/* ========================== 后缀数组索引 ========================== */
+
+/*
+ * 建立一次后缀数组后，每次计数只做两次二分；
+ * 编辑后索引过期，下一次 suffix_index_count 付出一次完整重建
+ */
+static void bench_suffix(void) {
+    static const char *const mixed[] = { "2026-01-11 ", "INFO ", "request handled ", "user=alice ",
+                                         "文本编辑器", "，", "世界", "(cache hit) " };
+    static const char *const patterns[] = { "request", "user=alice (cache", "文本编辑器，世界", "no such text" };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, mixed, (int)(sizeof(mixed) / sizeof(mixed[0])), 16 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[中英混排，%.0f MB，%d 行]\n", (double)total / (1024.0 * 1024.0), buf.line_count);
+
+    if (suffix_index_build(&buf) != 0) {
+        printf("  索引构建失败（内存不足）\n");
+        buffer_clear(&buf);
+        return;
+    }
+    SuffixIndexStats stats;
+    get_suffix_index_stats(&buf, &stats);
+    printf("  SA-IS 构建 %9.3f ms（%.1f MB/s），占用 %.1f MB\n", stats.build_seconds * 1000.0,
+           stats.build_seconds > 0 ? (double)stats.bytes / stats.build_seconds / (1024.0 * 1024.0) : 0.0,
+           (double)stats.memory_bytes / (1024.0 * 1024.0));
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        const int rounds = 1000;
+        int count = 0;
+        double t = now_seconds();
+        for (int r = 0; r < rounds; r++) {
+            count = suffix_index_count(&buf, patterns[p]);
+        }
+        double indexed = (now_seconds() - t) / rounds;
+
+        SuffixIndex *saved = buf.suffix_index;
+        buf.suffix_index = NULL;
+        t = now_seconds();
+        int scanned = find_substring_count(&buf, patterns[p]);
+        double scan = now_seconds() - t;
+        buf.suffix_index = saved;
+
+        printf("  \"%s\"  %d 处：后缀数组 %8.3f us，逐行扫描 %8.3f ms\n",
+               patterns[p], count, indexed * 1e6, scan * 1000.0);
+        if (count != scanned) printf("  结果数不一致: %d / %d\n", count, scanned);
+    }
+
+    insert_line(&buf, 0, "edited");
+    get_suffix_index_stats(&buf, &stats);
+    printf("  编辑后 stale = %d\n", stats.stale);
+    double t = now_seconds();
+    suffix_index_count(&buf, "edited");
+    printf("  %-32s %9.3f ms\n", "过期后首次查询（含重建）", (now_seconds() - t) * 1000.0);
+    buffer_clear(&buf);
+}
+
+/* ========================== 流式文件查找 ========================== */
+
+/*
+ * 先把日志文本存成临时文件，再比较分块流式查找与完整打开后查找；
+ * 流式查找的内存占用固定为一个块
+ */
+static void bench_stream(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    static const char *const patterns[] = { "cache hit", "no such text" };
+    const char *path = "bench_stream.tmp";
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, ascii, (int)(sizeof(ascii) / sizeof(ascii[0])), 128 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    int saved = file_save(&buf, path);
+    buffer_clear(&buf);
+    if (saved != 0) {
+        printf("  无法写入临时文件 %s\n", path);
+        return;
+    }
+    printf("\n[纯 ASCII 日志文件，%.0f MB，块大小 %d KB]\n",
+           (double)total / (1024.0 * 1024.0), STREAM_CHUNK_SIZE / 1024);
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        char label[64];
+        printf("  模式 \"%s\"\n", patterns[p]);
+
+        double t = now_seconds();
+        long long streamed = stream_search_file(path, patterns[p], NULL);
+        snprintf(label, sizeof(label), "stream_search_file (%lld)", streamed);
+        report_throughput(label, total, 1, now_seconds() - t);
+
+        SearchResults first;
+        search_results_init(&first, 100);
+        t = now_seconds();
+        stream_search_file(path, patterns[p], &first);
+        report_throughput("stream_search_file (前 100 处)", total, 1, now_seconds() - t);
+        search_results_free(&first);
+
+        t = now_seconds();
+        int count = file_open_mapped(&buf, path) == 0 ? find_substring_count(&buf, patterns[p]) : -1;
+        report_throughput("file_open_mapped + 计数", total, 1, now_seconds() - t);
+        buffer_clear(&buf);
+        if (count != streamed) printf("  结果数不一致: %lld / %d\n", streamed, count);
+    }
+    remove(path);
+}
+
+/* ========================== 多模式查找 ========================== */
+
+static void bench_multi(void) {
+    static const char *const samples[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                           "user=alice ", "ip=10.0.0.7 ", "mail=bob@example.com ",
+                                           "phone=13800138000 ", "(cache hit) " };
+    enum { TERMS = 32 };
+    char storage[TERMS][32];
+    const char *terms[TERMS];
+    for (int i = 0; i < TERMS; i++) {
+        /* 前 4 个会命中，其余模拟名单中不出现的词 */
+        static const char *const hits[] = { "alice", "10.0.0.7", "bob@example.com", "13800138000" };
+        if (i < 4) {
+            snprintf(storage[i], sizeof(storage[i]), "%s", hits[i]);
+        } else {
+            snprintf(storage[i], sizeof(storage[i]), "user%02d@corp.example", i);
+        }
+        terms[i] = storage[i];
+    }
+
+    TextBuffer seq, multi;
+    buffer_init(&seq);
+    buffer_init(&multi);
+    fill_corpus(&seq, samples, (int)(sizeof(samples) / sizeof(samples[0])), 32 * 1024 * 1024);
+    fill_corpus(&multi, samples, (int)(sizeof(samples) / sizeof(samples[0])), 32 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&seq);
+    printf("\n[日志脱敏，%.0f MB，%d 个词]\n", (double)total / (1024.0 * 1024.0), TERMS);
+
+    MultiPattern mp;
+    double t = now_seconds();
+    if (multi_pattern_init(&mp, terms, TERMS) != 0) {
+        printf("  自动机建立失败\n");
+        buffer_clear(&seq);
+        buffer_clear(&multi);
+        return;
+    }
+    printf("  %-32s %9.3f ms（%d 个结点）\n", "multi_pattern_init", (now_seconds() - t) * 1000.0, mp.node_count);
+
+    int seq_found = 0;
+    t = now_seconds();
+    for (int i = 0; i < TERMS; i++) seq_found += find_substring_count(&seq, terms[i]);
+    report_throughput("逐词 find_substring_count", total, 1, now_seconds() - t);
+
+    int counts[TERMS];
+    t = now_seconds();
+    int found = find_multi_occurrences(&multi, &mp, counts, NULL);
+    report_throughput("find_multi_occurrences", total, 1, now_seconds() - t);
+    if (found != seq_found) printf("  结果数不一致: %d / %d\n", found, seq_found);
+
+    int seq_deleted = 0;
+    t = now_seconds();
+    for (int i = 0; i < TERMS; i++) seq_deleted += delete_substring(&seq, terms[i]);
+    report_throughput("逐词 delete_substring", total, 1, now_seconds() - t);
+
+    t = now_seconds();
+    int deleted = replace_all_multi(&multi, &mp, NULL, counts);
+    report_throughput("replace_all_multi（删除）", total, 1, now_seconds() - t);
+    if (deleted != seq_deleted) printf("  删除数不一致: %d / %d\n", deleted, seq_deleted);
+
+    multi_pattern_free(&mp);
+    buffer_clear(&seq);
+    buffer_clear(&multi);
+}
+
+/* ========================== 正则查找 ========================== */
+
+static void bench_regex(void) {
+    static const char *const ascii[] = { "2026-01-11 ", "12:00:00 ", "INFO ", "request handled ",
+                                         "in 12ms; ", "user=alice ", "(cache hit) " };
+    static const char *const patterns[] = { "cache hit", "user=(\\w+)", "in \\d+ms", "^\\d{4}-\\d\\d-\\d\\d",
+                                            "(request|cache) (handled|hit)" };
+    TextBuffer buf;
+    buffer_init(&buf);
+    fill_corpus(&buf, ascii, (int)(sizeof(ascii) / sizeof(ascii[0])), 64 * 1024 * 1024);
+    size_t total = (size_t)get_total_length(&buf);
+    printf("\n[纯 ASCII 日志，%.0f MB]\n", (double)total / (1024.0 * 1024.0));
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        const char *error = NULL;
+        Regex *re = regex_compile(patterns[p], &error);
+        printf("  模式 /%s/\n", patterns[p]);
+        if (re == NULL) {
+            printf("  编译失败: %s\n", error);
+            continue;
+        }
+
+        /* 第一遍包含 DFA 状态构造，第二遍全部命中缓存 */
+        char label[64];
+        for (int round = 1; round <= 2; round++) {
+            double t = now_seconds();
+            int count = find_regex_count(&buf, re);
+            snprintf(label, sizeof(label), "find_regex_count 第%d遍 (%d)", round, count);
+            report_throughput(label, total, 1, now_seconds() - t);
+        }
+        int states = 0;
+        size_t bytes = 0;
+        regex_cache_stats(re, &states, &bytes);
+        printf("  %-32s %8d 个 / %.1f KB\n", "DFA 状态缓存", states, (double)bytes / 1024.0);
+        regex_free(re);
+    }
+    buffer_clear(&buf);
+}
+
+/* ========================== 注册表 ========================== */
+
+static const Benchmark g_benchmarks[] = {
+    { "lines", bench_lines, "insert_line/delete_line 在 25k~100k 行上的单次耗时" },
+    { "utf8",  bench_utf8,  "UTF-8 字符计数 + 校验在各指令集下的吞吐" },
+    { "stats", bench_stats, "count_characters 在纯 ASCII / 中英混排文本上的吞吐" },
+    { "search", bench_search, "各查找引擎下 find_substring_count / find_all_occurrences 的吞吐" },
+    { "replace", bench_replace, "replace_all 在每行上千处匹配时的吞吐（缩短、等长、变长、删除、无匹配）" },
+    { "undo", bench_undo, "全文替换后的撤销/重做耗时、日志内存占用以及与整份快照的对比" },
+    { "snapshot", bench_snapshot, "只读快照的创建耗时、写时复制的开销以及后台线程读取期间的编辑耗时" },
+    { "batch", bench_batch, "批量编辑事务与逐个调用插入/替换的对比（分散在各行、集中在一个长行）" },
+    { "nocase", bench_nocase, "忽略大小写查找：现场折叠（各指令集）与复制转小写后查找的对比" },
+    { "index", bench_index, "三元组查找索引的构建耗时、内存占用以及与逐行扫描的对比" },
+    { "suffix", bench_suffix, "后缀数组（SA-IS）的构建吞吐、计数查询耗时以及过期后的重建" },
+    { "stream", bench_stream, "分块流式查找文件与映射打开后查找的吞吐对比" },
+    { "regex", bench_regex, "正则查找（惰性 DFA）在日志文本上的吞吐和状态缓存大小" },
+    { "multi", bench_multi, "多词查找/删除：Aho-Corasick 单遍扫描与逐词调用对比" },
+    { "stats-mt", bench_stats_parallel, "count_characters_parallel 从 1 到 N 线程的扩展性" },
+    { "replace-mt", bench_replace_parallel, "replace_all_parallel 从 1 到 N 线程的扩展性" },
+};
+
+void list_benchmarks(void) {
+    printf("可用的基准测试:\n");
+    for (size_t i = 0; i < sizeof(g_benchmarks) / sizeof(g_benchmarks[0]); i++) {
+        printf("  %-12s %s\n", g_benchmarks[i].name, g_benchmarks[i].description);
+    }
+}
+
+int run_benchmarks(const char *name) {
+    int ran = 0;
+    for (size_t i = 0; i < sizeof(g_benchmarks) / sizeof(g_benchmarks[0]); i++) {
+        if (name == NULL || strcmp(name, g_benchmarks[i].name) == 0) {
+            printf("===== 基准测试: %s =====\n", g_benchmarks[i].name);
+            g_benchmarks[i].run();
+            printf("\n");
+            ran++;
+        }
+    }
+    if (ran == 0) {
+        printf("未知的基准测试: %s\n", name ? name : "");
+        list_benchmarks();
+        return -1;
+    }
+    return 0;
+}
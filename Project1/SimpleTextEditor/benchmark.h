@@ -0,0 +1,15 @@
+/*
+ * 简易文本编辑器 - 性能基准测试
+ * 通过命令行参数 --bench [名称] 运行，不进入交互菜单
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/* 运行名为 name 的基准测试，name 为 NULL 时运行全部；成功返回 0 */
+int run_benchmarks(const char *name);
+
+/* 列出所有基准测试 */
+void list_benchmarks(void);
+
+#endif /* BENCHMARK_H */
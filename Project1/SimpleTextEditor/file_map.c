@@ -0,0 +1,139 @@
+/*
+ * 简易文本编辑器 - 只读文件映射实现
+ */
+
+#include "file_map.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int file_map_open(FileMapping *map, const char *filename) {
+    if (map == NULL || filename == NULL) return -1;
+    map->data = NULL;
+    map->size = 0;
+
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return -1;
+
+    LARGE_INTEGER size;
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart > (size_t)-1 ||
+        !GetFileInformationByHandle(file, &info)) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    /* 空文件无法创建映射，视为成功打开的空内容 */
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) return -1;
+
+    /* 视图会保持映射对象存活，句柄可以立即关闭 */
+    const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (view == NULL) return -1;
+
+    map->data = (const char*)view;
+    map->size = (size_t)size.QuadPart;
+    map->device = info.dwVolumeSerialNumber;
+    map->inode = ((unsigned long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    return 0;
+}
+
+int file_map_same_file(const FileMapping *map, const char *filename) {
+    if (map == NULL || filename == NULL) return 0;
+
+    /* 只查询属性，不需要读写权限，也不妨碍其他进程访问 */
+    HANDLE file = CreateFileA(filename, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        return (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? 0 : 1;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    int same = 1;
+    if (GetFileInformationByHandle(file, &info)) {
+        unsigned long long index = ((unsigned long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        same = info.dwVolumeSerialNumber == map->device && index == map->inode;
+    }
+    CloseHandle(file);
+    return same;
+}
+
+void file_map_close(FileMapping *map) {
+    if (map == NULL) return;
+    if (map->data) {
+        UnmapViewOfFile(map->data);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+#else
+
+int file_map_open(FileMapping *map, const char *filename) {
+    if (map == NULL || filename == NULL) return -1;
+    map->data = NULL;
+    map->size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size > (size_t)-1) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return -1;
+    madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    map->data = (const char*)view;
+    map->size = (size_t)st.st_size;
+    map->device = (unsigned long long)st.st_dev;
+    map->inode = (unsigned long long)st.st_ino;
+    return 0;
+}
+
+int file_map_same_file(const FileMapping *map, const char *filename) {
+    if (map == NULL || filename == NULL) return 0;
+
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return errno == ENOENT || errno == ENOTDIR ? 0 : 1;
+    }
+    return (unsigned long long)st.st_dev == map->device && (unsigned long long)st.st_ino == map->inode;
+}
+
+void file_map_close(FileMapping *map) {
+    if (map == NULL) return;
+    if (map->data) {
+        munmap((void*)map->data, map->size);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+#endif
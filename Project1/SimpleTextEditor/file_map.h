@@ -0,0 +1,31 @@
+/*
+ * 简易文本编辑器 - 只读文件映射
+ * 封装 Windows 文件映射与 POSIX mmap，供大文件零拷贝打开使用
+ */
+
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stddef.h>
+
+/* 只读文件映射 */
+typedef struct {
+    const char *data;   /* 映射起始地址（空文件为 NULL） */
+    size_t size;        /* 映射字节数 */
+    unsigned long long device;  /* 被映射文件的标识：POSIX 为 st_dev / st_ino， */
+    unsigned long long inode;   /* Windows 为卷序列号 / 文件索引 */
+} FileMapping;
+
+/* 以只读方式映射整个文件，成功返回 0 */
+int file_map_open(FileMapping *map, const char *filename);
+
+/*
+ * filename 是否指向被映射的文件（按文件标识比较，能识别 ./、绝对路径、符号链接和硬链接）
+ * 文件不存在返回 0；无法判断时返回 1，由调用方按同一文件处理
+ */
+int file_map_same_file(const FileMapping *map, const char *filename);
+
+/* 解除映射（对未映射的结构体调用是安全的） */
+void file_map_close(FileMapping *map);
+
+#endif /* FILE_MAP_H */
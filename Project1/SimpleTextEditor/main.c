@@ -16,7 +16,11 @@
 #include <errno.h>
 #include <limits.h>
 #include "text_editor.h"
+#include "text_simd.h"
+#include "text_thread.h"
 #include "plugin_manager.h"
+#include "benchmark.h"
+#include "text_grep.h"
 
 /* 全局文本缓冲区 */
 static TextBuffer g_buffer;
@@ -32,6 +36,7 @@ void menu_modify_substring(void);
 void menu_delete_substring(void);
 void menu_display_text(void);
 void menu_plugins(void);
+void menu_undo_redo(void);
 int confirm_exit(void);
 
 /* UI 辅助函数 */
@@ -139,9 +144,10 @@ void display_text(TextBuffer *buf) {
         printf("(空文档)\n");
     } else {
         for (int i = 0; i < count; i++) {
-            const char *line = get_line(buf, i);
+            int len = 0;
+            const char *line = get_line_view(buf, i, &len);
             if (line) {
-                printf("%3d | %s\n", i + 1, line);
+                printf("%3d | %.*s\n", i + 1, len, line);
             }
         }
     }
@@ -164,9 +170,10 @@ void display_menu(void) {
     printf("║  8. 删除指定子串                         ║\n");
     printf("║  9. 显示当前文本                         ║\n");
     printf("║ 10. 插件管理                             ║\n");
+    printf("║ 11. 撤销/重做                            ║\n");
     printf("║  0. 退出系统                             ║\n");
     printf("╚══════════════════════════════════════════╝\n");
-    printf("请输入选项 (0-10): ");
+    printf("请输入选项 (0-11): ");
 }
 
 /*
@@ -181,7 +188,7 @@ int input_text_ui(TextBuffer *buf) {
     printf("提示: 支持大小写英文字母、数字、标点符号及空格\n");
     printf("--------------------------------------------------\n");
     
-    while (buf->line_count < MAX_LINES) {
+    for (;;) {
         printf("第%d行: ", buf->line_count + 1);
         
         if (fgets(line, sizeof(line), stdin) == NULL) {
@@ -203,7 +210,10 @@ int input_text_ui(TextBuffer *buf) {
         }
         
         /* 复制到缓冲区 */
-        insert_line(buf, buf->line_count, line);
+        if (insert_line(buf, buf->line_count, line) != 0) {
+            printf("错误: 内存不足，停止输入\n");
+            break;
+        }
     }
     
     printf("--------------------------------------------------\n");
@@ -246,7 +256,10 @@ void menu_input_text(void) {
         }
     }
     
+    /* 一次输入的所有行作为一条命令撤销 */
+    undo_group_begin(&g_buffer);
     input_text_ui(&g_buffer);
+    undo_group_end(&g_buffer);
     
     /* 显示输入结果 */
     if (g_buffer.line_count > 0) {
@@ -277,8 +290,35 @@ void menu_open_file(void) {
         return;
     }
     
-    if (file_open(&g_buffer, filename) == 0) {
+    bool mapped = read_yes_no("是否以内存映射方式打开（适合大文件）? (y/n): ");
+    int rc = mapped ? file_open_mapped(&g_buffer, filename) : file_open(&g_buffer, filename);
+    if (rc == 0) {
         printf("成功打开文件 '%s'，共读取 %d 行\n", filename, g_buffer.line_count);
+        LineIndexStats index_stats;
+        get_line_index_stats(&g_buffer, &index_stats);
+        double gbps = index_stats.build_seconds > 0
+            ? (double)index_stats.bytes_scanned / index_stats.build_seconds / 1e9 : 0.0;
+        printf("行索引: %.2f MB，用时 %.3f ms（%.2f GB/s，%s）\n",
+               (double)index_stats.bytes_scanned / (1024.0 * 1024.0),
+               index_stats.build_seconds * 1000.0, gbps,
+               simd_level_name((SimdLevel)index_stats.simd_level));
+        if (index_stats.utf8_valid) {
+            printf("编码校验: 合法 UTF-8，共 %zu 个字符（用时 %.3f ms）\n",
+                   index_stats.chars, index_stats.validate_seconds * 1000.0);
+        } else {
+            printf("警告: 文件包含非法 UTF-8 字节，非法字节将按单字节字符处理\n");
+        }
+        if (read_yes_no("是否建立三元组查找索引（加速大文件上的查找与替换）? (y/n): ")) {
+            SearchIndexStats search_stats;
+            if (search_index_build(&g_buffer) == 0) {
+                get_search_index_stats(&g_buffer, &search_stats);
+                printf("查找索引: %d 个三元组，占用 %.2f MB，用时 %.3f ms\n",
+                       search_stats.trigrams, (double)search_stats.memory_bytes / (1024.0 * 1024.0),
+                       search_stats.build_seconds * 1000.0);
+            } else {
+                printf("警告: 内存不足，未建立查找索引\n");
+            }
+        }
         display_text(&g_buffer);
     } else {
         printf("错误: 无法打开文件 '%s'\n", filename);
@@ -361,7 +401,7 @@ void menu_statistics(void) {
     display_text(&g_buffer);
     
     /* 统计并显示结果 */
-    CharStatistics stats = count_characters(&g_buffer);
+    CharStatistics stats = get_char_statistics(&g_buffer);
     display_statistics(&stats);
 }
 
@@ -390,24 +430,36 @@ void menu_find_substring(void) {
         return;
     }
     
-    int count = 0;
-    SearchResult *results = find_all_occurrences(&g_buffer, substr, &count);
+    bool nocase = read_yes_no("是否忽略大小写? (y/n): ");
+    
+    /* 只收集要显示的前若干处，超出时再单独计数，避免大文件上分配海量结果 */
+    SearchResults results;
+    search_results_init(&results, SEARCH_DISPLAY_LIMIT);
+    int count;
+    if (nocase) {
+        find_occurrences_nocase(&g_buffer, substr, &results);
+        count = results.truncated ? find_substring_count_nocase(&g_buffer, substr) : results.count;
+    } else {
+        find_occurrences(&g_buffer, substr, &results);
+        count = results.truncated ? find_substring_count(&g_buffer, substr) : results.count;
+    }
     
     printf("\n========== 查找结果 ==========\n");
     printf("查找子串: \"%s\"\n", substr);
     printf("------------------------------\n");
     
-    if (results != NULL && count > 0) {
-        for (int i = 0; i < count; i++) {
-            int line_idx = results[i].line;
-            int col_idx = results[i].column;
-            const char *line_content = get_line(&g_buffer, line_idx);
-            if (line_content) {
-                printf("第%d行，第%d列: %s\n", line_idx + 1, col_idx + 1, line_content);
-            }
+    for (int i = 0; i < results.count; i++) {
+        int line_idx = results.items[i].line;
+        int col_idx = results.items[i].column;
+        const char *line_content = get_line(&g_buffer, line_idx);
+        if (line_content) {
+            printf("第%d行，第%d列: %s\n", line_idx + 1, col_idx + 1, line_content);
         }
-        free(results);
     }
+    if (results.truncated) {
+        printf("...（仅显示前 %d 处）\n", results.count);
+    }
+    search_results_free(&results);
     
     printf("------------------------------\n");
     printf("共找到 %d 处匹配\n", count);
@@ -440,8 +492,8 @@ void menu_insert_substring(void) {
         return;
     }
     
-    printf("第%d行内容: %s\n", line, g_buffer.lines[line - 1]);
-    int line_chars = utf8_strlen_chars(g_buffer.lines[line - 1]);
+    printf("第%d行内容: %s\n", line, get_line(&g_buffer, line - 1));
+    int line_chars = get_line_char_count(&g_buffer, line - 1);
     snprintf(prompt, sizeof(prompt), "列号 (1-%d): ", line_chars + 1);
     if (!read_int_range(prompt, 1, line_chars + 1, &col)) {
         printf("输入无效\n");
@@ -507,8 +559,8 @@ void menu_modify_substring(void) {
                 return;
             }
             
-            printf("第%d行内容: %s\n", line, g_buffer.lines[line - 1]);
-            int line_chars = utf8_strlen_chars(g_buffer.lines[line - 1]);
+            printf("第%d行内容: %s\n", line, get_line(&g_buffer, line - 1));
+            int line_chars = get_line_char_count(&g_buffer, line - 1);
             snprintf(prompt, sizeof(prompt), "列号 (1-%d): ", line_chars);
             if (!read_int_range(prompt, 1, line_chars, &col)) {
                 printf("无效的列号\n");
@@ -545,8 +597,8 @@ void menu_modify_substring(void) {
                 return;
             }
             
-            printf("第%d行内容: %s\n", line, g_buffer.lines[line - 1]);
-            int line_chars = utf8_strlen_chars(g_buffer.lines[line - 1]);
+            printf("第%d行内容: %s\n", line, get_line(&g_buffer, line - 1));
+            int line_chars = get_line_char_count(&g_buffer, line - 1);
             snprintf(prompt, sizeof(prompt), "列号 (1-%d): ", line_chars);
             if (!read_int_range(prompt, 1, line_chars, &col)) {
                 printf("无效的列号\n");
@@ -584,7 +636,10 @@ void menu_modify_substring(void) {
                 return;
             }
             
-            int count = replace_all(&g_buffer, oldstr, newstr);
+            bool nocase = read_yes_no("是否忽略大小写? (y/n): ");
+            
+            int count = nocase ? replace_all_nocase(&g_buffer, oldstr, newstr)
+                               : replace_all_parallel(&g_buffer, oldstr, newstr, 0);
             if (count > 0) {
                 printf("\n成功替换 %d 处!\n", count);
                 printf("\n--- 操作后文本 ---\n");
@@ -645,7 +700,7 @@ void menu_delete_substring(void) {
         return;
     }
     
-    int deleted = delete_substring(&g_buffer, substr);
+    int deleted = delete_substring_parallel(&g_buffer, substr, 0);
     if (deleted >= 0) {
         printf("\n成功删除 %d 处子串!\n", deleted);
         printf("\n--- 操作后文本 ---\n");
@@ -663,7 +718,7 @@ void menu_display_text(void) {
     
     /* 同时显示统计信息 */
     if (g_buffer.line_count > 0) {
-        CharStatistics stats = count_characters(&g_buffer);
+        CharStatistics stats = get_char_statistics(&g_buffer);
         display_statistics(&stats);
     }
 }
@@ -735,6 +790,54 @@ void menu_plugins(void) {
     }
 }
 
+/*
+ * 菜单: 撤销/重做
+ */
+void menu_undo_redo(void) {
+    int choice;
+
+    while (1) {
+        UndoStats stats;
+        get_undo_stats(&g_buffer, &stats);
+        printf("\n===== 撤销/重做 =====\n");
+        printf("可撤销 %d 步，可重做 %d 步（日志占用 %.2f MB，上限 %.2f MB）\n",
+               stats.undo_groups, stats.redo_groups,
+               (double)stats.memory_bytes / (1024.0 * 1024.0),
+               (double)stats.limit_bytes / (1024.0 * 1024.0));
+        printf("1. 撤销\n");
+        printf("2. 重做\n");
+        printf("3. 返回主菜单\n");
+
+        if (!read_int_range("请选择: ", 1, 3, &choice)) {
+            printf("输入无效\n");
+            continue;
+        }
+
+        switch (choice) {
+            case 1:
+                if (undo_edit(&g_buffer) == 0) {
+                    printf("已撤销\n");
+                    display_text(&g_buffer);
+                } else {
+                    printf("没有可撤销的操作\n");
+                }
+                break;
+            case 2:
+                if (redo_edit(&g_buffer) == 0) {
+                    printf("已重做\n");
+                    display_text(&g_buffer);
+                } else {
+                    printf("没有可重做的操作\n");
+                }
+                break;
+            case 3:
+                return;
+            default:
+                printf("无效选择\n");
+        }
+    }
+}
+
 /*
  * 确认退出
  */
@@ -785,13 +888,60 @@ int confirm_exit(void) {
     return 1;
 }
 
+/*
+ * 命令行批量查找：--grep [-e] <查找内容> <目录或文件>
+ * -e 表示按正则表达式查找；匹配行写到标准输出，汇总写到标准错误
+ * 返回进程退出码：有匹配为 0，无匹配为 1，出错为 2（与 grep 相同）
+ */
+static int run_grep(int argc, char *argv[]) {
+    GrepOptions options = { NULL, 0, 0, stdout };
+    int i = 0;
+    if (i < argc && strcmp(argv[i], "-e") == 0) {
+        options.use_regex = 1;
+        i++;
+    }
+    if (argc - i != 2) {
+        fprintf(stderr, "用法: --grep [-e] <查找内容> <目录或文件>\n");
+        return 2;
+    }
+    options.pattern = argv[i];
+
+    GrepStats stats;
+    const char *error = NULL;
+    if (grep_path(argv[i + 1], &options, &stats, &error) != 0) {
+        fprintf(stderr, "错误: %s\n", error ? error : "查找失败");
+        return 2;
+    }
+    fprintf(stderr, "共查找 %d 个文件（跳过 %d 个），%d 个文件中 %lld 行含匹配，共 %lld 处；"
+            "用时 %.3f ms，工作窃取 %d 次\n",
+            stats.files, stats.skipped, stats.matched_files, stats.matched_lines, stats.matches,
+            stats.seconds * 1000.0, stats.steals);
+    return stats.matches > 0 ? 0 : 1;
+}
+
 /*
  * 主函数
+ * 命令行参数 --bench [名称] 运行基准测试后退出，--grep 见 run_grep
  */
-int main(void) {
+int main(int argc, char *argv[]) {
     int choice;
     bool running = true;
 
+    /* --threads N 设置并行操作的线程数（默认使用全部 CPU） */
+    if (argc > 2 && strcmp(argv[1], "--threads") == 0) {
+        text_set_thread_count(atoi(argv[2]));
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmarks(argc > 2 ? argv[2] : NULL) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--grep") == 0) {
+        return run_grep(argc - 2, argv + 2);
+    }
+
     /* 初始化缓冲区 */
     buffer_init(&g_buffer);
     /* 初始化插件管理器 */
@@ -802,8 +952,8 @@ int main(void) {
     while (running) {
         display_menu();
 
-        if (!read_int_range(NULL, 0, 10, &choice)) {
-            printf("输入无效，请输入数字 0-10\n");
+        if (!read_int_range(NULL, 0, 11, &choice)) {
+            printf("输入无效，请输入数字 0-11\n");
             continue;
         }
 
@@ -838,6 +988,9 @@ int main(void) {
             case 10:
                 menu_plugins();
                 break;
+            case 11:
+                menu_undo_redo();
+                break;
             case 0:
                 if (confirm_exit()) {
                     running = false;
@@ -845,11 +998,12 @@ int main(void) {
                 }
                 break;
             default:
-                printf("无效选项，请输入 0-10\n");
+                printf("无效选项，请输入 0-11\n");
                 break;
         }
     }
 
     plugin_manager_cleanup();
+    buffer_clear(&g_buffer);
     return 0;
 }
@@ -22,6 +22,14 @@ typedef struct EditorAPI {
     int (*read_file)(const char* path, char* out, size_t out_sz);
     int (*write_file)(const char* path, const char* data);
     int (*http_get)(const char* url, char* out, size_t out_sz);
+    /*
+     * 只读快照：可交给插件自己的后台线程读取（如统计、上传全文）
+     * snapshot_create 只能在命令回调中调用；快照可在任意一个线程中读取，用完须释放且只释放一次
+     * 有快照存在时不能覆盖保存以映射方式打开的文件；其余接口都只能在编辑器线程中调用
+     */
+    TextSnapshot* (*snapshot_create)(void);
+    void (*snapshot_release)(TextSnapshot* snap);
+    size_t (*get_buffer_content)(const TextSnapshot* snap, char* out, size_t out_sz);
 } EditorAPI;
 
 /* 插件初始化函数签名（DLL 出口） */
@@ -146,8 +146,7 @@ static int api_get_line_count(void) {
 
 static const char* api_get_line(int line_num) {
     if (!g_buf) return NULL;
-    if (line_num < 0 || line_num >= g_buf->line_count) return NULL;
-    return g_buf->lines[line_num];
+    return get_line(g_buf, line_num);
 }
 
 static int api_insert_line(int line_num, const char* text) {
@@ -162,11 +161,20 @@ static int api_delete_line(int line_num) {
 
 static int api_replace_line(int line_num, const char* text) {
     if (!g_buf) return -1;
-    if (line_num < 0 || line_num >= g_buf->line_count) return -1;
-    if ((int)strlen(text) > MAX_LINE_LENGTH) return -1;
-    strncpy_s(g_buf->lines[line_num], sizeof(g_buf->lines[line_num]), text, _TRUNCATE);
-    g_buf->modified = 1;
-    return 0;
+    return replace_line(g_buf, line_num, text);
+}
+
+static TextSnapshot* api_snapshot_create(void) {
+    if (!g_buf) return NULL;
+    return snapshot_create(g_buf);
+}
+
+static void api_snapshot_release(TextSnapshot* snap) {
+    snapshot_release(snap);
+}
+
+static size_t api_get_buffer_content(const TextSnapshot* snap, char* out, size_t out_sz) {
+    return get_buffer_content(snap, out, out_sz);
 }
 
 static void api_print_msg(const char* msg) {
@@ -207,7 +215,10 @@ static EditorAPI g_api = {
     api_register_command,
     api_read_file,
     api_write_file,
-    api_http_get
+    api_http_get,
+    api_snapshot_create,
+    api_snapshot_release,
+    api_get_buffer_content
 };
 
 /* ================= 管理器 ================= */
@@ -311,7 +322,10 @@ int execute_plugin_command(const char* cmd_name) {
     while (p) {
         if (strcmp(p->name, cmd_name) == 0) {
             if (p->func) {
+                /* 插件命令对缓冲区的全部修改作为一步撤销 */
+                undo_group_begin(g_buf);
                 p->func();
+                undo_group_end(g_buf);
                 return 0;
             }
             return -1;
@@ -2,36 +2,557 @@
  * 简易文本编辑器 - 核心功能实现
  */
 
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 #include "text_editor.h"
+#include "text_simd.h"
+#include "text_thread.h"
 
-static void trim_line_endings(char *line) {
-    if (!line) return;
-    size_t len = strlen(line);
-    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-        line[--len] = '\0';
+#define LINE_SCAN_BATCH     4096    /* 每批收集的换行符位置数 */
+
+/* 定义后 get_char_statistics 每次都与完整重新统计交叉核对（Debug 构建默认开启） */
+#if defined(_DEBUG) && !defined(TEXT_STATS_CHECK)
+#define TEXT_STATS_CHECK
+#endif
+
+/* ========================== 追加区与行表管理 ========================== */
+
+static const char g_empty_line[1] = "";
+
+static int utf8_count_chars(const char *s, int len);
+static void stats_apply_piece(TextBuffer *buf, const LinePiece *piece, int sign);
+static void search_index_apply(TextBuffer *buf, LinePiece *piece, int slot, int sign);
+static void search_index_move(TextBuffer *buf, int slot, int n);
+
+/* 撤销日志的行级记录类型 */
+enum { UNDO_SET, UNDO_INSERT, UNDO_DELETE };
+static void undo_record(TextBuffer *buf, int kind, int line, const LinePiece *before, const LinePiece *after);
+static void undo_detach_views(TextBuffer *buf);
+static void undo_free(TextBuffer *buf);
+
+/*
+ * 在追加区链表 head/tail 中预留 need 字节，返回写入位置；空间不足时新开一块
+ * 已有块从不移动，因此之前发布出去的行指针保持有效
+ */
+static char* add_chain_reserve(AddBlock **head, AddBlock **tail, size_t need) {
+    AddBlock *last = *tail;
+    if (last == NULL || last->capacity - last->used < need) {
+        size_t cap = need > ADD_BLOCK_SIZE ? need : ADD_BLOCK_SIZE;
+        AddBlock *block = (AddBlock*)malloc(sizeof(AddBlock) + cap);
+        if (block == NULL) return NULL;
+        block->next = NULL;
+        block->used = 0;
+        block->capacity = cap;
+        block->data = (char*)(block + 1);
+        if (last) {
+            last->next = block;
+        } else {
+            *head = block;
+        }
+        *tail = block;
+        last = block;
+    }
+    return last->data + last->used;
+}
+
+/* 释放追加区链表、原始区和文件映射 */
+static void text_storage_free(AddBlock *head, char *original, FileMapping *mapping) {
+    while (head) {
+        AddBlock *next = head->next;
+        free(head);
+        head = next;
+    }
+    free(original);
+    file_map_close(mapping);
+}
+
+/*
+ * 快照共享的文本存储：原始区、文件映射和追加区只追加不改写，快照直接指向其中的行；
+ * 缓冲区清空时把它们转交到这里，等最后一个快照释放后才真正释放
+ */
+struct SnapshotStore {
+    volatile long refs;     /* 缓冲区（清空前）与各快照各持一个引用 */
+    AddBlock *add_head;     /* 以下为缓冲区清空时转交过来的文本 */
+    char *original;
+    FileMapping mapping;
+    SnapshotStore *prev;    /* 持有映射时挂在 g_mapped_stores 链表上 */
+    SnapshotStore *next;
+};
+
+/* 缓冲区清空后仍由快照持有的文件映射；快照可以在任意线程中释放，链表由锁保护 */
+static TextMutex g_mapped_lock = TEXT_MUTEX_INIT;
+static SnapshotStore *g_mapped_stores = NULL;
+
+static void snapshot_store_release(SnapshotStore *store) {
+    if (text_atomic_add(&store->refs, -1) != 0) return;
+    if (store->mapping.data != NULL) {
+        text_mutex_lock(&g_mapped_lock);
+        if (store->prev != NULL) store->prev->next = store->next;
+        else g_mapped_stores = store->next;
+        if (store->next != NULL) store->next->prev = store->prev;
+        text_mutex_unlock(&g_mapped_lock);
+    }
+    text_storage_free(store->add_head, store->original, &store->mapping);
+    free(store);
+}
+
+static char* add_reserve(TextBuffer *buf, size_t need) {
+    return add_chain_reserve(&buf->add_head, &buf->add_tail, need);
+}
+
+static void add_commit(TextBuffer *buf, size_t used) {
+    buf->add_tail->used += used;
+}
+
+/* 在追加区中分配按 align 对齐的 size 字节（用于缓存数据） */
+static void* add_alloc(TextBuffer *buf, size_t size, size_t align) {
+    char *raw = add_reserve(buf, size + align - 1);
+    if (raw == NULL) return NULL;
+    size_t pad = (align - (size_t)((uintptr_t)raw % align)) % align;
+    add_commit(buf, pad + size);
+    return raw + pad;
+}
+
+/*
+ * 把三段字节拼接后写入追加区，作为一行的新内容（以 '\0' 结尾）
+ */
+static const char* add_line_image(TextBuffer *buf,
+                                  const char *a, size_t alen,
+                                  const char *b, size_t blen,
+                                  const char *c, size_t clen) {
+    size_t total = alen + blen + clen;
+    if (total == 0) return g_empty_line;
+    char *dst = add_reserve(buf, total + 1);
+    if (dst == NULL) return NULL;
+    if (alen) memcpy(dst, a, alen);
+    if (blen) memcpy(dst + alen, b, blen);
+    if (clen) memcpy(dst + alen + blen, c, clen);
+    dst[total] = '\0';
+    add_commit(buf, total + 1);
+    return dst;
+}
+
+#define LINE_CHUNK_MASK     (LINE_CHUNK_SLOTS - 1)     /* 槽位在块内的下标 */
+
+/* 分配有 count 个块指针的行表（块指针未初始化） */
+static LineTable* line_table_alloc(int count) {
+    LineTable *table = (LineTable*)malloc(sizeof(LineTable) + sizeof(LineChunk*) * (size_t)count);
+    if (table == NULL) return NULL;
+    table->refs = 1;
+    table->count = count;
+    table->chunks = (LineChunk**)(table + 1);
+    return table;
+}
+
+static void line_chunk_release(LineChunk *chunk) {
+    if (chunk != NULL && text_atomic_add(&chunk->refs, -1) == 0) {
+        free(chunk);
+    }
+}
+
+/* 释放一个行表引用，最后一个引用释放时连同不再被引用的块一起释放（可在任意线程调用） */
+static void line_table_release(LineTable *table) {
+    if (table == NULL || text_atomic_add(&table->refs, -1) != 0) return;
+    for (int c = 0; c < table->count; c++) {
+        line_chunk_release(table->chunks[c]);
+    }
+    free(table);
+}
+
+/* 物理槽位中的行片段（只读访问，或只写字符数等缓存字段） */
+static LinePiece* slot_at(const TextBuffer *buf, int slot) {
+    return &buf->lines->chunks[slot >> LINE_CHUNK_SHIFT]->slots[slot & LINE_CHUNK_MASK];
+}
+
+/* 逻辑行对应的物理槽位 */
+static int line_slot(const TextBuffer *buf, int line_num) {
+    return line_num < buf->gap_start ? line_num : line_num + (buf->gap_end - buf->gap_start);
+}
+
+/*
+ * 保证槽位 [from, to) 所在的块只被本缓冲区引用，之后可以就地改写：
+ * 行表被快照共享时先复制行表，块被共享时复制该块；内存不足返回 -1，内容不变
+ * 快照只读取行片段的 text 和 length，字符数、检查点和索引编号这些缓存字段可以直接写入共享块
+ */
+static int lines_own(TextBuffer *buf, int from, int to) {
+    if (from >= to) return 0;
+    LineTable *table = buf->lines;
+    if (text_atomic_load(&table->refs) > 1) {
+        LineTable *copy = line_table_alloc(table->count);
+        if (copy == NULL) return -1;
+        for (int c = 0; c < table->count; c++) {
+            copy->chunks[c] = table->chunks[c];
+            text_atomic_add(&copy->chunks[c]->refs, 1);
+        }
+        line_table_release(table);
+        buf->lines = table = copy;
+    }
+    for (int c = from >> LINE_CHUNK_SHIFT; c <= (to - 1) >> LINE_CHUNK_SHIFT; c++) {
+        LineChunk *chunk = table->chunks[c];
+        if (text_atomic_load(&chunk->refs) == 1) continue;
+        LineChunk *own = (LineChunk*)malloc(sizeof(LineChunk));
+        if (own == NULL) return -1;
+        own->refs = 1;
+        memcpy(own->slots, chunk->slots, sizeof(own->slots));
+        line_chunk_release(chunk);
+        table->chunks[c] = own;
+    }
+    return 0;
+}
+
+/* 可以就地改写的槽位，内存不足返回 NULL */
+static LinePiece* slot_mut(TextBuffer *buf, int slot) {
+    if (lines_own(buf, slot, slot + 1) != 0) return NULL;
+    return slot_at(buf, slot);
+}
+
+/*
+ * 把槽位 [src, src + n) 复制到 [dst, dst + n)（区间可以重叠），按块分段进行
+ * 调用前目标区间必须已经独占（lines_own）
+ */
+static void slots_move(TextBuffer *buf, int dst, int src, int n) {
+    if (dst > src) {
+        /* 从尾部往前复制，避免覆盖尚未复制的源槽位 */
+        while (n > 0) {
+            int k = n;
+            int dst_room = ((dst + n - 1) & LINE_CHUNK_MASK) + 1;
+            int src_room = ((src + n - 1) & LINE_CHUNK_MASK) + 1;
+            if (k > dst_room) k = dst_room;
+            if (k > src_room) k = src_room;
+            n -= k;
+            memmove(slot_at(buf, dst + n), slot_at(buf, src + n), sizeof(LinePiece) * (size_t)k);
+        }
+    } else if (dst < src) {
+        int done = 0;
+        while (done < n) {
+            int k = n - done;
+            int dst_room = LINE_CHUNK_SLOTS - ((dst + done) & LINE_CHUNK_MASK);
+            int src_room = LINE_CHUNK_SLOTS - ((src + done) & LINE_CHUNK_MASK);
+            if (k > dst_room) k = dst_room;
+            if (k > src_room) k = src_room;
+            memmove(slot_at(buf, dst + done), slot_at(buf, src + done), sizeof(LinePiece) * (size_t)k);
+            done += k;
+        }
+    }
+}
+
+/*
+ * 保证间隙至少能容纳 need 个行片段；扩容时在间隙终点所在块之后插入新块，
+ * 其后的块原样后移（只搬动块指针，不复制行片段）
+ * 间隙终点不在块边界上时，该块的前半部分仍属于间隙之前，复制一份放在新块的最前面
+ */
+static int ensure_gap(TextBuffer *buf, int need) {
+    int gap = buf->gap_end - buf->gap_start;
+    if (gap >= need) return 0;
+    if (need > INT_MAX - buf->line_count) return -1;
+
+    int max_count = INT_MAX / LINE_CHUNK_SLOTS;
+    int old_count = buf->lines ? buf->lines->count : 0;
+    int count = old_count > 0 ? old_count : 1;
+    while ((long long)count * LINE_CHUNK_SLOTS - buf->line_count < need) {
+        if (count == max_count) return -1;
+        count = count > max_count / 2 ? max_count : count * 2;
+    }
+
+    LineTable *table = line_table_alloc(count);
+    if (table == NULL) return -1;
+    int grow = count - old_count;
+    int split = buf->gap_end >> LINE_CHUNK_SHIFT;
+    int offset = buf->gap_end & LINE_CHUNK_MASK;
+    for (int c = split; c < split + grow; c++) {
+        LineChunk *chunk = (LineChunk*)malloc(sizeof(LineChunk));
+        if (chunk == NULL) {
+            for (int k = split; k < c; k++) free(table->chunks[k]);
+            free(table);
+            return -1;
+        }
+        chunk->refs = 1;
+        if (c == split && offset > 0) {
+            memcpy(chunk->slots, buf->lines->chunks[split]->slots, sizeof(LinePiece) * (size_t)offset);
+        }
+        table->chunks[c] = chunk;
+    }
+    for (int c = 0; c < old_count; c++) {
+        LineChunk *chunk = buf->lines->chunks[c];
+        table->chunks[c < split ? c : c + grow] = chunk;
+        text_atomic_add(&chunk->refs, 1);
+    }
+    line_table_release(buf->lines);
+
+    buf->lines = table;
+    buf->gap_end += grow * LINE_CHUNK_SLOTS;
+    buf->line_capacity = count * LINE_CHUNK_SLOTS;
+    /* 槽位整体变化，字符偏移树下次换算时重建；索引中间隙之后各行的槽位同步后移 */
+    buf->char_tree_valid = 0;
+    search_index_move(buf, buf->gap_end, buf->line_capacity - buf->gap_end);
+    return 0;
+}
+
+/* ========================== 字符偏移树状数组 ========================== */
+
+/* 行片段的字符数（按需计算并缓存） */
+static int piece_chars(LinePiece *piece) {
+    if (piece->chars < 0) {
+        piece->chars = utf8_count_chars(piece->text, piece->length);
+    }
+    return piece->chars;
+}
+
+static void char_tree_add(TextBuffer *buf, int slot, long long delta) {
+    for (int i = slot + 1; i <= buf->line_capacity; i += i & -i) {
+        buf->char_tree[i] += delta;
+    }
+}
+
+/* 物理槽位 [0, slot) 的权重之和 */
+static long long char_tree_prefix(const TextBuffer *buf, int slot) {
+    long long sum = 0;
+    for (int i = slot; i > 0; i -= i & -i) {
+        sum += buf->char_tree[i];
+    }
+    return sum;
+}
+
+/*
+ * 线性时间建立树状数组：每个非间隙槽位权重为该行字符数 + 1（换行符）
+ */
+static int char_tree_build(TextBuffer *buf) {
+    int cap = buf->line_capacity;
+    long long *tree = (long long*)realloc(buf->char_tree, sizeof(long long) * ((size_t)cap + 1));
+    if (tree == NULL) return -1;
+    buf->char_tree = tree;
+
+    tree[0] = 0;
+    for (int slot = 0; slot < cap; slot++) {
+        int in_gap = slot >= buf->gap_start && slot < buf->gap_end;
+        tree[slot + 1] = in_gap ? 0 : (long long)piece_chars(slot_at(buf, slot)) + 1;
+    }
+    for (int i = 1; i <= cap; i++) {
+        int parent = i + (i & -i);
+        if (parent > 0 && parent <= cap) tree[parent] += tree[i];
+    }
+    buf->char_tree_valid = 1;
+    return 0;
+}
+
+static int ensure_char_tree(TextBuffer *buf) {
+    if (buf->char_tree_valid) return 0;
+    return char_tree_build(buf);
+}
+
+/* 行片段在间隙数组中移动时同步树状数组；一次移动太多时改为下次重建 */
+static void char_tree_move(TextBuffer *buf, int from, int to, int n) {
+    if (!buf->char_tree_valid || from == to) return;
+    if (n > buf->line_capacity / 16) {
+        buf->char_tree_valid = 0;
+        return;
+    }
+    for (int k = 0; k < n; k++) {
+        long long weight = (long long)slot_at(buf, from + k)->chars + 1;
+        char_tree_add(buf, from + k, -weight);
+        char_tree_add(buf, to + k, weight);
+    }
+}
+
+/*
+ * 替换逻辑行 line_num 的内容，并更新字符数缓存与树状数组
+ * chars 为新内容的字符数（-1 表示在这里统计）；with_stats 为 0 时全文统计由调用方另行合并
+ * 返回改写后的行片段；该行所在块与快照共享且复制失败时返回 NULL，内容不变
+ */
+static LinePiece* piece_replace(TextBuffer *buf, int line_num, const char *text, int length,
+                                int chars, int with_stats) {
+    int slot = line_slot(buf, line_num);
+    LinePiece *piece = slot_mut(buf, slot);
+    if (piece == NULL) return NULL;
+
+    LinePiece before = *piece;
+    long long old_weight = (long long)piece->chars + 1;
+    if (with_stats) stats_apply_piece(buf, piece, -1);
+    search_index_apply(buf, piece, slot, -1);
+    buf->revision++;
+    piece->text = text;
+    piece->length = length;
+    piece->flags = 0;
+    piece->chars = chars >= 0 ? chars : utf8_count_chars(text, length);
+    piece->checkpoints = NULL;
+    if (buf->char_tree_valid) {
+        char_tree_add(buf, slot, (long long)piece->chars + 1 - old_weight);
+    }
+    if (with_stats) stats_apply_piece(buf, piece, 1);
+    search_index_apply(buf, piece, slot, 1);
+    undo_record(buf, UNDO_SET, line_num, &before, piece);
+    return piece;
+}
+
+static int piece_assign(TextBuffer *buf, int line_num, const char *text, int length) {
+    return piece_replace(buf, line_num, text, length, -1, 1) != NULL ? 0 : -1;
+}
+
+/*
+ * 把间隙移动到逻辑行 pos 之前，移动代价与距离成正比；
+ * 顺序插入/删除时间隙始终跟随编辑位置，因此均摊为 O(1)
+ * 目标槽位所在块与快照共享且复制失败时返回 -1，间隙不动
+ */
+static int move_gap(TextBuffer *buf, int pos) {
+    if (pos < buf->gap_start) {
+        int n = buf->gap_start - pos;
+        if (lines_own(buf, buf->gap_end - n, buf->gap_end) != 0) return -1;
+        char_tree_move(buf, pos, buf->gap_end - n, n);
+        slots_move(buf, buf->gap_end - n, pos, n);
+        search_index_move(buf, buf->gap_end - n, n);
+        buf->gap_start -= n;
+        buf->gap_end -= n;
+    } else if (pos > buf->gap_start) {
+        int n = pos - buf->gap_start;
+        if (lines_own(buf, buf->gap_start, buf->gap_start + n) != 0) return -1;
+        char_tree_move(buf, buf->gap_end, buf->gap_start, n);
+        slots_move(buf, buf->gap_start, buf->gap_end, n);
+        search_index_move(buf, buf->gap_start, n);
+        buf->gap_start += n;
+        buf->gap_end += n;
+    }
+    return 0;
+}
+
+static LinePiece* line_at(const TextBuffer *buf, int line_num) {
+    return slot_at(buf, line_slot(buf, line_num));
+}
+
+/* 在间隙起点追加一行，调用前须保证间隙非空且间隙起点所在块为独占 */
+static LinePiece* gap_push(TextBuffer *buf) {
+    buf->line_count++;
+    return slot_at(buf, buf->gap_start++);
+}
+
+/*
+ * 用 [byte_start, byte_end) 之外的原内容加上 newstr 组成该行的新内容
+ */
+static int line_splice(TextBuffer *buf, int line_num, int byte_start, int byte_end,
+                       const char *newstr, size_t newlen) {
+    const LinePiece *piece = line_at(buf, line_num);
+    const char *text = piece->text;
+    size_t tail_len = (size_t)(piece->length - byte_end);
+    size_t total = (size_t)byte_start + newlen + tail_len;
+    if (total > INT_MAX) return -1;
+
+    const char *image = add_line_image(buf, text, (size_t)byte_start,
+                                       newstr, newlen,
+                                       text + byte_end, tail_len);
+    if (image == NULL) return -1;
+
+    if (piece_assign(buf, line_num, image, (int)total) != 0) return -1;
+    buf->modified = 1;
+    return 0;
+}
+
+/*
+ * 把映射视图中的行复制到追加区，使其以 '\0' 结尾
+ * 只有被编辑或按 C 字符串访问的行才会走到这里
+ */
+static int materialize_line(TextBuffer *buf, int line_num) {
+    LinePiece *piece = line_at(buf, line_num);
+    if (!(piece->flags & LINE_FLAG_VIEW)) return 0;
+    const char *image = add_line_image(buf, piece->text, (size_t)piece->length, NULL, 0, NULL, 0);
+    if (image == NULL) return -1;
+    piece = slot_mut(buf, line_slot(buf, line_num));
+    if (piece == NULL) return -1;
+    piece->text = image;
+    piece->flags &= ~LINE_FLAG_VIEW;
+    return 0;
+}
+
+/* filename 是否正被清空前留下的快照以映射方式读取 */
+static int snapshot_maps_file(const char *filename) {
+    int found = 0;
+    text_mutex_lock(&g_mapped_lock);
+    for (const SnapshotStore *store = g_mapped_stores; store != NULL && !found; store = store->next) {
+        found = file_map_same_file(&store->mapping, filename);
+    }
+    text_mutex_unlock(&g_mapped_lock);
+    return found;
+}
+
+/*
+ * 解除文件映射：先把所有仍指向映射的行物化，再关闭映射
+ * 覆盖保存被映射的文件之前必须调用；仍有快照时它们可能正在读取映射，返回 -1
+ */
+static int detach_mapping(TextBuffer *buf) {
+    if (buf->mapping.data == NULL) return 0;
+    if (buf->snapshot_store != NULL && text_atomic_load(&buf->snapshot_store->refs) > 1) return -1;
+    for (int i = 0; i < buf->line_count; i++) {
+        if (materialize_line(buf, i) != 0) return -1;
     }
+    undo_detach_views(buf);
+    file_map_close(&buf->mapping);
+    return 0;
 }
 
 /* ========================== 初始化和清理函数 ========================== */
 
 /*
- * 初始化文本缓冲区
+ * 初始化文本缓冲区（不释放旧内容，仅用于未初始化的缓冲区）
  */
 void buffer_init(TextBuffer *buf) {
     if (buf == NULL) return;
     
-    memset(buf->lines, 0, sizeof(buf->lines));
+    buf->original = NULL;
+    buf->original_size = 0;
+    memset(&buf->mapping, 0, sizeof(buf->mapping));
+    memset(&buf->index_stats, 0, sizeof(buf->index_stats));
+    buf->add_head = NULL;
+    buf->add_tail = NULL;
+    buf->lines = NULL;
+    buf->line_capacity = 0;
+    buf->gap_start = 0;
+    buf->gap_end = 0;
+    buf->char_tree = NULL;
+    buf->char_tree_valid = 0;
+    memset(&buf->stats, 0, sizeof(buf->stats));
+    buf->stats_valid = 1;   /* 空缓冲区的统计恒为 0 */
+    buf->search_index = NULL;
+    buf->suffix_index = NULL;
+    buf->revision = 0;
+    buf->undo = NULL;
+    buf->snapshot_store = NULL;
     buf->line_count = 0;
     buf->modified = 0;
     memset(buf->filename, 0, sizeof(buf->filename));
 }
 
 /*
- * 清空文本缓冲区
+ * 清空文本缓冲区并释放全部内存
  */
 void buffer_clear(TextBuffer *buf) {
     if (buf == NULL) return;
+
+    /* 版本号跨清空继续递增，清空前开始的批次和取得的快照版本号不会与新内容重合 */
+    unsigned long long revision = buf->revision + 1;
+
+    if (buf->snapshot_store != NULL) {
+        /* 快照可能还在读取这些文本，交给快照存储，最后一个引用释放时一并释放 */
+        SnapshotStore *store = buf->snapshot_store;
+        store->add_head = buf->add_head;
+        store->original = buf->original;
+        store->mapping = buf->mapping;
+        if (store->mapping.data != NULL) {
+            text_mutex_lock(&g_mapped_lock);
+            store->next = g_mapped_stores;
+            if (g_mapped_stores != NULL) g_mapped_stores->prev = store;
+            g_mapped_stores = store;
+            text_mutex_unlock(&g_mapped_lock);
+        }
+        snapshot_store_release(store);
+    } else {
+        text_storage_free(buf->add_head, buf->original, &buf->mapping);
+    }
+    line_table_release(buf->lines);
+    free(buf->char_tree);
+    search_index_free(buf);
+    suffix_index_free(buf);
+    undo_free(buf);
     buffer_init(buf);
+    buf->revision = revision;
 }
 
 /* ========================== 缓冲区查询函数 ========================== */
@@ -40,9 +561,24 @@ int get_line_count(const TextBuffer *buf) {
     return buf ? buf->line_count : 0;
 }
 
+/*
+ * 获取以 '\0' 结尾的行内容
+ * 映射视图中的行在此首次物化（缓存行为，不改变文本，因此参数仍为 const）
+ */
 const char* get_line(const TextBuffer *buf, int line_num) {
     if (!buf || line_num < 0 || line_num >= buf->line_count) return NULL;
-    return buf->lines[line_num];
+    if (materialize_line((TextBuffer*)buf, line_num) != 0) return NULL;
+    return line_at(buf, line_num)->text;
+}
+
+/*
+ * 零拷贝获取行内容，返回的字节不保证以 '\0' 结尾，长度通过 length 返回
+ */
+const char* get_line_view(const TextBuffer *buf, int line_num, int *length) {
+    if (!buf || line_num < 0 || line_num >= buf->line_count) return NULL;
+    const LinePiece *piece = line_at(buf, line_num);
+    if (length) *length = piece->length;
+    return piece->text;
 }
 
 const char* get_filename(const TextBuffer *buf) {
@@ -55,32 +591,152 @@ int is_modified(const TextBuffer *buf) {
 
 /* ========================== 字符分类函数 ========================== */
 
-static int is_cjk_char(int cp) {
-    return (cp >= 0x4E00 && cp <= 0x9FFF) ||  /* CJK Unified Ideographs */
-           (cp >= 0x3400 && cp <= 0x4DBF) ||  /* Extension A */
-           (cp >= 0x20000 && cp <= 0x2A6DF) || /* Extension B */
-           (cp >= 0x2A700 && cp <= 0x2B73F) || /* Extension C-D */
-           (cp >= 0x2B740 && cp <= 0x2B81F) ||
-           (cp >= 0x2B820 && cp <= 0x2CEAF) ||
-           (cp >= 0xF900 && cp <= 0xFAFF);    /* Compatibility */
-}
+/* 字符类别，与 CharStatistics 的各计数字段一一对应 */
+enum {
+    CHAR_CLASS_LETTER,
+    CHAR_CLASS_DIGIT,
+    CHAR_CLASS_SPACE,
+    CHAR_CLASS_PUNCT,
+    CHAR_CLASS_CHINESE,
+    CHAR_CLASS_OTHER,
+    CHAR_CLASS_COUNT
+};
 
-static int is_cjk_punctuation_cp(int cp) {
-    return (cp >= 0x3000 && cp <= 0x303F) || /* CJK Symbols and Punctuation */
-           (cp >= 0xFE30 && cp <= 0xFE4F) || /* CJK Compatibility Forms */
-           (cp >= 0xFF00 && cp <= 0xFF65);   /* Fullwidth forms including punctuation */
-}
+/* 单字节类别表，与 is_letter/is_digit_char/is_space_char/is_punctuation 的判定一致 */
+#define L CHAR_CLASS_LETTER
+#define D CHAR_CLASS_DIGIT
+#define S CHAR_CLASS_SPACE
+#define P CHAR_CLASS_PUNCT
+#define O CHAR_CLASS_OTHER
+static const unsigned char g_ascii_class[256] = {
+    O, O, O, O, O, O, O, O, O, S, O, O, O, O, O, O, /* 00-0F */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 10-1F */
+    S, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P, /* 20-2F */
+    D, D, D, D, D, D, D, D, D, D, P, P, P, P, P, P, /* 30-3F */
+    P, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, /* 40-4F */
+    L, L, L, L, L, L, L, L, L, L, L, P, P, P, P, P, /* 50-5F */
+    P, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, /* 60-6F */
+    L, L, L, L, L, L, L, L, L, L, L, P, P, P, P, O, /* 70-7F */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 80-8F */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 90-9F */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* A0-AF */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* B0-BF */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* C0-CF */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* D0-DF */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* E0-EF */
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* F0-FF */
+};
+#undef L
+#undef D
+#undef S
+#undef P
+#undef O
 
-static int is_fullwidth_space(int cp) {
-    return cp == 0x3000; /* IDEOGRAPHIC SPACE */
+/* 非 ASCII 码点类别区间表，按起点升序且互不重叠（重叠部分已按原判定优先级拆开） */
+typedef struct {
+    int first;
+    int last;
+    unsigned char cls;
+} CodepointRange;
+
+static const CodepointRange g_codepoint_classes[] = {
+    { 0x3000,  0x3000,  CHAR_CLASS_SPACE   },  /* IDEOGRAPHIC SPACE */
+    { 0x3001,  0x303F,  CHAR_CLASS_PUNCT   },  /* CJK Symbols and Punctuation */
+    { 0x3400,  0x4DBF,  CHAR_CLASS_CHINESE },  /* Extension A */
+    { 0x4E00,  0x9FFF,  CHAR_CLASS_CHINESE },  /* CJK Unified Ideographs */
+    { 0xF900,  0xFAFF,  CHAR_CLASS_CHINESE },  /* Compatibility */
+    { 0xFE30,  0xFE4F,  CHAR_CLASS_PUNCT   },  /* CJK Compatibility Forms */
+    { 0xFF00,  0xFF0F,  CHAR_CLASS_PUNCT   },  /* Fullwidth forms */
+    { 0xFF10,  0xFF19,  CHAR_CLASS_DIGIT   },
+    { 0xFF1A,  0xFF20,  CHAR_CLASS_PUNCT   },
+    { 0xFF21,  0xFF3A,  CHAR_CLASS_LETTER  },
+    { 0xFF3B,  0xFF40,  CHAR_CLASS_PUNCT   },
+    { 0xFF41,  0xFF5A,  CHAR_CLASS_LETTER  },
+    { 0xFF5B,  0xFF65,  CHAR_CLASS_PUNCT   },
+    { 0x20000, 0x2A6DF, CHAR_CLASS_CHINESE },  /* Extension B */
+    { 0x2A700, 0x2CEAF, CHAR_CLASS_CHINESE },  /* Extension C-F */
+};
+
+/* 区间表二分查找，作为分页表的数据来源 */
+static int lookup_codepoint_range(int cp) {
+    int lo = 0;
+    int hi = (int)(sizeof(g_codepoint_classes) / sizeof(g_codepoint_classes[0])) - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < g_codepoint_classes[mid].first) {
+            hi = mid - 1;
+        } else if (cp > g_codepoint_classes[mid].last) {
+            lo = mid + 1;
+        } else {
+            return g_codepoint_classes[mid].cls;
+        }
+    }
+    return CHAR_CLASS_OTHER;
 }
 
-static int is_fullwidth_digit(int cp) {
-    return cp >= 0xFF10 && cp <= 0xFF19;
+/*
+ * 基本多文种平面按 256 个码点分页：整页同类的页直接给出类别；
+ * 类别混杂的页（CHAR_CLASS_MIXED + 序号）在首次统计时由区间表展开成逐码点的子表
+ */
+#define CHAR_CLASS_MIXED    0x80
+#define MIXED_PAGE_COUNT    4
+#define C  CHAR_CLASS_CHINESE
+#define O  CHAR_CLASS_OTHER
+#define M0 (CHAR_CLASS_MIXED + 0)
+#define M1 (CHAR_CLASS_MIXED + 1)
+#define M2 (CHAR_CLASS_MIXED + 2)
+#define M3 (CHAR_CLASS_MIXED + 3)
+static const unsigned char g_bmp_page_class[256] = {
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* 0000-0FFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* 1000-1FFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* 2000-2FFF */
+    M0, O , O , O , C , C , C , C , C , C , C , C , C , C , C , C, /* 3000-3FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , M1, C , C, /* 4000-4FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , C , C , C, /* 5000-5FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , C , C , C, /* 6000-6FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , C , C , C, /* 7000-7FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , C , C , C, /* 8000-8FFF */
+    C , C , C , C , C , C , C , C , C , C , C , C , C , C , C , C, /* 9000-9FFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* A000-AFFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* B000-BFFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* C000-CFFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* D000-DFFF */
+    O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O, /* E000-EFFF */
+    O , O , O , O , O , O , O , O , O , C , C , O , O , O , M2, M3, /* F000-FFFF */
+};
+#undef C
+#undef O
+#undef M0
+#undef M1
+#undef M2
+#undef M3
+
+static unsigned char g_mixed_page_class[MIXED_PAGE_COUNT][256];
+static int g_mixed_pages_ready = 0;
+
+/* 展开混杂页；须在开始统计（以及启动任何工作线程）之前调用 */
+static void init_codepoint_classes(void) {
+    if (g_mixed_pages_ready) return;
+    for (int page = 0; page < 256; page++) {
+        int cls = g_bmp_page_class[page];
+        if (cls < CHAR_CLASS_MIXED) continue;
+        for (int low = 0; low < 256; low++) {
+            g_mixed_page_class[cls - CHAR_CLASS_MIXED][low] =
+                (unsigned char)lookup_codepoint_range((page << 8) | low);
+        }
+    }
+    g_mixed_pages_ready = 1;
 }
 
-static int is_fullwidth_letter(int cp) {
-    return (cp >= 0xFF21 && cp <= 0xFF3A) || (cp >= 0xFF41 && cp <= 0xFF5A);
+static int classify_codepoint(int cp) {
+    if (cp < 0) return CHAR_CLASS_OTHER;
+    if (cp < 0x80) return g_ascii_class[cp];
+    if (cp < 0x10000) {
+        int cls = g_bmp_page_class[cp >> 8];
+        if (cls < CHAR_CLASS_MIXED) return cls;
+        return g_mixed_page_class[cls - CHAR_CLASS_MIXED][cp & 0xFF];
+    }
+    return lookup_codepoint_range(cp);
 }
 
 int is_letter(char c) {
@@ -111,45 +767,115 @@ static int utf8_char_length(unsigned char c) {
     return 1; /* 非法字节按单字节处理，避免死循环 */
 }
 
-int utf8_strlen_chars(const char *s) {
-    if (s == NULL) return 0;
+/*
+ * 统计 s 前 len 个字节中的字符数
+ * 合法 UTF-8 的字符数等于非续字节数，可直接用向量化内核；
+ * 含非法字节时回退到按首字节步进，保持原有计数语义
+ */
+static int utf8_count_chars(const char *s, int len) {
+    if (len >= UTF8_SIMD_MIN_BYTES) {
+        int valid;
+        size_t n = simd_utf8_count(s, (size_t)len, &valid);
+        if (valid) return (int)n;
+    }
     int count = 0;
-    for (int i = 0; s[i] != '\0'; ) {
-        int len = utf8_char_length((unsigned char)s[i]);
-        i += len;
+    for (int i = 0; i < len; ) {
+        i += utf8_char_length((unsigned char)s[i]);
         count++;
     }
     return count;
 }
 
-static int utf8_byte_offset(const char *s, int char_index) {
+int utf8_strlen_chars(const char *s) {
+    if (s == NULL) return 0;
+    return utf8_count_chars(s, (int)strlen(s));
+}
+
+/* 第 char_index 个字符在长度为 len 的行中的字节偏移，越界返回 -1 */
+static int utf8_byte_offset(const char *s, int len, int char_index) {
     if (s == NULL || char_index < 0) return -1;
     int i = 0;
     int idx = 0;
-    while (s[i] != '\0' && idx < char_index) {
-        int len = utf8_char_length((unsigned char)s[i]);
-        i += len;
+    while (i < len && idx < char_index) {
+        i += utf8_char_length((unsigned char)s[i]);
         idx++;
     }
+    if (i > len) i = len; /* 行尾残缺的多字节序列 */
     if (idx == char_index) {
         return i;
     }
     return -1;
 }
 
-static int utf8_char_index_from_byte(const char *s, int byte_pos) {
+static int utf8_char_index_from_byte(const char *s, int len, int byte_pos) {
     if (s == NULL || byte_pos < 0) return -1;
     int idx = 0;
     int i = 0;
-    while (s[i] != '\0' && i < byte_pos) {
-        int len = utf8_char_length((unsigned char)s[i]);
-        i += len;
+    while (i < len && i < byte_pos) {
+        i += utf8_char_length((unsigned char)s[i]);
         idx++;
     }
     if (i == byte_pos) return idx;
     return -1;
 }
 
+/*
+ * 为长行建立字节偏移检查点，存放在追加区中
+ * 行内容不可变，检查点与该行内容同生命周期，编辑产生新内容时自然失效
+ */
+static const int* line_checkpoints(TextBuffer *buf, LinePiece *piece) {
+    if (piece->checkpoints) return piece->checkpoints;
+
+    int chars = piece_chars(piece);
+    int count = chars / UTF8_CHECKPOINT_STRIDE + 1;
+    int *points = (int*)add_alloc(buf, sizeof(int) * (size_t)count, sizeof(int));
+    if (points == NULL) return NULL;
+
+    int i = 0;
+    for (int k = 0, idx = 0; k < count; k++) {
+        while (idx < k * UTF8_CHECKPOINT_STRIDE && i < piece->length) {
+            i += utf8_char_length((unsigned char)piece->text[i]);
+            idx++;
+        }
+        points[k] = i > piece->length ? piece->length : i;
+    }
+    piece->checkpoints = points;
+    return points;
+}
+
+/* 该行是否值得建立检查点（纯 ASCII 行可直接换算） */
+static int line_needs_checkpoints(LinePiece *piece) {
+    return piece->length >= UTF8_CHECKPOINT_MIN_BYTES && piece_chars(piece) != piece->length;
+}
+
+/*
+ * 行内第 char_index 个字符的字节偏移，越界返回 -1
+ * 纯 ASCII 行直接返回；长行从最近的检查点开始扫描，最多扫描一个步长
+ */
+static int line_byte_offset(TextBuffer *buf, LinePiece *piece, int char_index) {
+    if (char_index < 0) return -1;
+    int chars = piece_chars(piece);
+    if (char_index > chars) return -1;
+    if (chars == piece->length) return char_index;
+
+    if (line_needs_checkpoints(piece)) {
+        const int *points = line_checkpoints(buf, piece);
+        if (points) {
+            int k = char_index / UTF8_CHECKPOINT_STRIDE;
+            int base = points[k];
+            int off = utf8_byte_offset(piece->text + base, piece->length - base,
+                                       char_index - k * UTF8_CHECKPOINT_STRIDE);
+            return off < 0 ? -1 : base + off;
+        }
+    }
+    return utf8_byte_offset(piece->text, piece->length, char_index);
+}
+
+int get_line_char_count(const TextBuffer *buf, int line_num) {
+    if (buf == NULL || line_num < 0 || line_num >= buf->line_count) return -1;
+    return piece_chars(line_at(buf, line_num));
+}
+
 /* ========================== 字符统计功能 ========================== */
 
 /* UTF-8 读取下一个 code point */
@@ -173,134 +899,475 @@ static int utf8_next_codepoint(const unsigned char *p, int *advance) {
     return c;
 }
 
-CharStatistics count_characters(const TextBuffer *buf) {
-    CharStatistics stats = {0, 0, 0, 0, 0, 0, 0};
-    
-    if (buf == NULL) return stats;
-    
-    for (int i = 0; i < buf->line_count; i++) {
-        const unsigned char *p = (const unsigned char *)buf->lines[i];
-        while (*p != '\0') {
-            int advance = 1;
-            int cp = utf8_next_codepoint(p, &advance);
-            if (advance <= 0) advance = 1;
-            stats.total_count++;
-
-            if (cp >= 0 && cp < 0x80) {
-                char c = (char)cp;
-                if (is_letter(c)) {
-                    stats.letter_count++;
-                } else if (is_digit_char(c)) {
-                    stats.digit_count++;
-                } else if (is_space_char(c)) {
-                    stats.space_count++;
-                } else if (is_punctuation(c)) {
-                    stats.punctuation_count++;
-                } else {
-                    stats.other_count++;
+/*
+ * 按类别累加 [p, end) 中的字符：纯 ASCII 段整块交给向量化分类，
+ * 其余字符逐个解码后查码点区间表；各类别之和即总字符数
+ */
+static void classify_text(const unsigned char *p, const unsigned char *end,
+                          long long counts[CHAR_CLASS_COUNT]) {
+    /* 用局部计数器，避免每个字符都写回调用方的数组 */
+    long long local[CHAR_CLASS_COUNT] = {0};
+
+    while (p < end) {
+        if (*p < 0x80) {
+            /* 先逐字节查表；连续 ASCII 较长时再转入向量化分类，避免短片段的调用开销 */
+            const unsigned char *probe = end - p > 8 ? p + 8 : end;
+            while (p < probe && *p < 0x80) {
+                local[g_ascii_class[*p]]++;
+                p++;
+            }
+            if (p < probe) continue;
+
+            AsciiClassCounts ascii = {0, 0, 0, 0};
+            size_t done = simd_classify_ascii((const char*)p, (size_t)(end - p), &ascii);
+            if (done == 0) {
+                /* 标量级别、剩余不足一块或下一块即含非 ASCII：逐字节处理完这一段 */
+                while (p < end && *p < 0x80) {
+                    local[g_ascii_class[*p]]++;
+                    p++;
                 }
-            } else if (is_fullwidth_space(cp)) {
-                stats.space_count++;
-            } else if (is_fullwidth_digit(cp)) {
-                stats.digit_count++;
-            } else if (is_fullwidth_letter(cp)) {
-                stats.letter_count++;
-            } else if (is_cjk_char(cp)) {
-                stats.chinese_count++;
-            } else if (is_cjk_punctuation_cp(cp)) {
-                stats.punctuation_count++;
-            } else {
-                /* 其他特殊符号、表情等 */
-                stats.other_count++;
+                continue;
             }
-            p += advance;
+            local[CHAR_CLASS_LETTER] += (long long)ascii.letters;
+            local[CHAR_CLASS_DIGIT] += (long long)ascii.digits;
+            local[CHAR_CLASS_SPACE] += (long long)ascii.spaces;
+            local[CHAR_CLASS_PUNCT] += (long long)ascii.punctuation;
+            local[CHAR_CLASS_OTHER] += (long long)(done - ascii.letters - ascii.digits -
+                                                   ascii.spaces - ascii.punctuation);
+            p += done;
+            continue;
+        }
+
+        int advance;
+        int cp;
+        if ((*p & 0xF0) == 0xE0 && end - p >= 3) {
+            /* 三字节序列（中文及全角字符）最常见，直接解码 */
+            cp = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+            advance = 3;
+        } else if (utf8_char_length(*p) > end - p) {
+            /* 行尾残缺的多字节序列，按单个非法字节处理 */
+            cp = *p;
+            advance = (int)(end - p);
+        } else {
+            cp = utf8_next_codepoint(p, &advance);
         }
+        if (advance <= 0) advance = 1;
+        local[classify_codepoint(cp)]++;
+        p += advance;
     }
-    
+
+    for (int c = 0; c < CHAR_CLASS_COUNT; c++) {
+        counts[c] += local[c];
+    }
+}
+
+static CharStatistics stats_from_counts(const long long counts[CHAR_CLASS_COUNT]) {
+    CharStatistics stats;
+    long long total = 0;
+    for (int c = 0; c < CHAR_CLASS_COUNT; c++) {
+        total += counts[c];
+    }
+    stats.total_count = (int)total;
+    stats.letter_count = (int)counts[CHAR_CLASS_LETTER];
+    stats.digit_count = (int)counts[CHAR_CLASS_DIGIT];
+    stats.space_count = (int)counts[CHAR_CLASS_SPACE];
+    stats.punctuation_count = (int)counts[CHAR_CLASS_PUNCT];
+    stats.chinese_count = (int)counts[CHAR_CLASS_CHINESE];
+    stats.other_count = (int)counts[CHAR_CLASS_OTHER];
     return stats;
 }
 
-/*
- * 在指定位置插入一行
- */
-int insert_line(TextBuffer *buf, int line_num, const char *text) {
-    if (buf == NULL || text == NULL) return -1;
-    if (line_num < 0 || line_num > buf->line_count) return -1;
-    if (buf->line_count >= MAX_LINES) return -1;
+CharStatistics count_characters(const TextBuffer *buf) {
+    CharStatistics stats = {0, 0, 0, 0, 0, 0, 0};
     
-    /* 移动后面的行 */
-    for (int i = buf->line_count; i > line_num; i--) {
-        strcpy_s(buf->lines[i], MAX_LINE_LENGTH + 1, buf->lines[i - 1]);
+    if (buf == NULL) return stats;
+
+    init_codepoint_classes();
+    long long counts[CHAR_CLASS_COUNT] = {0};
+    for (int i = 0; i < buf->line_count; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        const unsigned char *p = (const unsigned char *)piece->text;
+        classify_text(p, p + piece->length, counts);
     }
-    
-    /* 插入新行 */
-    strncpy_s(buf->lines[line_num], sizeof(buf->lines[line_num]), text, _TRUNCATE);
-    buf->line_count++;
-    buf->modified = 1;
-    
-    return 0;
+    return stats_from_counts(counts);
 }
 
-/* ========================== 文件操作功能 ========================== */
+/* 并行统计的一个分片：逻辑行 [first, last) */
+typedef struct {
+    const TextBuffer *buf;
+    int first;
+    int last;
+    long long counts[CHAR_CLASS_COUNT];
+} StatsTask;
 
-/*
- * 打开文件并读取内容到缓冲区
- */
-int file_open(TextBuffer *buf, const char *filename) {
-    FILE *fp = NULL;
-    char line[MAX_LINE_LENGTH + 2];
-    
-    if (buf == NULL || filename == NULL) return -1;
-    
-    if (fopen_s(&fp, filename, "r") != 0 || fp == NULL) {
-        return -1;
-    }
-    
-    /* 清空当前缓冲区 */
-    buffer_clear(buf);
-    
-    /* 读取文件内容 */
-    while (fgets(line, sizeof(line), fp) != NULL && buf->line_count < MAX_LINES) {
-        trim_line_endings(line);
-        
-        /* 截断过长的行 */
-        size_t len = strlen(line);
-        if (len > MAX_LINE_LENGTH) {
-            line[MAX_LINE_LENGTH] = '\0';
-        }
-        
-        strncpy_s(buf->lines[buf->line_count], sizeof(buf->lines[buf->line_count]), line, _TRUNCATE);
-        buf->line_count++;
+static void stats_worker(void *arg) {
+    StatsTask *task = (StatsTask*)arg;
+    for (int i = task->first; i < task->last; i++) {
+        const LinePiece *piece = line_at(task->buf, i);
+        const unsigned char *p = (const unsigned char *)piece->text;
+        classify_text(p, p + piece->length, task->counts);
     }
-    
-    fclose(fp);
-    
-    /* 保存文件名 */
-    strncpy_s(buf->filename, sizeof(buf->filename), filename, _TRUNCATE);
-    buf->modified = 0;
-    
-    
-    return 0;
 }
 
 /*
- * 保存缓冲区内容到指定文件
+ * 按行区间把统计分给多个线程，各自累加后合并；threads <= 0 时使用 text_thread_count()。
+ * 统计只读缓冲区，调用期间不得修改 buf
+ */
+CharStatistics count_characters_parallel(const TextBuffer *buf, int threads) {
+    CharStatistics empty = {0, 0, 0, 0, 0, 0, 0};
+    if (buf == NULL) return empty;
+
+    if (threads <= 0) threads = text_thread_count();
+    if (threads > MAX_WORKER_THREADS) threads = MAX_WORKER_THREADS;
+    if (threads > buf->line_count / PARALLEL_MIN_LINES) threads = buf->line_count / PARALLEL_MIN_LINES;
+    if (threads <= 1) return count_characters(buf);
+
+    StatsTask *tasks = (StatsTask*)calloc((size_t)threads, sizeof(StatsTask));
+    if (tasks == NULL) return count_characters(buf);
+
+    /* 共享的查表数据和指令集检测须在启动线程前完成 */
+    init_codepoint_classes();
+    simd_level();
+
+    for (int t = 0; t < threads; t++) {
+        tasks[t].buf = buf;
+        tasks[t].first = (int)((long long)buf->line_count * t / threads);
+        tasks[t].last = (int)((long long)buf->line_count * (t + 1) / threads);
+    }
+    text_parallel_run(stats_worker, tasks, sizeof(StatsTask), threads);
+
+    long long counts[CHAR_CLASS_COUNT] = {0};
+    for (int t = 0; t < threads; t++) {
+        for (int c = 0; c < CHAR_CLASS_COUNT; c++) {
+            counts[c] += tasks[t].counts[c];
+        }
+    }
+    free(tasks);
+    return stats_from_counts(counts);
+}
+
+/* 把按类别的字符数加到（sign = 1）或减出（sign = -1）全文统计 */
+static void stats_apply_counts(TextBuffer *buf, const long long counts[CHAR_CLASS_COUNT], int sign) {
+    CharStatistics delta = stats_from_counts(counts);
+
+    buf->stats.total_count += sign * delta.total_count;
+    buf->stats.letter_count += sign * delta.letter_count;
+    buf->stats.digit_count += sign * delta.digit_count;
+    buf->stats.space_count += sign * delta.space_count;
+    buf->stats.punctuation_count += sign * delta.punctuation_count;
+    buf->stats.chinese_count += sign * delta.chinese_count;
+    buf->stats.other_count += sign * delta.other_count;
+}
+
+/*
+ * 把一行的统计加到（sign = 1）或减出（sign = -1）全文统计；
+ * 统计尚未建立时不做任何事，首次查询时会完整统计一次
+ */
+static void stats_apply_piece(TextBuffer *buf, const LinePiece *piece, int sign) {
+    if (!buf->stats_valid || piece->length == 0) return;
+
+    init_codepoint_classes();
+    long long counts[CHAR_CLASS_COUNT] = {0};
+    const unsigned char *p = (const unsigned char *)piece->text;
+    classify_text(p, p + piece->length, counts);
+    stats_apply_counts(buf, counts, sign);
+}
+
+/*
+ * 返回全文字符统计：各修改函数已逐行增量维护，O(1)；
+ * 打开文件后的首次调用做一次完整统计
+ */
+CharStatistics get_char_statistics(TextBuffer *buf) {
+    CharStatistics empty = {0, 0, 0, 0, 0, 0, 0};
+    if (buf == NULL) return empty;
+
+    if (!buf->stats_valid) {
+        buf->stats = count_characters_parallel(buf, 0);
+        buf->stats_valid = 1;
+        return buf->stats;
+    }
+
+#ifdef TEXT_STATS_CHECK
+    CharStatistics full = count_characters(buf);
+    if (memcmp(&full, &buf->stats, sizeof(full)) != 0) {
+        fprintf(stderr, "[统计校验] 增量统计与完整统计不一致: 总数 %d / %d，以完整统计为准\n",
+                buf->stats.total_count, full.total_count);
+        buf->stats = full;
+    }
+#endif
+    return buf->stats;
+}
+
+/*
+ * 在逻辑行 line_num 之前插入一个指向已有文本的行片段，调用前须保证间隙非空
+ * chars 为 -1 时在这里统计；行片段块与快照共享且复制失败时返回 -1
+ */
+static int insert_piece(TextBuffer *buf, int line_num, const char *text, int length, int flags, int chars) {
+    /* 间隙移到插入点，只移动描述符，不复制文本 */
+    if (move_gap(buf, line_num) != 0) return -1;
+    if (lines_own(buf, buf->gap_start, buf->gap_start + 1) != 0) return -1;
+
+    LinePiece *piece = gap_push(buf);
+    piece->text = text;
+    piece->length = length;
+    piece->flags = flags;
+    piece->chars = chars >= 0 ? chars : utf8_count_chars(text, length);
+    piece->index_id = -1;
+    piece->checkpoints = NULL;
+    if (buf->char_tree_valid) {
+        char_tree_add(buf, buf->gap_start - 1, (long long)piece->chars + 1);
+    }
+    stats_apply_piece(buf, piece, 1);
+    search_index_apply(buf, piece, buf->gap_start - 1, 1);
+    buf->revision++;
+    undo_record(buf, UNDO_INSERT, line_num, NULL, piece);
+    return 0;
+}
+
+/*
+ * 在指定位置插入一行
+ */
+int insert_line(TextBuffer *buf, int line_num, const char *text) {
+    if (buf == NULL || text == NULL) return -1;
+    if (line_num < 0 || line_num > buf->line_count) return -1;
+    if (ensure_gap(buf, 1) != 0) return -1;
+
+    size_t len = strlen(text);
+    if (len > INT_MAX) return -1;
+    const char *image = add_line_image(buf, text, len, NULL, 0, NULL, 0);
+    if (image == NULL) return -1;
+
+    if (insert_piece(buf, line_num, image, (int)len, 0, utf8_count_chars(image, (int)len)) != 0) return -1;
+    buf->modified = 1;
+    
+    return 0;
+}
+
+/*
+ * 用新内容替换整行
+ */
+int replace_line(TextBuffer *buf, int line_num, const char *text) {
+    if (buf == NULL || text == NULL) return -1;
+    if (line_num < 0 || line_num >= buf->line_count) return -1;
+
+    size_t len = strlen(text);
+    if (len > INT_MAX) return -1;
+    return line_splice(buf, line_num, 0, line_at(buf, line_num)->length, text, len);
+}
+
+/* ========================== 文件操作功能 ========================== */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * 统计 data 中的行数（末尾换行不产生额外空行）
+ */
+static size_t count_lines(const char *data, size_t size) {
+    if (size == 0) return 0;
+    size_t lines = simd_count_byte(data, size, '\n');
+    if (data[size - 1] != '\n') lines++;
+    return lines;
+}
+
+static void push_line_piece(TextBuffer *buf, const char *start, const char *line_end, int writable) {
+    /* 去掉行尾的 \r */
+    while (line_end > start && line_end[-1] == '\r') {
+        line_end--;
+    }
+    if (writable) {
+        *(char*)line_end = '\0';
+    }
+
+    LinePiece *piece = gap_push(buf);    /* 刚清空的缓冲区，行片段块都是独占的 */
+    piece->text = start;
+    piece->length = (int)(line_end - start);
+    piece->flags = writable ? 0 : LINE_FLAG_VIEW;
+    piece->chars = -1;
+    piece->index_id = -1;
+    piece->checkpoints = NULL;
+}
+
+/*
+ * 建立行索引：用 SIMD 换行符扫描把 data 切分为行片段，去掉行尾的 \r\n
+ * writable 为真时就地写入 '\0' 结尾；否则行片段标记为只读视图
+ * 调用前间隙必须不小于 count_lines 的结果
+ */
+static void split_lines(TextBuffer *buf, const char *data, size_t size, int writable) {
+    size_t positions[LINE_SCAN_BATCH];
+    const char *line_start = data;
+    size_t base = 0;
+
+    while (base < size) {
+        size_t consumed = 0;
+        size_t found = simd_find_byte(data + base, size - base, '\n',
+                                      positions, LINE_SCAN_BATCH, &consumed);
+        for (size_t k = 0; k < found; k++) {
+            const char *nl = data + base + positions[k];
+            push_line_piece(buf, line_start, nl, writable);
+            line_start = nl + 1;
+        }
+        base += consumed;
+    }
+    if (line_start < data + size) {
+        push_line_piece(buf, line_start, data + size, writable);
+    }
+}
+
+/*
+ * 统计行数、分配行片段并切分，同时记录索引构建耗时；
+ * 随后整体校验一次 UTF-8 编码，供界面提示非法字节
+ */
+static int build_line_index(TextBuffer *buf, const char *data, size_t size, int writable) {
+    double start = now_seconds();
+
+    size_t lines = count_lines(data, size);
+    if (lines > INT_MAX) return -1;
+    if (ensure_gap(buf, (int)lines) != 0) return -1;
+    split_lines(buf, data, size, writable);
+
+    buf->index_stats.bytes_scanned = size;
+    buf->index_stats.lines = buf->line_count;
+    buf->index_stats.build_seconds = now_seconds() - start;
+    buf->index_stats.simd_level = (int)simd_level();
+    buf->stats_valid = 0;   /* 全文统计推迟到首次查询 */
+
+    start = now_seconds();
+    int valid;
+    buf->index_stats.chars = simd_utf8_count(data, size, &valid);
+    buf->index_stats.utf8_valid = valid;
+    buf->index_stats.validate_seconds = now_seconds() - start;
+    return 0;
+}
+
+/*
+ * 获取最近一次打开文件时的行索引统计
+ */
+void get_line_index_stats(const TextBuffer *buf, LineIndexStats *stats) {
+    if (buf == NULL || stats == NULL) return;
+    *stats = buf->index_stats;
+}
+
+/*
+ * 打开文件并读取内容到缓冲区
+ * 整个文件一次读入原始区，按行就地切分（换行符替换为 '\0'），不再逐行复制
+ */
+int file_open(TextBuffer *buf, const char *filename) {
+    FILE *fp = NULL;
+    
+    if (buf == NULL || filename == NULL) return -1;
+    
+    if (fopen_s(&fp, filename, "rb") != 0 || fp == NULL) {
+        return -1;
+    }
+
+    /* 读取文件内容 */
+    size_t size = 0;
+    size_t cap = BUFFER_SIZE;
+    char *data = (char*)malloc(cap + 1);
+    while (data != NULL) {
+        size_t n = fread(data + size, 1, cap - size, fp);
+        size += n;
+        if (size < cap) break;
+        char *grown = (char*)realloc(data, cap * 2 + 1);
+        if (grown == NULL) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = grown;
+        cap *= 2;
+    }
+    int read_error = ferror(fp);
+    fclose(fp);
+    if (data == NULL || read_error) {
+        free(data);
+        return -1;
+    }
+    data[size] = '\0';
+
+    /* 清空当前缓冲区并建立行索引 */
+    buffer_clear(buf);
+    buf->original = data;
+    buf->original_size = size;
+    if (build_line_index(buf, data, size, 1) != 0) {
+        buffer_clear(buf);
+        return -1;
+    }
+    
+    /* 保存文件名 */
+    strncpy_s(buf->filename, sizeof(buf->filename), filename, _TRUNCATE);
+    buf->modified = 0;
+    
+    
+    return 0;
+}
+
+/*
+ * 以内存映射方式打开文件（适合大文件）
+ * 文件字节不做任何复制，未修改的行直接指向映射；被编辑或按 C 字符串
+ * 访问的行才会物化到追加区
+ */
+int file_open_mapped(TextBuffer *buf, const char *filename) {
+    FileMapping mapping;
+
+    if (buf == NULL || filename == NULL) return -1;
+
+    if (file_map_open(&mapping, filename) != 0) {
+        return -1;
+    }
+
+    buffer_clear(buf);
+    buf->mapping = mapping;
+    if (build_line_index(buf, mapping.data, mapping.size, 0) != 0) {
+        buffer_clear(buf);
+        return -1;
+    }
+
+    strncpy_s(buf->filename, sizeof(buf->filename), filename, _TRUNCATE);
+    buf->modified = 0;
+
+    return 0;
+}
+
+/*
+ * 保存缓冲区内容到指定文件
  */
 int file_save(TextBuffer *buf, const char *filename) {
     FILE *fp = NULL;
+    int failed = 0;
     
     if (buf == NULL || filename == NULL) return -1;
+
+    /* 清空或打开别的文件之后，之前的映射可能仍被快照读取，同样不能截断 */
+    if (snapshot_maps_file(filename)) return -1;
+
+    /*
+     * 覆盖正在映射的文件前先解除映射，否则截断文件会使视图失效；
+     * 按文件标识判断，换一种写法的路径、符号链接或硬链接指向同一文件时同样解除
+     */
+    if (buf->mapping.data != NULL && file_map_same_file(&buf->mapping, filename)) {
+        if (detach_mapping(buf) != 0) return -1;
+    }
     
     if (fopen_s(&fp, filename, "w") != 0 || fp == NULL) {
         return -1;
     }
     
     /* 写入所有行 */
-    for (int i = 0; i < buf->line_count; i++) {
-        fprintf(fp, "%s\n", buf->lines[i]);
+    for (int i = 0; i < buf->line_count && !failed; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        if (fwrite(piece->text, 1, (size_t)piece->length, fp) != (size_t)piece->length ||
+            fputc('\n', fp) == EOF) {
+            failed = 1;
+        }
     }
     
-    fclose(fp);
+    if (fclose(fp) != 0) failed = 1;
+    if (failed) return -1;
     
     /* 更新文件名 */
     strncpy_s(buf->filename, sizeof(buf->filename), filename, _TRUNCATE);
@@ -322,392 +1389,3260 @@ int file_save_current(TextBuffer *buf) {
     return file_save(buf, buf->filename);
 }
 
-/* ========================== 子串查找功能 ========================== */
+/* ========================== 搜索结果集 ========================== */
 
-static void build_lps(const char *pattern, size_t m, int *lps) {
-    size_t len = 0;
-    lps[0] = 0;
+/*
+ * 自行增长的结果集，limit > 0 时收集满 limit 个即停止扫描
+ */
+void search_results_init(SearchResults *results, int limit) {
+    if (results == NULL) return;
+    results->items = NULL;
+    results->count = 0;
+    results->capacity = 0;
+    results->limit = limit;
+    results->owns_items = 1;
+    results->truncated = 0;
+}
 
-    for (size_t i = 1; i < m; ) {
-        if (pattern[i] == pattern[len]) {
-            len++;
-            lps[i] = (int)len;
-            i++;
-        } else if (len != 0) {
-            len = lps[len - 1];
-        } else {
-            lps[i] = 0;
-            i++;
+/*
+ * 使用调用方提供的缓冲区（例如栈上数组或内存池），不做任何分配，写满即停止
+ */
+void search_results_init_buffer(SearchResults *results, SearchResult *storage, int capacity) {
+    if (results == NULL) return;
+    results->items = storage;
+    results->count = 0;
+    results->capacity = storage != NULL && capacity > 0 ? capacity : 0;
+    results->limit = results->capacity;
+    results->owns_items = 0;
+    results->truncated = 0;
+}
+
+void search_results_free(SearchResults *results) {
+    if (results == NULL) return;
+    if (results->owns_items) {
+        free(results->items);
+    }
+    results->items = NULL;
+    results->count = 0;
+    results->capacity = 0;
+}
+
+/*
+ * 追加一个结果：返回 0 继续扫描，1 表示已达上限应停止，-1 表示内存不足
+ */
+static int search_results_push(SearchResults *results, int line, int column) {
+    if (results->limit > 0 && results->count >= results->limit) {
+        results->truncated = 1;
+        return 1;
+    }
+    if (results->count == results->capacity) {
+        if (!results->owns_items) {
+            results->truncated = 1;
+            return 1;
+        }
+        int cap = results->capacity ? results->capacity * 2 : 64;
+        if (results->limit > 0 && cap > results->limit) cap = results->limit;
+        SearchResult *grown = (SearchResult*)realloc(results->items, sizeof(SearchResult) * (size_t)cap);
+        if (grown == NULL) return -1;
+        results->items = grown;
+        results->capacity = cap;
+    }
+    results->items[results->count].line = line;
+    results->items[results->count].column = column;
+    results->count++;
+    return 0;
+}
+
+/* ========================== 三元组查找索引 ========================== */
+
+/*
+ * 每个不同的三字节组合对应一个倒排表，记录包含它的行编号（升序）
+ * 行编号只增不复用：行内容改变时旧编号作废、分配新编号，因此倒排表
+ * 始终只在末尾追加；作废编号留下的失效条目在过多时整体重建清除
+ */
+#define TRIGRAM_EMPTY   0xFFFFFFFFu     /* 空槽标记（三元组只占低 24 位） */
+
+typedef struct {
+    unsigned int key;       /* b0 | b1 << 8 | b2 << 16 */
+    int count;              /* 倒排条目数 */
+    int capacity;           /* ids 容量 */
+    int *ids;               /* 行编号，升序 */
+} TrigramPosting;
+
+struct TrigramIndex {
+    TrigramPosting *slots;  /* 开放寻址哈希表 */
+    size_t slot_mask;       /* 槽数 - 1（槽数为 2 的幂） */
+    int trigrams;           /* 已占用的槽数 */
+    int *line_grams;        /* 按行编号：该行的不同三元组数，-1 表示已作废 */
+    int *id_slots;          /* 按行编号：该行当前所在的槽位，随间隙移动同步 */
+    int id_capacity;        /* line_grams 与 id_slots 容量 */
+    int next_id;            /* 下一个可分配的行编号 */
+    int lines;              /* 有效行数 */
+    size_t live_postings;   /* 有效倒排条目数 */
+    size_t stale_postings;  /* 失效倒排条目数 */
+    size_t posting_bytes;   /* 倒排表已分配的字节数 */
+    double build_seconds;
+    int builds;
+    int last_candidates;
+};
+
+static size_t trigram_hash(unsigned int key, size_t mask) {
+    return (size_t)(((unsigned long long)key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static unsigned int trigram_key(const unsigned char *p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16);
+}
+
+static TrigramPosting* trigram_alloc_slots(size_t count) {
+    TrigramPosting *slots = (TrigramPosting*)calloc(count, sizeof(TrigramPosting));
+    if (slots == NULL) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        slots[i].key = TRIGRAM_EMPTY;
+    }
+    return slots;
+}
+
+static TrigramPosting* trigram_find(const TrigramIndex *ix, unsigned int key) {
+    size_t h = trigram_hash(key, ix->slot_mask);
+    while (ix->slots[h].key != TRIGRAM_EMPTY) {
+        if (ix->slots[h].key == key) return &ix->slots[h];
+        h = (h + 1) & ix->slot_mask;
+    }
+    return NULL;
+}
+
+/* 装载率达到一半时槽数翻倍 */
+static int trigram_grow(TrigramIndex *ix) {
+    size_t old_count = ix->slot_mask + 1;
+    size_t mask = old_count * 2 - 1;
+    TrigramPosting *slots = trigram_alloc_slots(mask + 1);
+    if (slots == NULL) return -1;
+    for (size_t i = 0; i < old_count; i++) {
+        if (ix->slots[i].key == TRIGRAM_EMPTY) continue;
+        size_t h = trigram_hash(ix->slots[i].key, mask);
+        while (slots[h].key != TRIGRAM_EMPTY) h = (h + 1) & mask;
+        slots[h] = ix->slots[i];
+    }
+    free(ix->slots);
+    ix->slots = slots;
+    ix->slot_mask = mask;
+    return 0;
+}
+
+static TrigramPosting* trigram_insert(TrigramIndex *ix, unsigned int key) {
+    size_t h = trigram_hash(key, ix->slot_mask);
+    while (ix->slots[h].key != TRIGRAM_EMPTY) {
+        if (ix->slots[h].key == key) return &ix->slots[h];
+        h = (h + 1) & ix->slot_mask;
+    }
+    if ((size_t)(ix->trigrams + 1) * 2 > ix->slot_mask + 1) {
+        if (trigram_grow(ix) != 0) return NULL;
+        return trigram_insert(ix, key);
+    }
+    ix->slots[h].key = key;
+    ix->trigrams++;
+    return &ix->slots[h];
+}
+
+static void trigram_index_destroy(TrigramIndex *ix) {
+    if (ix == NULL) return;
+    for (size_t i = 0; i <= ix->slot_mask; i++) {
+        free(ix->slots[i].ids);
+    }
+    free(ix->slots);
+    free(ix->line_grams);
+    free(ix->id_slots);
+    free(ix);
+}
+
+static TrigramIndex* trigram_index_create(void) {
+    TrigramIndex *ix = (TrigramIndex*)calloc(1, sizeof(TrigramIndex));
+    if (ix == NULL) return NULL;
+    ix->slot_mask = 1023;
+    ix->slots = trigram_alloc_slots(ix->slot_mask + 1);
+    if (ix->slots == NULL) {
+        free(ix);
+        return NULL;
+    }
+    ix->last_candidates = -1;
+    return ix;
+}
+
+/*
+ * 给槽位 slot 上的一行分配新编号并把它的每个不同三元组追加到对应倒排表；
+ * 同一行内重复的三元组只记一次（倒排表末尾已是本行编号）
+ */
+static int trigram_index_add(TrigramIndex *ix, LinePiece *piece, int slot) {
+    if (ix->next_id == INT_MAX) return -1;
+    if (ix->next_id == ix->id_capacity) {
+        int cap = ix->id_capacity ? (ix->id_capacity > INT_MAX / 2 ? INT_MAX : ix->id_capacity * 2) : 1024;
+        int *grown = (int*)realloc(ix->line_grams, sizeof(int) * (size_t)cap);
+        if (grown == NULL) return -1;
+        ix->line_grams = grown;
+        grown = (int*)realloc(ix->id_slots, sizeof(int) * (size_t)cap);
+        if (grown == NULL) return -1;
+        ix->id_slots = grown;
+        ix->id_capacity = cap;
+    }
+
+    int id = ix->next_id;
+    int grams = 0;
+    const unsigned char *p = (const unsigned char *)piece->text;
+    for (int i = 0; i + 2 < piece->length; i++) {
+        TrigramPosting *slot = trigram_insert(ix, trigram_key(p + i));
+        if (slot == NULL) return -1;
+        if (slot->count > 0 && slot->ids[slot->count - 1] == id) continue;
+        if (slot->count == slot->capacity) {
+            int cap = slot->capacity ? slot->capacity * 2 : 4;
+            int *grown = (int*)realloc(slot->ids, sizeof(int) * (size_t)cap);
+            if (grown == NULL) return -1;
+            ix->posting_bytes += sizeof(int) * (size_t)(cap - slot->capacity);
+            slot->ids = grown;
+            slot->capacity = cap;
+        }
+        slot->ids[slot->count++] = id;
+        grams++;
+    }
+
+    ix->line_grams[id] = grams;
+    ix->id_slots[id] = slot;
+    ix->next_id++;
+    ix->lines++;
+    ix->live_postings += (size_t)grams;
+    piece->index_id = id;
+    return 0;
+}
+
+/* 作废一行的编号，倒排表中的条目留到重建时清除 */
+static void trigram_index_remove(TrigramIndex *ix, LinePiece *piece) {
+    int id = piece->index_id;
+    if (id < 0 || id >= ix->next_id || ix->line_grams[id] < 0) return;
+    ix->live_postings -= (size_t)ix->line_grams[id];
+    ix->stale_postings += (size_t)ix->line_grams[id];
+    ix->line_grams[id] = -1;
+    ix->lines--;
+    piece->index_id = -1;
+}
+
+/*
+ * 建立（或重建）三元组查找索引，成功返回 0；
+ * 内存不足时保留原索引（如有）并返回 -1
+ */
+int search_index_build(TextBuffer *buf) {
+    if (buf == NULL) return -1;
+
+    double start = now_seconds();
+    TrigramIndex *ix = trigram_index_create();
+    if (ix == NULL) return -1;
+    for (int i = 0; i < buf->line_count; i++) {
+        int slot = line_slot(buf, i);
+        if (trigram_index_add(ix, slot_at(buf, slot), slot) != 0) {
+            trigram_index_destroy(ix);
+            if (buf->search_index != NULL) {
+                /* 行编号已部分改写，原索引不再可用 */
+                search_index_free(buf);
+            }
+            return -1;
         }
     }
+
+    if (buf->search_index != NULL) {
+        ix->builds = buf->search_index->builds;
+        trigram_index_destroy(buf->search_index);
+    }
+    ix->builds++;
+    ix->build_seconds = now_seconds() - start;
+    buf->search_index = ix;
+    return 0;
+}
+
+/*
+ * 释放三元组查找索引，之后的查找回到逐行扫描
+ */
+void search_index_free(TextBuffer *buf) {
+    if (buf == NULL) return;
+    trigram_index_destroy(buf->search_index);
+    buf->search_index = NULL;
+}
+
+void get_search_index_stats(const TextBuffer *buf, SearchIndexStats *stats) {
+    if (buf == NULL || stats == NULL) return;
+    memset(stats, 0, sizeof(*stats));
+    stats->last_candidates = -1;
+    const TrigramIndex *ix = buf->search_index;
+    if (ix == NULL) return;
+
+    stats->enabled = 1;
+    stats->lines = ix->lines;
+    stats->trigrams = ix->trigrams;
+    stats->postings = ix->live_postings;
+    stats->stale_postings = ix->stale_postings;
+    stats->memory_bytes = sizeof(TrigramIndex)
+                        + sizeof(TrigramPosting) * (ix->slot_mask + 1)
+                        + sizeof(int) * 2 * (size_t)ix->id_capacity
+                        + ix->posting_bytes;
+    stats->build_seconds = ix->build_seconds;
+    stats->builds = ix->builds;
+    stats->last_candidates = ix->last_candidates;
+}
+
+/*
+ * 行内容变化时维护索引（与 stats_apply_piece 成对调用）：
+ * sign = -1 作废旧编号，sign = 1 按槽位 slot 上的新内容重新登记；
+ * 失效条目过多时整体重建，内存不足时丢弃索引，查找自动回到逐行扫描
+ */
+static void search_index_apply(TextBuffer *buf, LinePiece *piece, int slot, int sign) {
+    TrigramIndex *ix = buf->search_index;
+    if (ix == NULL) return;
+
+    if (sign < 0) {
+        trigram_index_remove(ix, piece);
+        return;
+    }
+    if (trigram_index_add(ix, piece, slot) != 0) {
+        search_index_free(buf);
+        return;
+    }
+    int dead_ids = ix->next_id - ix->lines;
+    if ((ix->stale_postings >= SEARCH_INDEX_COMPACT_MIN && ix->stale_postings > ix->live_postings) ||
+        (dead_ids >= SEARCH_INDEX_COMPACT_MIN && dead_ids > ix->lines)) {
+        if (search_index_build(buf) != 0) {
+            search_index_free(buf);
+        }
+    }
+}
+
+/* 槽位 [slot, slot + n) 上的行片段移动到这里之后调用，更新这些行的编号到槽位映射 */
+static void search_index_move(TextBuffer *buf, int slot, int n) {
+    TrigramIndex *ix = buf->search_index;
+    if (ix == NULL) return;
+    for (int k = 0; k < n; k++) {
+        int id = slot_at(buf, slot + k)->index_id;
+        if (id >= 0) ix->id_slots[id] = slot + k;
+    }
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_posting_size(const void *a, const void *b) {
+    const TrigramPosting *pa = *(const TrigramPosting *const *)a;
+    const TrigramPosting *pb = *(const TrigramPosting *const *)b;
+    if (pa->count != pb->count) return pa->count < pb->count ? -1 : 1;
+    return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+/* 在升序数组 ids[from, count) 中找第一个不小于 id 的位置（倍增后二分） */
+static int posting_seek(const int *ids, int count, int from, int id) {
+    int step = 1;
+    int hi = from;
+    while (hi < count && ids[hi] < id) {
+        from = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > count) hi = count;
+    while (from < hi) {
+        int mid = from + (hi - from) / 2;
+        if (ids[mid] < id) from = mid + 1;
+        else hi = mid;
+    }
+    return from;
+}
+
+/*
+ * 用索引筛出可能包含 pattern 的行：对模式的各个三元组按倒排表从短到长求交，
+ * 再按行顺序换算成行号，写入 *lines（调用方 free，可能为 NULL）和 *count
+ * 返回 1 表示已筛选；返回 0 表示未建立索引、模式短于 3 字节或内存不足，
+ * 调用方应逐行扫描全部行
+ */
+static int search_index_candidates(TextBuffer *buf, const char *pattern, size_t m,
+                                   int **lines, int *count) {
+    TrigramIndex *ix = buf->search_index;
+    *lines = NULL;
+    *count = 0;
+    if (ix == NULL) return 0;
+    ix->last_candidates = -1;
+    if (m < 3) return 0;
+
+    size_t grams = m - 2;
+    TrigramPosting **lists = (TrigramPosting**)malloc(sizeof(TrigramPosting*) * grams);
+    if (lists == NULL) return 0;
+    for (size_t i = 0; i < grams; i++) {
+        lists[i] = trigram_find(ix, trigram_key((const unsigned char *)pattern + i));
+        if (lists[i] == NULL) {
+            /* 某个三元组从未出现，任何行都不可能匹配 */
+            free(lists);
+            ix->last_candidates = 0;
+            return 1;
+        }
+    }
+    qsort(lists, grams, sizeof(TrigramPosting*), compare_posting_size);
+
+    /* 以最短的倒排表为起点，只保留仍然有效的编号 */
+    int *cand = (int*)malloc(sizeof(int) * (size_t)(lists[0]->count + 1));
+    if (cand == NULL) {
+        free(lists);
+        return 0;
+    }
+    int n = 0;
+    for (int k = 0; k < lists[0]->count; k++) {
+        int id = lists[0]->ids[k];
+        if (ix->line_grams[id] >= 0) cand[n++] = id;
+    }
+    for (size_t i = 1; i < grams && n > 0; i++) {
+        if (lists[i] == lists[i - 1]) continue;
+        const TrigramPosting *list = lists[i];
+        int pos = 0;
+        int kept = 0;
+        for (int k = 0; k < n && pos < list->count; k++) {
+            pos = posting_seek(list->ids, list->count, pos, cand[k]);
+            if (pos < list->count && list->ids[pos] == cand[k]) cand[kept++] = cand[k];
+        }
+        n = kept;
+    }
+    free(lists);
+
+    if (n > 0) {
+        /* 编号与行号的顺序无关：经槽位换算成行号后排序，耗时只与候选数有关 */
+        int gap = buf->gap_end - buf->gap_start;
+        for (int k = 0; k < n; k++) {
+            int slot = ix->id_slots[cand[k]];
+            cand[k] = slot < buf->gap_start ? slot : slot - gap;
+        }
+        qsort(cand, (size_t)n, sizeof(int), compare_int);
+    }
+    if (n == 0) {
+        free(cand);
+        cand = NULL;
+    }
+
+    ix->last_candidates = n;
+    *lines = cand;
+    *count = n;
+    return 1;
+}
+
+/* ========================== 子串查找功能 ========================== */
+
+static void build_lps(const char *pattern, size_t m, int *lps) {
+    size_t len = 0;
+    lps[0] = 0;
+
+    for (size_t i = 1; i < m; ) {
+        if (pattern[i] == pattern[len]) {
+            len++;
+            lps[i] = (int)len;
+            i++;
+        } else if (len != 0) {
+            len = lps[len - 1];
+        } else {
+            lps[i] = 0;
+            i++;
+        }
+    }
+}
+
+static int kmp_count_line(const char *text, size_t n, const char *pattern, const int *lps, size_t m) {
+    size_t i = 0, j = 0;
+    int count = 0;
+
+    while (i < n) {
+        if (text[i] == pattern[j]) {
+            i++;
+            j++;
+            if (j == m) {
+                count++;
+                j = (size_t)lps[j - 1];
+            }
+        } else if (j != 0) {
+            j = (size_t)lps[j - 1];
+        } else {
+            i++;
+        }
+    }
+
+    return count;
+}
+
+/* 按字节递增的命中位置换算为列号时的进度：从上一次命中处继续，整行只走一遍 */
+typedef struct {
+    int byte;
+    int chr;
+} ColumnCursor;
+
+static int push_hit(SearchResults *results, const char *text, size_t n, int ascii_only,
+                    int line_idx, int byte_pos, ColumnCursor *cursor) {
+    int char_pos = byte_pos;
+    if (!ascii_only) {
+        int rel = utf8_char_index_from_byte(text + cursor->byte, (int)n - cursor->byte,
+                                            byte_pos - cursor->byte);
+        if (rel >= 0) {
+            cursor->chr += rel;
+            cursor->byte = byte_pos;
+            char_pos = cursor->chr;
+        } /* 否则落在多字节字符中间，退回字节位置 */
+    }
+    return search_results_push(results, line_idx, char_pos);
+}
+
+/*
+ * 把一行中的所有命中追加到结果集，返回值同 search_results_push
+ */
+static int kmp_collect_line(const char *text, size_t n, int ascii_only,
+                            const char *pattern, const int *lps, size_t m,
+                            int line_idx, SearchResults *results) {
+    size_t i = 0, j = 0;
+    ColumnCursor cursor = {0, 0};
+
+    while (i < n) {
+        if (text[i] == pattern[j]) {
+            i++;
+            j++;
+            if (j == m) {
+                int rc = push_hit(results, text, n, ascii_only, line_idx, (int)(i - j), &cursor);
+                if (rc != 0) return rc;
+                j = (size_t)lps[j - 1];
+            }
+        } else if (j != 0) {
+            j = (size_t)lps[j - 1];
+        } else {
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+/* 返回第一次完整匹配的位置 */
+static const char* kmp_find_first(const char *text, size_t n, const char *pattern, const int *lps, size_t m) {
+    size_t i = 0, j = 0;
+
+    while (i < n) {
+        if (text[i] == pattern[j]) {
+            i++;
+            j++;
+            if (j == m) return text + (i - m);
+        } else if (j != 0) {
+            j = (size_t)lps[j - 1];
+        } else {
+            i++;
+        }
+    }
+    return NULL;
+}
+
+/* ========================== 后缀数组索引 ========================== */
+
+/*
+ * 各行以 '\n' 连接成一段文本后建立后缀数组；行内不含 '\n'，
+ * 因此不含换行符的模式只会在行内命中，结果与逐行扫描一致
+ */
+struct SuffixIndex {
+    char *text;                     /* 各行以 '\n' 连接的副本 */
+    int size;                       /* text 的字节数 */
+    int *sa;                        /* 后缀数组：按字典序排列的后缀起点 */
+    int *line_starts;               /* 各行在 text 中的起点，lines + 1 项 */
+    int lines;
+    unsigned long long revision;    /* 建立时缓冲区的内容版本号 */
+    double build_seconds;
+    int builds;
+};
+
+/* 第 0 层的文本是字节，递归各层是整数 */
+#define SAIS_CHR(i) (bytes != NULL ? (int)bytes[i] : ints[i])
+
+/*
+ * 诱导排序：先把 lms 中的后缀放到各自 S 桶的末尾，
+ * 再从左到右诱导 L 型后缀、从右到左诱导 S 型后缀
+ */
+static void sais_induce(const unsigned char *bytes, const int *ints, int n, int upper,
+                        const unsigned char *ls, const int *sum_l, const int *sum_s,
+                        const int *lms, int m, int *bucket, int *sa) {
+    for (int i = 0; i < n; i++) sa[i] = -1;
+
+    memcpy(bucket, sum_s, sizeof(int) * (size_t)(upper + 1));
+    for (int k = 0; k < m; k++) {
+        int d = lms[k];
+        sa[bucket[SAIS_CHR(d)]++] = d;
+    }
+
+    memcpy(bucket, sum_l, sizeof(int) * (size_t)(upper + 1));
+    sa[bucket[SAIS_CHR(n - 1)]++] = n - 1;
+    for (int i = 0; i < n; i++) {
+        int v = sa[i];
+        if (v >= 1 && !ls[v - 1]) {
+            sa[bucket[SAIS_CHR(v - 1)]++] = v - 1;
+        }
+    }
+
+    memcpy(bucket, sum_l, sizeof(int) * (size_t)(upper + 1));
+    for (int i = n - 1; i >= 0; i--) {
+        int v = sa[i];
+        if (v >= 1 && ls[v - 1]) {
+            sa[--bucket[SAIS_CHR(v - 1) + 1]] = v - 1;
+        }
+    }
+}
+
+/*
+ * SA-IS：诱导排序 LMS 子串，给互不相同的 LMS 子串编号得到缩减串并递归排序，
+ * 再用排好序的 LMS 后缀诱导出完整后缀数组，总耗时 O(n)
+ * 字母表为 [0, upper]，文本末尾视为一个比所有字符都小的虚拟哨兵
+ * 成功返回 0，内存不足返回 -1
+ */
+static int sais_build(const unsigned char *bytes, const int *ints, int n, int upper, int *sa) {
+    if (n == 0) return 0;
+    if (n == 1) {
+        sa[0] = 0;
+        return 0;
+    }
+    if (n == 2) {
+        int first = SAIS_CHR(0) < SAIS_CHR(1) ? 0 : 1;
+        sa[0] = first;
+        sa[1] = 1 - first;
+        return 0;
+    }
+
+    int rc = -1;
+    int *lms = NULL, *sorted = NULL, *rec_s = NULL, *rec_sa = NULL;
+    unsigned char *ls = (unsigned char*)malloc((size_t)n);
+    int *sum_l = (int*)calloc((size_t)upper + 1, sizeof(int));
+    int *sum_s = (int*)calloc((size_t)upper + 1, sizeof(int));
+    int *bucket = (int*)malloc(sizeof(int) * ((size_t)upper + 1));
+    int *lms_map = (int*)malloc(sizeof(int) * ((size_t)n + 1));
+    if (ls == NULL || sum_l == NULL || sum_s == NULL || bucket == NULL || lms_map == NULL) goto done;
+
+    /* ls[i] 为真表示后缀 i 是 S 型（小于后缀 i + 1） */
+    ls[n - 1] = 0;
+    for (int i = n - 2; i >= 0; i--) {
+        int a = SAIS_CHR(i), b = SAIS_CHR(i + 1);
+        ls[i] = a == b ? ls[i + 1] : (unsigned char)(a < b);
+    }
+
+    /* sum_l[c] / sum_s[c]：字符 c 的 L 桶 / S 桶起点 */
+    for (int i = 0; i < n; i++) {
+        if (!ls[i]) sum_s[SAIS_CHR(i)]++;
+        else sum_l[SAIS_CHR(i) + 1]++;
+    }
+    for (int c = 0; c <= upper; c++) {
+        sum_s[c] += sum_l[c];
+        if (c < upper) sum_l[c + 1] += sum_s[c];
+    }
+
+    int m = 0;
+    lms_map[0] = -1;
+    lms_map[n] = -1;
+    for (int i = 1; i < n; i++) {
+        lms_map[i] = (!ls[i - 1] && ls[i]) ? m++ : -1;
+    }
+    lms = (int*)calloc((size_t)m + 1, sizeof(int));
+    if (lms == NULL) goto done;
+    for (int i = 1, k = 0; i < n; i++) {
+        if (lms_map[i] >= 0) lms[k++] = i;
+    }
+
+    sais_induce(bytes, ints, n, upper, ls, sum_l, sum_s, lms, m, bucket, sa);
+
+    if (m > 0) {
+        sorted = (int*)malloc(sizeof(int) * (size_t)m);
+        rec_s = (int*)malloc(sizeof(int) * (size_t)m);
+        rec_sa = (int*)malloc(sizeof(int) * (size_t)m);
+        if (sorted == NULL || rec_s == NULL || rec_sa == NULL) goto done;
+
+        int k = 0;
+        for (int i = 0; i < n; i++) {
+            int v = sa[i];
+            if (v > 0 && ls[v] && !ls[v - 1]) sorted[k++] = v;
+        }
+
+        /* 相邻且内容相同的 LMS 子串取同一编号 */
+        int rec_upper = 0;
+        rec_s[lms_map[sorted[0]]] = 0;
+        for (int i = 1; i < m; i++) {
+            int l = sorted[i - 1], r = sorted[i];
+            int end_l = lms_map[l] + 1 < m ? lms[lms_map[l] + 1] : n;
+            int end_r = lms_map[r] + 1 < m ? lms[lms_map[r] + 1] : n;
+            int same = end_l - l == end_r - r;
+            if (same) {
+                while (l < end_l && SAIS_CHR(l) == SAIS_CHR(r)) {
+                    l++;
+                    r++;
+                }
+                if (l == n || r == n || SAIS_CHR(l) != SAIS_CHR(r)) same = 0;
+            }
+            if (!same) rec_upper++;
+            rec_s[lms_map[sorted[i]]] = rec_upper;
+        }
+
+        if (sais_build(NULL, rec_s, m, rec_upper, rec_sa) != 0) goto done;
+        for (int i = 0; i < m; i++) {
+            sorted[i] = lms[rec_sa[i]];
+        }
+        sais_induce(bytes, ints, n, upper, ls, sum_l, sum_s, sorted, m, bucket, sa);
+    }
+    rc = 0;
+
+done:
+    free(ls);
+    free(sum_l);
+    free(sum_s);
+    free(bucket);
+    free(lms_map);
+    free(lms);
+    free(sorted);
+    free(rec_s);
+    free(rec_sa);
+    return rc;
+}
+
+#undef SAIS_CHR
+
+static void suffix_index_destroy(SuffixIndex *ix) {
+    if (ix == NULL) return;
+    free(ix->text);
+    free(ix->sa);
+    free(ix->line_starts);
+    free(ix);
+}
+
+/*
+ * 建立（或重建）后缀数组索引，成功返回 0；
+ * 文本超过 INT_MAX 字节或内存不足时返回 -1，原索引保持不变
+ */
+int suffix_index_build(TextBuffer *buf) {
+    if (buf == NULL) return -1;
+
+    double start = now_seconds();
+    size_t total = 0;
+    for (int i = 0; i < buf->line_count; i++) {
+        total += (size_t)line_at(buf, i)->length + 1;
+        if (total > INT_MAX) return -1;
+    }
+    if (total > 0) total--;     /* 最后一行之后没有换行符 */
+
+    SuffixIndex *ix = (SuffixIndex*)calloc(1, sizeof(SuffixIndex));
+    if (ix == NULL) return -1;
+    ix->text = (char*)malloc(total + 1);
+    ix->sa = (int*)malloc(sizeof(int) * (total + 1));
+    ix->line_starts = (int*)malloc(sizeof(int) * ((size_t)buf->line_count + 1));
+    if (ix->text == NULL || ix->sa == NULL || ix->line_starts == NULL) {
+        suffix_index_destroy(ix);
+        return -1;
+    }
+
+    size_t pos = 0;
+    for (int i = 0; i < buf->line_count; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        ix->line_starts[i] = (int)pos;
+        memcpy(ix->text + pos, piece->text, (size_t)piece->length);
+        pos += (size_t)piece->length;
+        if (i + 1 < buf->line_count) ix->text[pos++] = '\n';
+    }
+    ix->line_starts[buf->line_count] = (int)total + 1;
+    ix->text[total] = '\0';
+    ix->size = (int)total;
+    ix->lines = buf->line_count;
+
+    if (sais_build((const unsigned char *)ix->text, NULL, ix->size, 255, ix->sa) != 0) {
+        suffix_index_destroy(ix);
+        return -1;
+    }
+
+    ix->revision = buf->revision;
+    ix->builds = buf->suffix_index != NULL ? buf->suffix_index->builds + 1 : 1;
+    ix->build_seconds = now_seconds() - start;
+    suffix_index_destroy(buf->suffix_index);
+    buf->suffix_index = ix;
+    return 0;
+}
+
+void suffix_index_free(TextBuffer *buf) {
+    if (buf == NULL) return;
+    suffix_index_destroy(buf->suffix_index);
+    buf->suffix_index = NULL;
+}
+
+void get_suffix_index_stats(const TextBuffer *buf, SuffixIndexStats *stats) {
+    if (buf == NULL || stats == NULL) return;
+    memset(stats, 0, sizeof(*stats));
+    const SuffixIndex *ix = buf->suffix_index;
+    if (ix == NULL) return;
+
+    stats->enabled = 1;
+    stats->stale = ix->revision != buf->revision;
+    stats->bytes = (size_t)ix->size;
+    stats->memory_bytes = sizeof(SuffixIndex)
+                        + (size_t)ix->size + 1
+                        + sizeof(int) * ((size_t)ix->size + 1)
+                        + sizeof(int) * ((size_t)ix->lines + 1);
+    stats->build_seconds = ix->build_seconds;
+    stats->builds = ix->builds;
+}
+
+/* 索引已建立且与当前内容一致 */
+static int suffix_index_fresh(const TextBuffer *buf) {
+    return buf->suffix_index != NULL && buf->suffix_index->revision == buf->revision;
+}
+
+/*
+ * 比较后缀 pos 与模式：模式是该后缀的前缀时返回 0，
+ * 否则按字典序返回负数（后缀较小）或正数
+ */
+static int suffix_compare(const SuffixIndex *ix, int pos, const char *pattern, size_t m) {
+    size_t avail = (size_t)(ix->size - pos);
+    int c = memcmp(ix->text + pos, pattern, avail < m ? avail : m);
+    if (c != 0) return c;
+    return avail < m ? -1 : 0;
+}
+
+/* 以 pattern 为前缀的后缀在后缀数组中占据的区间 [*lo, *hi)，两次二分共 O(m log n) */
+static void suffix_range(const SuffixIndex *ix, const char *pattern, size_t m, int *lo, int *hi) {
+    int a = 0, b = ix->size;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (suffix_compare(ix, ix->sa[mid], pattern, m) < 0) a = mid + 1;
+        else b = mid;
+    }
+    *lo = a;
+    b = ix->size;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (suffix_compare(ix, ix->sa[mid], pattern, m) <= 0) a = mid + 1;
+        else b = mid;
+    }
+    *hi = a;
+}
+
+static int suffix_count(const SuffixIndex *ix, const char *pattern, size_t m) {
+    if (memchr(pattern, '\n', m) != NULL) return 0;
+    int lo, hi;
+    suffix_range(ix, pattern, m, &lo, &hi);
+    return hi - lo;
+}
+
+/*
+ * 取出全部命中的后缀起点，排序后按行换算为 (行, 列) 追加到结果集，
+ * 耗时只与命中数有关；返回值同 search_results_push
+ */
+static int suffix_collect(TextBuffer *buf, const char *pattern, size_t m, SearchResults *results) {
+    const SuffixIndex *ix = buf->suffix_index;
+    if (memchr(pattern, '\n', m) != NULL) return 0;
+
+    int lo, hi;
+    suffix_range(ix, pattern, m, &lo, &hi);
+    if (hi == lo) return 0;
+    int *hits = (int*)malloc(sizeof(int) * (size_t)(hi - lo));
+    if (hits == NULL) return -1;
+    memcpy(hits, ix->sa + lo, sizeof(int) * (size_t)(hi - lo));
+    qsort(hits, (size_t)(hi - lo), sizeof(int), compare_int);
+
+    int rc = 0;
+    int line = -1;
+    LinePiece *piece = NULL;
+    int ascii_only = 0;
+    ColumnCursor cursor = {0, 0};
+    for (int k = 0; k < hi - lo && rc == 0; k++) {
+        if (line < 0 || hits[k] >= ix->line_starts[line + 1]) {
+            /* 最后一个起点不大于 hits[k] 的行 */
+            int a = line + 1, b = ix->lines - 1;
+            while (a < b) {
+                int mid = a + (b - a + 1) / 2;
+                if (ix->line_starts[mid] <= hits[k]) a = mid;
+                else b = mid - 1;
+            }
+            line = a;
+            piece = line_at(buf, line);
+            ascii_only = piece_chars(piece) == piece->length;
+            cursor.byte = 0;
+            cursor.chr = 0;
+        }
+        rc = push_hit(results, piece->text, (size_t)piece->length, ascii_only,
+                      line, hits[k] - ix->line_starts[line], &cursor);
+    }
+    free(hits);
+    return rc;
+}
+
+/* 索引过期时先重建；未建立索引或重建失败返回 -1 */
+static int suffix_index_refresh(TextBuffer *buf) {
+    if (buf->suffix_index == NULL) return -1;
+    if (suffix_index_fresh(buf)) return 0;
+    return suffix_index_build(buf);
+}
+
+/*
+ * 用后缀数组统计出现次数（允许重叠，与 find_substring_count 一致）
+ * 未建立索引或内存不足返回 -1
+ */
+int suffix_index_count(TextBuffer *buf, const char *substr) {
+    if (buf == NULL || substr == NULL) return -1;
+    if (suffix_index_refresh(buf) != 0) return -1;
+    if (substr[0] == '\0') return 0;
+    return suffix_count(buf->suffix_index, substr, strlen(substr));
+}
+
+/*
+ * 用后缀数组列出所有出现位置（顺序与 find_occurrences 相同）
+ * 返回收集到的结果数，未建立索引或内存不足返回 -1
+ */
+int suffix_index_occurrences(TextBuffer *buf, const char *substr, SearchResults *results) {
+    if (buf == NULL || substr == NULL || results == NULL) return -1;
+    if (suffix_index_refresh(buf) != 0) return -1;
+    if (substr[0] == '\0') return 0;
+    int rc = suffix_collect(buf, substr, strlen(substr), results);
+    return rc < 0 ? -1 : results->count;
+}
+
+/* ========================== 查找引擎 ========================== */
+
+static SearchEngine g_search_engine = SEARCH_ENGINE_AUTO;
+
+void set_search_engine(SearchEngine engine) {
+    g_search_engine = engine;
+}
+
+SearchEngine get_search_engine(void) {
+    return g_search_engine;
+}
+
+const char* search_engine_name(SearchEngine engine) {
+    switch (engine) {
+        case SEARCH_ENGINE_KMP:  return "KMP";
+        case SEARCH_ENGINE_SIMD: return "SIMD";
+        case SEARCH_ENGINE_BMH:  return "BMH";
+        default:                 return "auto";
+    }
+}
+
+/*
+ * Horspool / Two-Way 预处理数据
+ * shift[c] 为字节 c 在模式中最后一次出现的位置 + 1（0 表示不出现），
+ * 窗口末字节不匹配时据此整体右移；ms/period 是 Two-Way 的临界分解，
+ * 保证校验阶段不会回退，整体最坏情况仍为线性
+ */
+typedef struct {
+    size_t shift[256];
+    size_t ms;          /* 临界位置：左半部分为 [0, ms]，右半部分为 (ms, m) */
+    size_t period;      /* 失配后窗口的移动距离 */
+    size_t mem0;        /* 周期模式移动后可跳过的已匹配前缀长度，非周期为 0 */
+} BmhTable;
+
+/* 一次查找所用的模式及预处理数据 */
+typedef struct {
+    const char *pattern;
+    size_t m;
+    SearchEngine engine;    /* 实际使用的引擎（不会是 AUTO） */
+    int *lps;               /* KMP 部分匹配表 */
+    BmhTable *bmh;          /* BMH 跳跃表，所有行共用 */
+    char *folded;           /* 忽略大小写时折叠为小写的模式，否则为 NULL */
+} Searcher;
+
+/*
+ * 大小写折叠表：区间内的码点加 delta 得到小写。
+ * 折叠前后 UTF-8 字节长度不变，所以匹配长度仍等于模式的字节数，
+ * 文本一侧由 simd_find_pattern_nocase 按同一张表的规则现场折叠
+ */
+static const struct {
+    int first;
+    int last;
+    int delta;
+} g_case_fold_ranges[] = {
+    { 'A',    'Z',    0x20 },
+    { 0xFF21, 0xFF3A, 0x20 },   /* 全角拉丁大写字母 Ａ-Ｚ */
+};
+
+static int case_fold_codepoint(int cp) {
+    for (size_t k = 0; k < sizeof(g_case_fold_ranges) / sizeof(g_case_fold_ranges[0]); k++) {
+        if (cp >= g_case_fold_ranges[k].first && cp <= g_case_fold_ranges[k].last) {
+            return cp + g_case_fold_ranges[k].delta;
+        }
+    }
+    return cp;
+}
+
+/* 把 src 的 m 个字节折叠为小写写入 dst；不完整或非法的字节序列原样复制 */
+static void case_fold_pattern(char *dst, const char *src, size_t m) {
+    const unsigned char *s = (const unsigned char*)src;
+    unsigned char *d = (unsigned char*)dst;
+    size_t i = 0;
+    while (i < m) {
+        int len = utf8_char_length(s[i]);
+        if (len > 3 || (size_t)len > m - i) len = 1;
+        int advance;
+        int cp = len == 1 ? s[i] : utf8_next_codepoint(s + i, &advance);
+        int folded = case_fold_codepoint(cp);
+        if (folded == cp) {
+            memcpy(d + i, s + i, (size_t)len);
+        } else if (len == 1) {
+            d[i] = (unsigned char)folded;
+        } else {
+            d[i] = (unsigned char)(0xE0 | (folded >> 12));
+            d[i + 1] = (unsigned char)(0x80 | ((folded >> 6) & 0x3F));
+            d[i + 2] = (unsigned char)(0x80 | (folded & 0x3F));
+        }
+        i += (size_t)len;
+    }
+}
+
+/* 求最大后缀（greater 为 1 时按字节大于比较，否则按小于），返回临界位置，周期写入 *period */
+static size_t max_suffix(const unsigned char *n, size_t m, int greater, size_t *period) {
+    size_t ip = (size_t)-1, jp = 0, k = 1, p = 1;
+    while (jp + k < m) {
+        unsigned char a = n[ip + k], b = n[jp + k];
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (greater ? a > b : a < b) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ip;
+}
+
+static void build_bmh(const char *pattern, size_t m, BmhTable *t) {
+    const unsigned char *n = (const unsigned char*)pattern;
+    memset(t->shift, 0, sizeof(t->shift));
+    for (size_t i = 0; i < m; i++) {
+        t->shift[n[i]] = i + 1;
+    }
+
+    /* 临界分解：两种字节序下的最大后缀取较长者 */
+    size_t p0, p1;
+    size_t ms = max_suffix(n, m, 1, &p0);
+    size_t ms1 = max_suffix(n, m, 0, &p1);
+    size_t p = p0;
+    if (ms1 + 1 > ms + 1) {
+        ms = ms1;
+        p = p1;
+    }
+
+    if (memcmp(n, n + p, ms + 1) != 0) {
+        /* 非周期模式：失配后可整体移过较长的一半 */
+        t->mem0 = 0;
+        p = (ms + 1 > m - ms - 1 ? ms + 1 : m - ms - 1) + 1;
+    } else {
+        t->mem0 = m - p;
+    }
+    t->ms = ms;
+    t->period = p;
+}
+
+/* 用 BMH 表在 [text, text + n) 中查找第一次出现的位置 */
+static const char* bmh_find(const BmhTable *t, const char *text, size_t n, const char *pattern, size_t m) {
+    const unsigned char *h = (const unsigned char*)text;
+    const unsigned char *z = h + n;
+    const unsigned char *pat = (const unsigned char*)pattern;
+    size_t ms = t->ms;
+    size_t mem = 0;
+    size_t k;
+
+    while ((size_t)(z - h) >= m) {
+        /* 先看窗口末字节，按 Horspool 跳跃表移动 */
+        size_t s = t->shift[h[m - 1]];
+        if (s != m) {
+            k = s ? m - s : m;
+            if (k < mem) k = mem;
+            h += k;
+            mem = 0;
+            continue;
+        }
+
+        /* 右半部分从左往右比较，失配时按失配位置移动 */
+        for (k = ms + 1 > mem ? ms + 1 : mem; k < m && pat[k] == h[k]; k++) {}
+        if (k < m) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        /* 左半部分从右往左比较 */
+        for (k = ms + 1; k > mem && pat[k - 1] == h[k - 1]; k--) {}
+        if (k <= mem) return (const char*)h;
+        h += t->period;
+        mem = t->mem0;
+    }
+    return NULL;
+}
+
+/*
+ * 自动选择：短模式的首尾字节在文本中很少同时命中，向量过滤后几乎不用校验；
+ * 长模式交给 BMH，窗口末字节不在模式中时一次跳过整个模式长度
+ */
+static int searcher_init(Searcher *s, const char *pattern, size_t m) {
+    s->pattern = pattern;
+    s->m = m;
+    s->lps = NULL;
+    s->bmh = NULL;
+    s->folded = NULL;
+    s->engine = g_search_engine;
+    if (s->engine == SEARCH_ENGINE_AUTO) {
+        s->engine = m <= SEARCH_SIMD_MAX_PATTERN ? SEARCH_ENGINE_SIMD : SEARCH_ENGINE_BMH;
+    }
+
+    if (s->engine == SEARCH_ENGINE_KMP) {
+        s->lps = (int*)malloc(sizeof(int) * m);
+        if (s->lps == NULL) return -1;
+        build_lps(pattern, m, s->lps);
+    } else if (s->engine == SEARCH_ENGINE_BMH) {
+        s->bmh = (BmhTable*)malloc(sizeof(BmhTable));
+        if (s->bmh == NULL) return -1;
+        build_bmh(pattern, m, s->bmh);
+    }
+    return 0;
+}
+
+/*
+ * 忽略大小写的查找只折叠一份模式，文本逐行现场折叠比较，不复制任何一行；
+ * 折叠后的首尾字节仍可向量过滤，所以固定使用 SIMD 内核，不受引擎设置影响
+ */
+static int searcher_init_nocase(Searcher *s, const char *pattern, size_t m) {
+    s->m = m;
+    s->lps = NULL;
+    s->bmh = NULL;
+    s->engine = SEARCH_ENGINE_SIMD;
+    s->folded = (char*)malloc(m);
+    if (s->folded == NULL) return -1;
+    case_fold_pattern(s->folded, pattern, m);
+    s->pattern = s->folded;
+    return 0;
+}
+
+static void searcher_free(Searcher *s) {
+    free(s->lps);
+    free(s->bmh);
+    free(s->folded);
+    s->lps = NULL;
+    s->bmh = NULL;
+    s->folded = NULL;
+}
+
+/* 在 [text, text + n) 中查找第一次出现的位置 */
+static const char* searcher_find(const Searcher *s, const char *text, size_t n) {
+    if (s->m > n) return NULL;
+    if (s->engine == SEARCH_ENGINE_KMP) {
+        return kmp_find_first(text, n, s->pattern, s->lps, s->m);
+    }
+    if (s->engine == SEARCH_ENGINE_BMH) {
+        return bmh_find(s->bmh, text, n, s->pattern, s->m);
+    }
+    size_t pos = s->folded != NULL ? simd_find_pattern_nocase(text, n, s->pattern, s->m)
+                                   : simd_find_pattern(text, n, s->pattern, s->m);
+    return pos < n ? text + pos : NULL;
+}
+
+/* 统计一行中的出现次数（允许重叠，与 KMP 计数一致） */
+static int searcher_count_line(const Searcher *s, const char *text, size_t n) {
+    if (s->engine == SEARCH_ENGINE_KMP) {
+        return kmp_count_line(text, n, s->pattern, s->lps, s->m);
+    }
+    int count = 0;
+    const char *end = text + n;
+    const char *p;
+    while ((p = searcher_find(s, text, (size_t)(end - text))) != NULL) {
+        count++;
+        text = p + 1;
+    }
+    return count;
+}
+
+/* 把一行中的所有命中（允许重叠）追加到结果集，返回值同 search_results_push */
+static int searcher_collect_line(const Searcher *s, const char *text, size_t n, int ascii_only,
+                                 int line_idx, SearchResults *results) {
+    if (s->engine == SEARCH_ENGINE_KMP) {
+        return kmp_collect_line(text, n, ascii_only, s->pattern, s->lps, s->m, line_idx, results);
+    }
+    ColumnCursor cursor = {0, 0};
+    const char *from = text;
+    const char *end = text + n;
+    const char *p;
+    while ((p = searcher_find(s, from, (size_t)(end - from))) != NULL) {
+        int rc = push_hit(results, text, n, ascii_only, line_idx, (int)(p - text), &cursor);
+        if (rc != 0) return rc;
+        from = p + 1;
+    }
+    return 0;
+}
+
+/*
+ * 统计子串在文本中出现的次数（nocase 为 1 时忽略大小写；
+ * 三元组索引和后缀数组都按原字节建立，忽略大小写时不使用）
+ */
+static int count_substring(TextBuffer *buf, const char *substr, int nocase) {
+    int count = 0;
+
+    if (buf == NULL || substr == NULL || substr[0] == '\0') return 0;
+
+    size_t m = strlen(substr);
+    if (!nocase && suffix_index_fresh(buf)) {
+        return suffix_count(buf->suffix_index, substr, m);
+    }
+
+    Searcher searcher;
+    if ((nocase ? searcher_init_nocase(&searcher, substr, m) : searcher_init(&searcher, substr, m)) != 0) {
+        return 0;
+    }
+
+    int *cand = NULL;
+    int ncand = 0;
+    int indexed = !nocase && search_index_candidates(buf, substr, m, &cand, &ncand);
+    int total = indexed ? ncand : buf->line_count;
+    for (int k = 0; k < total; k++) {
+        const LinePiece *piece = line_at(buf, indexed ? cand[k] : k);
+        count += searcher_count_line(&searcher, piece->text, (size_t)piece->length);
+    }
+
+    free(cand);
+    searcher_free(&searcher);
+    return count;
+}
+
+int find_substring_count(TextBuffer *buf, const char *substr) {
+    return count_substring(buf, substr, 0);
+}
+
+int find_substring_count_nocase(TextBuffer *buf, const char *substr) {
+    return count_substring(buf, substr, 1);
+}
+
+/*
+ * 单遍扫描，把所有出现位置追加到 results（由调用方初始化）；
+ * 返回收集到的结果数，内存不足时返回 -1（已收集的结果保留）
+ */
+static int collect_occurrences(TextBuffer *buf, const char *substr, int nocase, SearchResults *results) {
+    if (buf == NULL || substr == NULL || results == NULL) return -1;
+    if (substr[0] == '\0') return 0;
+
+    size_t m = strlen(substr);
+    if (!nocase && suffix_index_fresh(buf)) {
+        int rc = suffix_collect(buf, substr, m, results);
+        return rc < 0 ? -1 : results->count;
+    }
+
+    Searcher searcher;
+    if ((nocase ? searcher_init_nocase(&searcher, substr, m) : searcher_init(&searcher, substr, m)) != 0) {
+        return -1;
+    }
+
+    /* 建立了三元组索引时只校验候选行 */
+    int *cand = NULL;
+    int ncand = 0;
+    int indexed = !nocase && search_index_candidates(buf, substr, m, &cand, &ncand);
+    int total = indexed ? ncand : buf->line_count;
+    int rc = 0;
+    for (int k = 0; k < total && rc == 0; k++) {
+        int i = indexed ? cand[k] : k;
+        LinePiece *piece = line_at(buf, i);
+        int ascii_only = piece_chars(piece) == piece->length;
+        rc = searcher_collect_line(&searcher, piece->text, (size_t)piece->length, ascii_only, i, results);
+    }
+
+    free(cand);
+    searcher_free(&searcher);
+    return rc < 0 ? -1 : results->count;
+}
+
+int find_occurrences(TextBuffer *buf, const char *substr, SearchResults *results) {
+    return collect_occurrences(buf, substr, 0, results);
+}
+
+int find_occurrences_nocase(TextBuffer *buf, const char *substr, SearchResults *results) {
+    return collect_occurrences(buf, substr, 1, results);
+}
+
+/*
+ * 获取所有出现位置，返回的数组由调用方 free
+ */
+static SearchResult* collect_all_occurrences(TextBuffer *buf, const char *substr, int nocase, int *count) {
+    if (buf == NULL || substr == NULL || count == NULL) return NULL;
+
+    SearchResults results;
+    search_results_init(&results, 0);
+    if (collect_occurrences(buf, substr, nocase, &results) <= 0) {
+        search_results_free(&results);
+        *count = 0;
+        return NULL;
+    }
+
+    *count = results.count;
+    return results.items;
+}
+
+SearchResult* find_all_occurrences(TextBuffer *buf, const char *substr, int *count) {
+    return collect_all_occurrences(buf, substr, 0, count);
+}
+
+SearchResult* find_all_occurrences_nocase(TextBuffer *buf, const char *substr, int *count) {
+    return collect_all_occurrences(buf, substr, 1, count);
+}
+
+/* ========================== 流式文件查找 ========================== */
+
+/*
+ * 分块读取时跨块的状态：窗口开头保留上一块末尾可能与下一块拼成匹配的字节，
+ * 这些字节总是属于当前行；列号按与 push_hit 相同的规则从行首逐字符步进
+ */
+typedef struct {
+    const Searcher *searcher;
+    SearchResults *results;     /* NULL 或已收集满时只计数 */
+    long long count;            /* 匹配总数 */
+    int line;                   /* 当前行号 */
+    long long step_byte;        /* 列号步进到的字符边界（行内字节偏移） */
+    long long step_chars;       /* 该边界之前的字符数 */
+} StreamSearch;
+
+/*
+ * 报告 [text, text + n) 中的匹配，text 位于当前行的字节偏移 base 处；
+ * 返回 0 继续，-1 表示内存不足
+ */
+static int stream_search_segment(StreamSearch *st, const char *text, size_t n, long long base) {
+    if (st->results == NULL) {
+        st->count += searcher_count_line(st->searcher, text, n);
+        return 0;
+    }
+
+    const char *from = text;
+    const char *end = text + n;
+    const char *p;
+    while ((p = searcher_find(st->searcher, from, (size_t)(end - from))) != NULL) {
+        st->count++;
+        from = p + 1;
+        if (st->results == NULL) continue;
+
+        long long target = base + (p - text);
+        while (st->step_byte < target) {
+            st->step_byte += utf8_char_length((unsigned char)text[st->step_byte - base]);
+            st->step_chars++;
+        }
+        /* 落在多字节字符中间时退回字节位置，与 push_hit 一致 */
+        long long column = st->step_byte == target ? st->step_chars : target;
+        int rc = search_results_push(st->results, st->line, (int)column);
+        if (rc < 0) return -1;
+        if (rc > 0) st->results = NULL;
+    }
+    return 0;
+}
+
+/*
+ * 在文件中查找子串而不把文件读入 TextBuffer：每次读入 STREAM_CHUNK_SIZE 字节，
+ * 内存占用与文件大小无关；行的划分（'\n' 分行、去掉行尾 '\r'）、重叠计数和列号
+ * 都与 file_open 后调用 find_occurrences 相同，使用当前选择的查找引擎
+ * results 为 NULL 时只计数，否则收集到结果集容量或上限为止，之后继续计数
+ * 返回匹配总数；无法打开或读取文件、内存不足时返回 -1
+ */
+long long stream_search_file(const char *filename, const char *substr, SearchResults *results) {
+    if (filename == NULL || substr == NULL) return -1;
+
+    FILE *fp = NULL;
+    if (fopen_s(&fp, filename, "rb") != 0 || fp == NULL) return -1;
+
+    size_t m = strlen(substr);
+    if (m == 0 || memchr(substr, '\n', m) != NULL) {
+        fclose(fp);
+        return 0;
+    }
+
+    Searcher searcher;
+    if (searcher_init(&searcher, substr, m) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    StreamSearch st = { &searcher, results, 0, 0, 0, 0 };
+    size_t window_cap = STREAM_CHUNK_SIZE + m;
+    char *window = (char*)malloc(window_cap);
+    size_t carry = 0;               /* 窗口开头保留的字节数 */
+    long long carry_offset = 0;     /* window[0] 在当前行中的字节偏移 */
+    int failed = window == NULL;
+
+    while (!failed) {
+        if (carry + STREAM_CHUNK_SIZE > window_cap) {
+            /* 行尾连续的 '\r' 过长时保留区才会超过 m - 1 字节 */
+            char *grown = (char*)realloc(window, carry + STREAM_CHUNK_SIZE);
+            if (grown == NULL) {
+                failed = 1;
+                break;
+            }
+            window = grown;
+            window_cap = carry + STREAM_CHUNK_SIZE;
+        }
+        size_t got = fread(window + carry, 1, STREAM_CHUNK_SIZE, fp);
+        if (ferror(fp)) {
+            failed = 1;
+            break;
+        }
+        int eof = got < STREAM_CHUNK_SIZE;
+        size_t size = carry + got;
+        size_t pos = 0;
+        long long base = carry_offset;
+
+        for (;;) {
+            size_t nl = pos + simd_find_pattern(window + pos, size - pos, "\n", 1);
+            if (nl < size || eof) {
+                /* 完整的一行（文件末尾没有换行符的最后一行也算） */
+                size_t line_end = nl < size ? nl : size;
+                while (line_end > pos && window[line_end - 1] == '\r') line_end--;
+                if (stream_search_segment(&st, window + pos, line_end - pos, base) != 0) {
+                    failed = 1;
+                    break;
+                }
+                if (nl >= size) break;
+                st.line++;
+                st.step_byte = 0;
+                st.step_chars = 0;
+                pos = nl + 1;
+                base = 0;
+                continue;
+            }
+
+            /*
+             * 行在块尾未结束：行尾的 '\r' 可能是换行前要去掉的，先不参与匹配；
+             * 起点在保留区之前的匹配已经完整，保留区留给下一块继续
+             */
+            size_t limit = size;
+            while (limit > pos && window[limit - 1] == '\r') limit--;
+            if (stream_search_segment(&st, window + pos, limit - pos, base) != 0) {
+                failed = 1;
+                break;
+            }
+            size_t keep = limit - pos > m - 1 ? limit - (m - 1) : pos;
+            long long keep_offset = base + (long long)(keep - pos);
+            while (st.step_byte < keep_offset) {
+                st.step_byte += utf8_char_length((unsigned char)window[pos + (size_t)(st.step_byte - base)]);
+                st.step_chars++;
+            }
+            memmove(window, window + keep, size - keep);
+            carry = size - keep;
+            carry_offset = keep_offset;
+            break;
+        }
+        if (eof) break;
+    }
+
+    free(window);
+    searcher_free(&searcher);
+    fclose(fp);
+    return failed ? -1 : st.count;
+}
+
+/* ========================== 子串插入功能 ========================== */
+
+/*
+ * 在指定行和列位置插入子串
+ */
+int insert_substring(TextBuffer *buf, int line, int col, const char *substr) {
+    if (buf == NULL || substr == NULL) return -1;
+    if (line < 0 || line >= buf->line_count) return -1;
+
+    LinePiece *piece = line_at(buf, line);
+    int byte_col = line_byte_offset(buf, piece, col);
+    if (byte_col < 0) return -1;
+
+    size_t substr_len = strlen(substr);
+    if (substr_len > (size_t)(INT_MAX - piece->length)) return -1;
+
+    return line_splice(buf, line, byte_col, byte_col, substr, substr_len);
+}
+
+/*
+ * 在全局位置插入子串（按字符计），位置基于现有文本行及换行符顺序
+ */
+int insert_at_position(TextBuffer *buf, int pos, const char *substr) {
+    if (buf == NULL || substr == NULL || pos < 0) return -1;
+
+    /* 空缓冲区时，直接作为第一行插入 */
+    if (buf->line_count == 0) {
+        return insert_line(buf, 0, substr);
+    }
+
+    int line, col;
+    if (position_to_line_col(buf, pos, &line, &col) != 0) {
+        return -1;
+    }
+    return insert_substring(buf, line, col, substr);
+}
+
+/*
+ * 全局字符位置 -> (行, 列)
+ * 第 i 行覆盖位置 [起点, 起点 + 字符数]，最后一个位置即行尾（换行符之前）
+ */
+int position_to_line_col(const TextBuffer *buf, int pos, int *line, int *col) {
+    if (buf == NULL || line == NULL || col == NULL || pos < 0) return -1;
+    if (buf->line_count == 0) return -1;
+
+    TextBuffer *tree_buf = (TextBuffer*)buf; /* 树状数组是缓存，按需建立 */
+    if (ensure_char_tree(tree_buf) != 0) return -1;
+
+    int cap = buf->line_capacity;
+    int step = 1;
+    while (step * 2 <= cap && step * 2 > 0) step *= 2;
+
+    /* 树上二分：找到第一个前缀和超过 pos 的槽位 */
+    int slot = 0;
+    long long remaining = pos;
+    for (; step > 0; step >>= 1) {
+        int next = slot + step;
+        if (next <= cap && buf->char_tree[next] <= remaining) {
+            slot = next;
+            remaining -= buf->char_tree[next];
+        }
+    }
+    if (slot >= cap) return -1; /* 超出文本末尾 */
+
+    *line = slot < buf->gap_start ? slot : slot - (buf->gap_end - buf->gap_start);
+    *col = (int)remaining;
+    return 0;
+}
+
+/*
+ * (行, 列) -> 全局字符位置，列允许等于行字符数（行尾）
+ */
+int line_col_to_position(const TextBuffer *buf, int line, int col) {
+    if (buf == NULL || line < 0 || line >= buf->line_count || col < 0) return -1;
+
+    TextBuffer *tree_buf = (TextBuffer*)buf;
+    if (ensure_char_tree(tree_buf) != 0) return -1;
+
+    LinePiece *piece = line_at(buf, line);
+    if (col > piece_chars(piece)) return -1;
+
+    long long pos = char_tree_prefix(buf, line_slot(buf, line)) + col;
+    return pos > INT_MAX ? -1 : (int)pos;
+}
+
+/* ========================== 子串修改功能 ========================== */
+
+/*
+ * 把行内 [col, col + len) 的字符范围换算为字节范围，len 超出行尾时截断
+ */
+static int char_range_to_bytes(TextBuffer *buf, LinePiece *piece, int col, int len,
+                               int *byte_start, int *byte_end) {
+    int line_chars = piece_chars(piece);
+    if (col < 0 || col >= line_chars) return -1;
+    if (len > line_chars - col) len = line_chars - col;
+
+    *byte_start = line_byte_offset(buf, piece, col);
+    *byte_end = line_byte_offset(buf, piece, col + len);
+    if (*byte_start < 0) return -1;
+    if (*byte_end < 0) *byte_end = piece->length;
+    return 0;
+}
+
+/*
+ * 在指定位置替换指定长度的内容
+ */
+int replace_at_position(TextBuffer *buf, int line, int col, int len, const char *newstr) {
+    if (buf == NULL || newstr == NULL) return -1;
+    if (line < 0 || line >= buf->line_count) return -1;
+    if (len < 0) return -1;
+
+    int byte_start, byte_end;
+    if (char_range_to_bytes(buf, line_at(buf, line), col, len, &byte_start, &byte_end) != 0) {
+        return -1;
+    }
+
+    size_t newstr_len = strlen(newstr);
+    if (newstr_len > (size_t)(INT_MAX - line_at(buf, line)->length)) return -1;
+
+    return line_splice(buf, line, byte_start, byte_end, newstr, newstr_len);
+}
+
+/*
+ * 替换单个字符
+ */
+int replace_char(TextBuffer *buf, int line, int col, const char *newchar_utf8) {
+    if (buf == NULL || newchar_utf8 == NULL) return -1;
+    return replace_at_position(buf, line, col, 1, newchar_utf8);
+}
+
+/* 逐行替换的参数；searcher 只读，可由多个线程共用，offsets 每个线程各一份 */
+typedef struct {
+    const Searcher *searcher;
+    size_t oldlen;
+    const char *newstr;
+    size_t newlen;
+    int *offsets;           /* 变长替换时记录一行中匹配的偏移，在各行间复用 */
+    size_t offsets_cap;
+} LineReplacer;
+
+/*
+ * 替换一行中所有不重叠的匹配，新内容直接写到追加区链表 head/tail 的尾部，
+ * 只有一个输出游标，不经过临时缓冲区：先找第一处匹配，没有匹配的行不复制；
+ * 替换不变长时行长度就是上界，预留后单遍写出；变长时先找出全部匹配并记下偏移，
+ * 按确切长度预留后照偏移写出，不再重复查找
+ * 返回替换次数并通过 image/length 返回新内容（0 表示没有匹配），失败返回 -1
+ */
+static int replace_line_matches(LineReplacer *r, const LinePiece *piece, AddBlock **head, AddBlock **tail,
+                                const char **image, int *length) {
+    const char *text = piece->text;
+    const char *end = text + piece->length;
+    const char *p = searcher_find(r->searcher, text, (size_t)piece->length);
+    if (p == NULL) return 0;
+
+    size_t oldlen = r->oldlen;
+    size_t newlen = r->newlen;
+    size_t bound = (size_t)piece->length;
+    size_t hits = 0;
+    if (newlen > oldlen) {
+        for (; p != NULL; p = searcher_find(r->searcher, p + oldlen, (size_t)(end - p) - oldlen)) {
+            if (hits == r->offsets_cap) {
+                size_t cap = r->offsets_cap ? r->offsets_cap * 2 : 256;
+                int *grown = (int*)realloc(r->offsets, sizeof(int) * cap);
+                if (grown == NULL) return -1;
+                r->offsets = grown;
+                r->offsets_cap = cap;
+            }
+            r->offsets[hits++] = (int)(p - text);
+        }
+        if (hits > (INT_MAX - bound) / (newlen - oldlen)) return -1;
+        bound += hits * (newlen - oldlen);
+    }
+
+    char *dst = add_chain_reserve(head, tail, bound + 1);
+    if (dst == NULL) return -1;
+
+    size_t out = 0;
+    int line_hits = 0;
+    const char *last = text;
+    while (newlen > oldlen ? (size_t)line_hits < hits : p != NULL) {
+        if (newlen > oldlen) p = text + r->offsets[line_hits];
+        memcpy(dst + out, last, (size_t)(p - last));
+        out += (size_t)(p - last);
+        memcpy(dst + out, r->newstr, newlen);
+        out += newlen;
+        last = p + oldlen;
+        line_hits++;
+        if (newlen <= oldlen) p = searcher_find(r->searcher, last, (size_t)(end - last));
+    }
+    memcpy(dst + out, last, (size_t)(end - last));
+    out += (size_t)(end - last);
+
+    *image = g_empty_line;
+    if (out > 0) {
+        dst[out] = '\0';
+        (*tail)->used += out + 1;
+        *image = dst;
+    }
+    *length = (int)out;
+    return line_hits;
+}
+
+/* 并行替换中一个线程改写的一行，合并时按行号写回 */
+typedef struct {
+    int line;
+    const char *text;
+    int length;
+    int chars;
+} LineChange;
+
+/* 并行替换的一个分片：候选下标 [first, last)，新内容写在线程自己的追加区链表中 */
+typedef struct {
+    TextBuffer *buf;
+    const int *cand;        /* 三元组索引筛出的候选行，NULL 表示逐行 */
+    int first;
+    int last;
+    LineReplacer replacer;
+    AddBlock *add_head;
+    AddBlock *add_tail;
+    LineChange *changes;
+    int change_count;
+    int change_capacity;
+    long long removed[CHAR_CLASS_COUNT];    /* 被替换行的字符统计 */
+    long long added[CHAR_CLASS_COUNT];      /* 新内容的字符统计 */
+    int count;
+    int failed;
+} ReplaceTask;
+
+static void replace_worker(void *arg) {
+    ReplaceTask *task = (ReplaceTask*)arg;
+    TextBuffer *buf = task->buf;
+    for (int k = task->first; k < task->last; k++) {
+        int i = task->cand ? task->cand[k] : k;
+        const LinePiece *piece = line_at(buf, i);
+        const char *image;
+        int length;
+        int hits = replace_line_matches(&task->replacer, piece, &task->add_head, &task->add_tail, &image, &length);
+        if (hits == 0) continue;
+        if (hits > 0 && task->change_count == task->change_capacity) {
+            int cap = task->change_capacity ? task->change_capacity * 2 : 64;
+            LineChange *grown = (LineChange*)realloc(task->changes, sizeof(LineChange) * (size_t)cap);
+            if (grown == NULL) {
+                hits = -1;
+            } else {
+                task->changes = grown;
+                task->change_capacity = cap;
+            }
+        }
+        if (hits < 0) {
+            task->failed = 1;
+            return;
+        }
+
+        LineChange *change = &task->changes[task->change_count++];
+        change->line = i;
+        change->text = image;
+        change->length = length;
+        change->chars = utf8_count_chars(image, length);
+        if (buf->stats_valid) {
+            const unsigned char *old = (const unsigned char*)piece->text;
+            classify_text(old, old + piece->length, task->removed);
+            classify_text((const unsigned char*)image, (const unsigned char*)image + length, task->added);
+        }
+        task->count += hits;
+    }
+}
+
+/*
+ * 替换所有匹配的子串（nocase 为 1 时忽略大小写，替换内容按原样写入）
+ * threads > 1 时按行区间分给多个线程：各线程把新内容写进自己的追加区链表并记下改动，
+ * 全部结束后把这些链表接到缓冲区的追加区末尾，再逐行写回片段、合并统计
+ * （三元组索引、树状数组和修订号只在调用线程中更新）
+ */
+static int replace_matches(TextBuffer *buf, const char *oldstr, const char *newstr, int nocase, int threads) {
+    int count = 0;
+
+    if (buf == NULL || oldstr == NULL || newstr == NULL) return -1;
+    if (oldstr[0] == '\0') return 0;
+
+    size_t oldlen = strlen(oldstr);
+    int failed = 0;
+
+    Searcher searcher;
+    if ((nocase ? searcher_init_nocase(&searcher, oldstr, oldlen) : searcher_init(&searcher, oldstr, oldlen)) != 0) {
+        return -1;
+    }
+    LineReplacer replacer = { &searcher, oldlen, newstr, strlen(newstr), NULL, 0 };
+    undo_group_begin(buf);
+
+    /* 候选行号在替换过程中不变（替换不增删行），可以直接沿用 */
+    int *cand = NULL;
+    int ncand = 0;
+    int indexed = !nocase && search_index_candidates(buf, oldstr, oldlen, &cand, &ncand);
+    int total = indexed ? ncand : buf->line_count;
+
+    if (threads > MAX_WORKER_THREADS) threads = MAX_WORKER_THREADS;
+    if (threads > total / PARALLEL_MIN_LINES) threads = total / PARALLEL_MIN_LINES;
+    ReplaceTask *tasks = threads > 1 ? (ReplaceTask*)calloc((size_t)threads, sizeof(ReplaceTask)) : NULL;
+
+    if (tasks == NULL) {
+        for (int k = 0; k < total; k++) {
+            int i = indexed ? cand[k] : k;
+            const char *image;
+            int length;
+            int hits = replace_line_matches(&replacer, line_at(buf, i), &buf->add_head, &buf->add_tail, &image, &length);
+            if (hits > 0 && piece_assign(buf, i, image, length) != 0) hits = -1;
+            if (hits < 0) {
+                failed = 1;
+                break;
+            }
+            count += hits;
+        }
+    } else {
+        /* 共享的查表数据和指令集检测须在启动线程前完成 */
+        init_codepoint_classes();
+        simd_level();
+
+        for (int t = 0; t < threads; t++) {
+            tasks[t].buf = buf;
+            tasks[t].cand = indexed ? cand : NULL;
+            tasks[t].first = (int)((long long)total * t / threads);
+            tasks[t].last = (int)((long long)total * (t + 1) / threads);
+            tasks[t].replacer = replacer;
+        }
+        text_parallel_run(replace_worker, tasks, sizeof(ReplaceTask), threads);
+
+        /* 合并时逐行写回：先让改动行所在的块独占（与快照共享时复制），写回就不会中途失败 */
+        int owned = 1;
+        for (int t = 0; t < threads && owned; t++) {
+            for (int c = 0; c < tasks[t].change_count && owned; c++) {
+                int slot = line_slot(buf, tasks[t].changes[c].line);
+                owned = lines_own(buf, slot, slot + 1) == 0;
+            }
+        }
+
+        long long delta[CHAR_CLASS_COUNT] = {0};
+        for (int t = 0; t < threads; t++) {
+            ReplaceTask *task = &tasks[t];
+            if (task->add_head != NULL) {
+                if (buf->add_tail != NULL) {
+                    buf->add_tail->next = task->add_head;
+                } else {
+                    buf->add_head = task->add_head;
+                }
+                buf->add_tail = task->add_tail;
+            }
+            failed |= task->failed || !owned;
+            if (owned) {
+                for (int c = 0; c < task->change_count; c++) {
+                    const LineChange *change = &task->changes[c];
+                    piece_replace(buf, change->line, change->text, change->length, change->chars, 0);
+                }
+                for (int c = 0; c < CHAR_CLASS_COUNT; c++) {
+                    delta[c] += task->added[c] - task->removed[c];
+                }
+                count += task->count;
+            }
+            free(task->changes);
+            free(task->replacer.offsets);
+        }
+        if (buf->stats_valid) stats_apply_counts(buf, delta, 1);
+        free(tasks);
+    }
+
+    free(replacer.offsets);
+    free(cand);
+    searcher_free(&searcher);
+    undo_group_end(buf);
+
+    if (count > 0) {
+        buf->modified = 1;
+    }
+
+    return (failed && count == 0) ? -1 : count;
+}
+
+int replace_all(TextBuffer *buf, const char *oldstr, const char *newstr) {
+    return replace_matches(buf, oldstr, newstr, 0, 1);
+}
+
+int replace_all_nocase(TextBuffer *buf, const char *oldstr, const char *newstr) {
+    return replace_matches(buf, oldstr, newstr, 1, 1);
+}
+
+/*
+ * 多线程替换：threads <= 0 时使用 text_thread_count()，行数不足以分片时退回单线程；
+ * 结果与 replace_all 完全相同
+ */
+int replace_all_parallel(TextBuffer *buf, const char *oldstr, const char *newstr, int threads) {
+    if (threads <= 0) threads = text_thread_count();
+    return replace_matches(buf, oldstr, newstr, 0, threads);
+}
+
+/* ========================== 多模式查找与替换 ========================== */
+
+#define AC_ASCII 128    /* 稠密转移表覆盖的字节数 */
+
+/* 在结点的非 ASCII 子边中查找字节 c，没有时返回 -1 */
+static int ac_high_child(const MultiPattern *mp, int node, unsigned char c) {
+    for (int e = mp->high_first[node]; e < mp->high_first[node + 1]; e++) {
+        if (mp->high_byte[e] == c) return mp->high_child[e];
+    }
+    return -1;
+}
+
+/* 自动机读入一个字节后的状态 */
+static int ac_step(const MultiPattern *mp, int node, unsigned char c) {
+    if (c < AC_ASCII) return mp->ascii_next[(size_t)node * mp->class_count + mp->ascii_class[c]];
+    for (;;) {
+        int child = ac_high_child(mp, node, c);
+        if (child >= 0) return child;
+        if (node == 0) return 0;
+        node = mp->fail[node];
+    }
+}
+
+void multi_pattern_free(MultiPattern *mp) {
+    if (mp == NULL) return;
+    free(mp->lengths);
+    free(mp->same_next);
+    free(mp->ascii_next);
+    free(mp->fail);
+    free(mp->out);
+    free(mp->dict);
+    free(mp->high_first);
+    free(mp->high_byte);
+    free(mp->high_child);
+    memset(mp, 0, sizeof(*mp));
+}
+
+/*
+ * 建立多模式自动机；模式不能为空，相同的模式各自计数
+ * 成功返回 0，参数错误或内存不足返回 -1
+ */
+int multi_pattern_init(MultiPattern *mp, const char *const *patterns, int count) {
+    if (mp == NULL) return -1;
+    memset(mp, 0, sizeof(*mp));
+    if (patterns == NULL || count <= 0) return -1;
+
+    /*
+     * 结点数不超过模式总字节数 + 1；只有模式中出现过的 ASCII 字节需要单独一列，
+     * 其余字节在任何状态下都回到根，共用第 0 列，转移表因此小得多，更容易留在缓存里
+     */
+    size_t max_nodes = 1;
+    mp->class_count = 1;
+    for (int i = 0; i < count; i++) {
+        if (patterns[i] == NULL || patterns[i][0] == '\0') return -1;
+        size_t len = strlen(patterns[i]);
+        if (len > (size_t)(INT_MAX / AC_ASCII) - max_nodes) return -1;
+        max_nodes += len;
+        mp->first_byte[(unsigned char)patterns[i][0]] = 1;
+        for (size_t k = 0; k < len; k++) {
+            unsigned char c = (unsigned char)patterns[i][k];
+            if (c < AC_ASCII && mp->ascii_class[c] == 0) mp->ascii_class[c] = (unsigned char)mp->class_count++;
+        }
+    }
+    size_t width = (size_t)mp->class_count;
+
+    mp->pattern_count = count;
+    mp->lengths = (int*)malloc(sizeof(int) * (size_t)count);
+    mp->same_next = (int*)malloc(sizeof(int) * (size_t)count);
+    mp->ascii_next = (int*)malloc(sizeof(int) * max_nodes * width);
+    mp->fail = (int*)malloc(sizeof(int) * max_nodes);
+    mp->out = (int*)malloc(sizeof(int) * max_nodes);
+    mp->dict = (int*)malloc(sizeof(int) * max_nodes);
+    mp->high_first = (int*)malloc(sizeof(int) * (max_nodes + 1));
+    mp->high_byte = (unsigned char*)malloc(max_nodes);
+    mp->high_child = (int*)malloc(sizeof(int) * max_nodes);
+
+    /* 建树期间的非 ASCII 子边按结点串成链表，建完后再压缩 */
+    int *edge_head = (int*)malloc(sizeof(int) * max_nodes);
+    int *edge_next = (int*)malloc(sizeof(int) * max_nodes);
+    unsigned char *edge_byte = (unsigned char*)malloc(max_nodes);
+    int *edge_child = (int*)malloc(sizeof(int) * max_nodes);
+    int *queue = (int*)malloc(sizeof(int) * max_nodes);
+
+    int ok = mp->lengths && mp->same_next && mp->ascii_next && mp->fail && mp->out && mp->dict &&
+             mp->high_first && mp->high_byte && mp->high_child &&
+             edge_head && edge_next && edge_byte && edge_child && queue;
+
+    if (ok) {
+        /* 建立 trie，ascii_next 中 -1 表示没有子结点 */
+        int edges = 0;
+        mp->node_count = 1;
+        memset(mp->ascii_next, 0xff, sizeof(int) * width);
+        mp->out[0] = -1;
+        edge_head[0] = -1;
+
+        for (int i = 0; i < count; i++) {
+            const unsigned char *p = (const unsigned char*)patterns[i];
+            int len = (int)strlen(patterns[i]);
+            int node = 0;
+            for (int k = 0; k < len; k++) {
+                unsigned char c = p[k];
+                int child = -1;
+                if (c < AC_ASCII) {
+                    child = mp->ascii_next[(size_t)node * width + mp->ascii_class[c]];
+                } else {
+                    for (int e = edge_head[node]; e >= 0; e = edge_next[e]) {
+                        if (edge_byte[e] == c) {
+                            child = edge_child[e];
+                            break;
+                        }
+                    }
+                }
+                if (child < 0) {
+                    child = mp->node_count++;
+                    memset(mp->ascii_next + (size_t)child * width, 0xff, sizeof(int) * width);
+                    mp->out[child] = -1;
+                    edge_head[child] = -1;
+                    if (c < AC_ASCII) {
+                        mp->ascii_next[(size_t)node * width + mp->ascii_class[c]] = child;
+                    } else {
+                        edge_byte[edges] = c;
+                        edge_child[edges] = child;
+                        edge_next[edges] = edge_head[node];
+                        edge_head[node] = edges++;
+                    }
+                }
+                node = child;
+            }
+
+            mp->lengths[i] = len;
+            mp->same_next[i] = -1;
+            if (len > mp->max_length) mp->max_length = len;
+            if (mp->out[node] < 0) {
+                mp->out[node] = i;
+            } else {
+                int j = mp->out[node];
+                while (mp->same_next[j] >= 0) j = mp->same_next[j];
+                mp->same_next[j] = i;
+            }
+        }
+
+        /* 非 ASCII 子边压缩成按结点连续存放的数组 */
+        int pos = 0;
+        for (int node = 0; node < mp->node_count; node++) {
+            mp->high_first[node] = pos;
+            for (int e = edge_head[node]; e >= 0; e = edge_next[e]) {
+                mp->high_byte[pos] = edge_byte[e];
+                mp->high_child[pos] = edge_child[e];
+                pos++;
+            }
+        }
+        mp->high_first[mp->node_count] = pos;
+
+        /*
+         * 按层次遍历求失败链；处理结点 u 时，更浅的失败结点的转移行已经补全，
+         * 因此 u 缺失的 ASCII 转移直接抄失败结点的同一列
+         */
+        int head = 0, tail = 0;
+        mp->fail[0] = 0;
+        mp->dict[0] = -1;
+        queue[tail++] = 0;
+        while (head < tail) {
+            int u = queue[head++];
+            int f = mp->fail[u];
+            int *row = mp->ascii_next + (size_t)u * width;
+            const int *frow = mp->ascii_next + (size_t)f * width;
+            for (size_t c = 0; c < width; c++) {
+                int v = row[c];
+                if (v < 0) {
+                    row[c] = u == 0 ? 0 : frow[c];
+                    continue;
+                }
+                int fv = u == 0 ? 0 : frow[c];
+                mp->fail[v] = fv;
+                mp->dict[v] = mp->out[fv] >= 0 ? fv : mp->dict[fv];
+                queue[tail++] = v;
+            }
+            for (int e = mp->high_first[u]; e < mp->high_first[u + 1]; e++) {
+                int v = mp->high_child[e];
+                int fv = u == 0 ? 0 : ac_step(mp, f, mp->high_byte[e]);
+                mp->fail[v] = fv;
+                mp->dict[v] = mp->out[fv] >= 0 ? fv : mp->dict[fv];
+                queue[tail++] = v;
+            }
+        }
+
+        /* 按实际结点数收缩转移表 */
+        int *shrunk = (int*)realloc(mp->ascii_next, sizeof(int) * (size_t)mp->node_count * width);
+        if (shrunk != NULL) mp->ascii_next = shrunk;
+    }
+
+    free(edge_head);
+    free(edge_next);
+    free(edge_byte);
+    free(edge_child);
+    free(queue);
+
+    if (!ok) {
+        multi_pattern_free(mp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * 单遍扫描统计所有模式的出现次数（允许重叠，与逐个调用 find_substring_count 一致）
+ * counts（可为 NULL）按模式下标写入次数；results（可为 NULL）是 pattern_count 个
+ * 由调用方初始化的结果集，某个结果集达到上限后只停止收集，计数照常进行
+ * 返回所有模式的出现总数，内存不足时返回 -1
+ */
+int find_multi_occurrences(TextBuffer *buf, const MultiPattern *mp, int *counts, SearchResults *results) {
+    if (buf == NULL || mp == NULL || mp->node_count == 0) return -1;
+    if (counts != NULL) memset(counts, 0, sizeof(int) * (size_t)mp->pattern_count);
+
+    /* 非 ASCII 行中最近 max_length 个字节位置的列号，不在字符边界上为 -1 */
+    int window = mp->max_length;
+    int *columns = NULL;
+    if (results != NULL) {
+        columns = (int*)malloc(sizeof(int) * (size_t)window);
+        if (columns == NULL) return -1;
+    }
+
+    int total = 0;
+    int failed = 0;
+    for (int i = 0; i < buf->line_count && !failed; i++) {
+        LinePiece *piece = line_at(buf, i);
+        const unsigned char *text = (const unsigned char*)piece->text;
+        int n = piece->length;
+        int ascii_only = results == NULL || piece_chars(piece) == n;
+        int state = 0;
+        int boundary = 0;
+        int chr = 0;
+
+        for (int k = 0; k < n; k++) {
+            if (state == 0) {
+                while (k < n && !mp->first_byte[text[k]]) k++;
+                if (k == n) break;
+            }
+            /* 被跳过的字节不可能是匹配起点，列号只需在处理到的字节上补齐 */
+            if (!ascii_only) {
+                while (boundary < k) {
+                    boundary += utf8_char_length(text[boundary]);
+                    chr++;
+                }
+                columns[k % window] = boundary == k ? chr : -1;
+            }
+
+            state = ac_step(mp, state, text[k]);
+            for (int v = mp->out[state] >= 0 ? state : mp->dict[state]; v >= 0; v = mp->dict[v]) {
+                for (int p = mp->out[v]; p >= 0; p = mp->same_next[p]) {
+                    total++;
+                    if (counts != NULL) counts[p]++;
+                    if (results == NULL) continue;
+
+                    int start = k + 1 - mp->lengths[p];
+                    int column = ascii_only ? start : columns[start % window];
+                    if (column < 0) column = start;   /* 落在多字节字符中间，同 push_hit 退回字节位置 */
+                    if (search_results_push(&results[p], i, column) < 0) failed = 1;
+                }
+            }
+        }
+    }
+
+    free(columns);
+    return failed ? -1 : total;
+}
+
+/* 保证输出缓冲区至少能容纳 need 字节 */
+static int reserve_output(char **temp, size_t *temp_cap, size_t need) {
+    if (need <= *temp_cap && *temp != NULL) return 0;
+    size_t cap = *temp_cap ? *temp_cap : BUFFER_SIZE;
+    while (cap < need) cap *= 2;
+    char *grown = (char*)realloc(*temp, cap);
+    if (grown == NULL) return -1;
+    *temp = grown;
+    *temp_cap = cap;
+    return 0;
+}
+
+/*
+ * 单遍替换所有模式：每次取最左的匹配，起点相同时取最长的，匹配之间不重叠
+ * replacements[i] 为第 i 个模式的替换串，NULL（或 replacements 本身为 NULL）表示删除
+ * counts（可为 NULL）按模式下标写入替换次数；返回替换总数，失败返回 -1
+ */
+int replace_all_multi(TextBuffer *buf, const MultiPattern *mp, const char *const *replacements, int *counts) {
+    if (buf == NULL || mp == NULL || mp->node_count == 0) return -1;
+    if (counts != NULL) memset(counts, 0, sizeof(int) * (size_t)mp->pattern_count);
+
+    size_t *rep_lengths = (size_t*)malloc(sizeof(size_t) * (size_t)mp->pattern_count);
+    if (rep_lengths == NULL) return -1;
+    for (int p = 0; p < mp->pattern_count; p++) {
+        const char *rep = replacements != NULL ? replacements[p] : NULL;
+        rep_lengths[p] = rep != NULL ? strlen(rep) : 0;
+    }
+
+    int count = 0;
+    int failed = 0;
+    char *temp = NULL;
+    size_t temp_cap = 0;
+
+    undo_group_begin(buf);
+    for (int i = 0; i < buf->line_count && !failed; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        const unsigned char *text = (const unsigned char*)piece->text;
+        size_t n = (size_t)piece->length;
+        size_t last = 0;
+        size_t temp_len = 0;
+        int line_hits = 0;
+
+        while (last < n) {
+            /* 第一个匹配出现后，起点不晚于它的匹配都在其后 max_length 字节内结束 */
+            int best = -1;
+            size_t best_start = 0;
+            int state = 0;
+            for (size_t k = last; k < n; k++) {
+                if (best >= 0 && k >= best_start + (size_t)mp->max_length) break;
+                if (state == 0 && !mp->first_byte[text[k]]) continue;
+                state = ac_step(mp, state, text[k]);
+                int v = mp->out[state] >= 0 ? state : mp->dict[state];
+                if (v < 0) continue;
+                int p = mp->out[v];     /* 在此结束的最长模式 */
+                size_t start = k + 1 - (size_t)mp->lengths[p];
+                if (best < 0 || start <= best_start) {
+                    best = p;
+                    best_start = start;
+                }
+            }
+            if (best < 0) break;
+
+            size_t prefix_len = best_start - last;
+            size_t rep_len = rep_lengths[best];
+            if (reserve_output(&temp, &temp_cap, temp_len + prefix_len + rep_len) != 0) {
+                failed = 1;
+                break;
+            }
+            memcpy(temp + temp_len, text + last, prefix_len);
+            temp_len += prefix_len;
+            if (rep_len > 0) {
+                memcpy(temp + temp_len, replacements[best], rep_len);
+                temp_len += rep_len;
+            }
+
+            if (counts != NULL) counts[best]++;
+            line_hits++;
+            last = best_start + (size_t)mp->lengths[best];
+        }
+
+        if (line_hits > 0 && !failed) {
+            size_t remain = n - last;
+            const char *image = NULL;
+            if (temp_len + remain <= INT_MAX) {
+                image = add_line_image(buf, temp, temp_len, (const char*)text + last, remain, NULL, 0);
+            }
+            if (image == NULL) {
+                failed = 1;
+                break;
+            }
+            if (piece_assign(buf, i, image, (int)(temp_len + remain)) != 0) {
+                failed = 1;
+                break;
+            }
+            count += line_hits;
+        }
+    }
+
+    undo_group_end(buf);
+    free(temp);
+    free(rep_lengths);
+
+    if (count > 0) {
+        buf->modified = 1;
+    }
+
+    return (failed && count == 0) ? -1 : count;
+}
+
+/* ========================== 正则查找与替换 ========================== */
+
+/* find_regex_occurrences 的逐处回调状态 */
+typedef struct {
+    SearchResults *results;
+    const char *text;
+    size_t n;
+    int ascii_only;
+    int line_idx;
+    ColumnCursor cursor;
+    int rc;
+} RegexFindCtx;
+
+static int regex_find_hit(void *ctx, size_t start, size_t end) {
+    RegexFindCtx *f = (RegexFindCtx*)ctx;
+    (void)end;
+    f->rc = push_hit(f->results, f->text, f->n, f->ascii_only, f->line_idx, (int)start, &f->cursor);
+    return f->rc != 0;
+}
+
+/*
+ * 统计正则在文本中的匹配数（各行内不重叠的匹配），内存不足返回 -1
+ */
+int find_regex_count(TextBuffer *buf, Regex *re) {
+    if (buf == NULL || re == NULL) return -1;
+    int count = 0;
+    for (int i = 0; i < buf->line_count; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        int found = regex_scan_line(re, piece->text, (size_t)piece->length, NULL, NULL);
+        if (found < 0) return -1;
+        count += found;
+    }
+    return count;
+}
+
+/*
+ * 把所有匹配的起点追加到 results（由调用方初始化），列号按字符计；
+ * 返回收集到的结果数，内存不足时返回 -1
+ */
+int find_regex_occurrences(TextBuffer *buf, Regex *re, SearchResults *results) {
+    if (buf == NULL || re == NULL || results == NULL) return -1;
+
+    RegexFindCtx f;
+    f.results = results;
+    f.rc = 0;
+    for (int i = 0; i < buf->line_count && f.rc == 0; i++) {
+        LinePiece *piece = line_at(buf, i);
+        f.text = piece->text;
+        f.n = (size_t)piece->length;
+        f.ascii_only = piece_chars(piece) == piece->length;
+        f.line_idx = i;
+        f.cursor.byte = 0;
+        f.cursor.chr = 0;
+        if (regex_scan_line(re, f.text, f.n, regex_find_hit, &f) < 0) return -1;
+    }
+    return f.rc < 0 ? -1 : results->count;
+}
+
+/* replace_regex 的逐处回调状态：输出缓冲区在各行之间复用 */
+typedef struct {
+    Regex *re;
+    const char *text;
+    size_t n;
+    const char *replacement;
+    int uses_groups;        /* 替换模板是否引用了 $1 ~ $9 */
+    size_t slots[2 * (REGEX_MAX_GROUPS + 1)];
+    char *temp;
+    size_t temp_cap;
+    size_t temp_len;
+    size_t last;            /* 本行已复制到的位置 */
+    int hits;
+    int failed;
+} RegexReplaceCtx;
+
+static int regex_emit(RegexReplaceCtx *r, const char *src, size_t len) {
+    if (reserve_output(&r->temp, &r->temp_cap, r->temp_len + len) != 0) {
+        r->failed = 1;
+        return -1;
+    }
+    memcpy(r->temp + r->temp_len, src, len);
+    r->temp_len += len;
+    return 0;
+}
+
+static int regex_replace_hit(void *ctx, size_t start, size_t end) {
+    RegexReplaceCtx *r = (RegexReplaceCtx*)ctx;
+    if (r->uses_groups && regex_captures(r->re, r->text, r->n, start, r->slots) != 0) {
+        r->failed = 1;
+        return 1;
+    }
+    r->slots[0] = start;
+    r->slots[1] = end;
+
+    if (regex_emit(r, r->text + r->last, start - r->last) != 0) return 1;
+
+    /* $0 ~ $9 引用分组，$$ 表示 $ 本身，其余字符原样输出 */
+    int groups = regex_group_count(r->re);
+    const char *p = r->replacement;
+    while (*p != '\0') {
+        const char *dollar = strchr(p, '$');
+        size_t plain = dollar ? (size_t)(dollar - p) : strlen(p);
+        if (plain > 0 && regex_emit(r, p, plain) != 0) return 1;
+        if (dollar == NULL) break;
+
+        p = dollar + 1;
+        if (*p == '$') {
+            if (regex_emit(r, "$", 1) != 0) return 1;
+            p++;
+        } else if (*p >= '0' && *p <= '9') {
+            int g = *p - '0';
+            size_t gs = r->slots[2 * g];
+            size_t ge = r->slots[2 * g + 1];
+            if (g <= groups && gs != (size_t)-1 && ge != (size_t)-1 && ge >= gs) {
+                if (regex_emit(r, r->text + gs, ge - gs) != 0) return 1;
+            }
+            p++;
+        } else if (regex_emit(r, "$", 1) != 0) {
+            return 1;
+        }
+    }
+
+    r->last = end;
+    r->hits++;
+    return 0;
+}
+
+/*
+ * 用替换模板替换所有匹配，模板中 $0 为整个匹配、$1 ~ $9 为分组、$$ 为 $
+ * 返回替换次数，失败返回 -1
+ */
+int replace_regex(TextBuffer *buf, Regex *re, const char *replacement) {
+    if (buf == NULL || re == NULL || replacement == NULL) return -1;
+
+    RegexReplaceCtx r;
+    memset(&r, 0, sizeof(r));
+    r.re = re;
+    r.replacement = replacement;
+    for (const char *p = strchr(replacement, '$'); p != NULL; p = strchr(p + 2, '$')) {
+        if (p[1] >= '1' && p[1] <= '9') r.uses_groups = 1;
+        if (p[1] == '\0') break;
+    }
+    for (int g = 0; g < 2 * (REGEX_MAX_GROUPS + 1); g++) r.slots[g] = (size_t)-1;
+
+    int count = 0;
+    undo_group_begin(buf);
+    for (int i = 0; i < buf->line_count && !r.failed; i++) {
+        const LinePiece *piece = line_at(buf, i);
+        r.text = piece->text;
+        r.n = (size_t)piece->length;
+        r.temp_len = 0;
+        r.last = 0;
+        r.hits = 0;
+        if (regex_scan_line(re, r.text, r.n, regex_replace_hit, &r) < 0) r.failed = 1;
+        if (r.hits == 0 || r.failed) continue;
+
+        size_t remain = r.n - r.last;
+        const char *image = NULL;
+        if (r.temp_len + remain <= INT_MAX) {
+            image = add_line_image(buf, r.temp, r.temp_len, r.text + r.last, remain, NULL, 0);
+        }
+        if (image == NULL) {
+            r.failed = 1;
+            break;
+        }
+        if (piece_assign(buf, i, image, (int)(r.temp_len + remain)) != 0) {
+            r.failed = 1;
+            break;
+        }
+        count += r.hits;
+    }
+
+    undo_group_end(buf);
+    free(r.temp);
+    if (count > 0) {
+        buf->modified = 1;
+    }
+    return (r.failed && count == 0) ? -1 : count;
+}
+
+/* ========================== 子串删除功能 ========================== */
+
+/*
+ * 删除所有匹配的子串
+ */
+int delete_substring(TextBuffer *buf, const char *substr) {
+    if (buf == NULL || substr == NULL || substr[0] == '\0') return -1;
+    
+    /* 用空字符串替换实现删除 */
+    return replace_all(buf, substr, "");
+}
+
+int delete_substring_parallel(TextBuffer *buf, const char *substr, int threads) {
+    if (buf == NULL || substr == NULL || substr[0] == '\0') return -1;
+    return replace_all_parallel(buf, substr, "", threads);
+}
+
+/*
+ * 删除指定位置的字符
+ */
+int delete_at_position(TextBuffer *buf, int line, int col, int len) {
+    if (buf == NULL) return -1;
+    if (line < 0 || line >= buf->line_count) return -1;
+    if (len < 0) return -1;
+
+    return replace_at_position(buf, line, col, len, "");
+}
+
+/*
+ * 删除指定行
+ */
+int delete_line(TextBuffer *buf, int line_num) {
+    if (buf == NULL) return -1;
+    if (line_num < 0 || line_num >= buf->line_count) return -1;
+    
+    /* 间隙移到该行之前，再把该行并入间隙 */
+    if (move_gap(buf, line_num) != 0) return -1;
+    LinePiece *piece = slot_at(buf, buf->gap_end);
+    if (buf->char_tree_valid) {
+        char_tree_add(buf, buf->gap_end, -((long long)piece->chars + 1));
+    }
+    stats_apply_piece(buf, piece, -1);
+    search_index_apply(buf, piece, buf->gap_end, -1);
+    buf->revision++;
+    undo_record(buf, UNDO_DELETE, line_num, piece, NULL);
+    buf->gap_end++;
+    
+    buf->line_count--;
+    buf->modified = 1;
+    
+    return 0;
 }
 
-static int kmp_count_line(const char *text, const char *pattern, const int *lps, size_t m) {
-    size_t n = strlen(text);
-    size_t i = 0, j = 0;
-    int count = 0;
+/* ========================== 撤销与重做 ========================== */
 
-    while (i < n) {
-        if (text[i] == pattern[j]) {
-            i++;
-            j++;
-            if (j == m) {
-                count++;
-                j = (size_t)lps[j - 1];
-            }
-        } else if (j != 0) {
-            j = (size_t)lps[j - 1];
-        } else {
-            i++;
-        }
-    }
+/*
+ * 撤销日志按时间顺序保存行级记录：改写、插入或删除一行时各记一条，
+ * 只保存行片段修改前后的指向而不复制文本——原始区、文件映射和追加区中的旧内容
+ * 在缓冲区清空前一直有效（解除映射前先把日志中的视图复制到追加区）
+ * 一条命令的记录连续存放，第一条带 first 标记；命令组另外保存全文统计的净变化，
+ * 重放时不必重新统计各行
+ */
+typedef struct {
+    const char *text;
+    int length;
+    int chars;              /* -1 表示未统计 */
+} UndoImage;
 
-    return count;
-}
+typedef struct {
+    UndoImage before;       /* 修改前的行（UNDO_INSERT 时不用） */
+    UndoImage after;        /* 修改后的行（UNDO_DELETE 时不用），总在追加区中 */
+    int line;               /* 逻辑行号 */
+    unsigned char kind;     /* UNDO_SET / UNDO_INSERT / UNDO_DELETE */
+    unsigned char flags;    /* 修改前的 LINE_FLAG_* */
+    unsigned char first;    /* 命令的第一条记录 */
+    unsigned char has_delta;/* 所属命令在 deltas 中保存了统计净变化（只标在第一条记录上） */
+} UndoRecord;
 
-static int kmp_collect_line(const char *text, const char *pattern, const int *lps, size_t m,
-                            int line_idx, SearchResult *results, int start_offset, int max_results) {
-    size_t n = strlen(text);
-    size_t i = 0, j = 0;
-    int count = 0;
+struct UndoJournal {
+    UndoRecord *records;    /* 行级记录 */
+    size_t count;
+    size_t capacity;
+    size_t cursor;          /* 前 cursor 条记录已生效，其后的可以重做 */
+    CharStatistics *deltas; /* 按命令顺序保存的统计净变化 */
+    int delta_count;
+    int delta_capacity;
+    int delta_cursor;       /* 已生效的命令占用的 deltas 项数 */
+    int group_count;        /* 命令数 */
+    int applied;            /* 已生效的命令数 */
+    size_t open_first;      /* 命令组内正在记录的命令的首条记录下标 */
+    int depth;              /* undo_group_begin 的嵌套深度 */
+    int open;               /* 命令组内已开始记录 */
+    int overflow;           /* 当前命令超出上限或内存不足，组结束前不再记录 */
+    int replaying;          /* 正在撤销/重做，不记录 */
+    CharStatistics group_stats; /* 最外层命令组开始时的全文统计 */
+    int group_stats_valid;  /* 开始时统计是否已建立 */
+    size_t limit;           /* 内存上限（字节），0 表示不记录 */
+    int dropped;            /* 被丢弃的命令数 */
+};
 
-    while (i < n) {
-        if (text[i] == pattern[j]) {
-            i++;
-            j++;
-            if (j == m) {
-                if (start_offset + count < max_results) {
-                    int byte_pos = (int)(i - j);
-                    int char_pos = utf8_char_index_from_byte(text, byte_pos);
-                    if (char_pos < 0) char_pos = byte_pos; /* fallback */
-                    results[start_offset + count].line = line_idx;
-                    results[start_offset + count].column = char_pos;
-                }
-                count++;
-                j = (size_t)lps[j - 1];
-            }
-        } else if (j != 0) {
-            j = (size_t)lps[j - 1];
-        } else {
-            i++;
-        }
+static UndoJournal* undo_journal(TextBuffer *buf) {
+    if (buf->undo == NULL) {
+        UndoJournal *j = (UndoJournal*)calloc(1, sizeof(UndoJournal));
+        if (j == NULL) return NULL;
+        j->limit = UNDO_LIMIT_DEFAULT;
+        buf->undo = j;
     }
+    return buf->undo;
+}
 
-    return count;
+static void undo_free(TextBuffer *buf) {
+    UndoJournal *j = buf->undo;
+    if (j == NULL) return;
+    free(j->records);
+    free(j->deltas);
+    free(j);
+    buf->undo = NULL;
+}
+
+/* 丢弃全部历史；处于命令组内时该组余下的修改也不再记录 */
+static void undo_discard(UndoJournal *j) {
+    j->dropped += j->group_count;
+    j->count = 0;
+    j->cursor = 0;
+    j->delta_count = 0;
+    j->delta_cursor = 0;
+    j->group_count = 0;
+    j->applied = 0;
+    j->open = 0;
+    j->overflow = j->depth > 0;
+}
+
+/* 从 start 开始的命令之后的第一条记录下标 */
+static size_t undo_group_last(const UndoJournal *j, size_t start) {
+    size_t end = start + 1;
+    while (end < j->count && !j->records[end].first) end++;
+    return end;
 }
 
 /*
- * 统计子串在文本中出现的次数
+ * 超出上限时从最早的命令开始丢弃，降到上限的 3/4 为止，避免每条新记录都搬动整个日志
+ * keep_last 为真时保留正在记录的最新命令；可重做的命令不丢弃；仍超出上限时放弃全部历史
  */
-int find_substring_count(TextBuffer *buf, const char *substr) {
-    int count = 0;
-
-    if (buf == NULL || substr == NULL || substr[0] == '\0') return 0;
+static void undo_trim(UndoJournal *j, int keep_last) {
+    size_t used = j->count * sizeof(UndoRecord) + (size_t)j->delta_count * sizeof(CharStatistics);
+    if (used <= j->limit) return;
 
-    size_t substr_len = strlen(substr);
-    int *lps = (int*)malloc(sizeof(int) * substr_len);
-    if (lps == NULL) return 0;
+    size_t target = j->limit / 4 * 3;
+    int droppable = j->applied - (keep_last ? 1 : 0);
+    int drop = 0;
+    int drop_deltas = 0;
+    size_t first = 0;
+    while (drop < droppable && used > target) {
+        size_t end = undo_group_last(j, first);
+        if (j->records[first].has_delta) {
+            drop_deltas++;
+            used -= sizeof(CharStatistics);
+        }
+        used -= (end - first) * sizeof(UndoRecord);
+        first = end;
+        drop++;
+    }
+    if (used > j->limit) {
+        undo_discard(j);
+        return;
+    }
 
-    build_lps(substr, substr_len, lps);
+    memmove(j->records, j->records + first, sizeof(UndoRecord) * (j->count - first));
+    if (drop_deltas > 0) {
+        memmove(j->deltas, j->deltas + drop_deltas, sizeof(CharStatistics) * (size_t)(j->delta_count - drop_deltas));
+    }
+    j->count -= first;
+    j->cursor -= first;
+    j->open_first -= first;
+    j->delta_count -= drop_deltas;
+    j->delta_cursor -= drop_deltas;
+    j->group_count -= drop;
+    j->applied -= drop;
+    j->dropped += drop;
+}
 
-    for (int i = 0; i < buf->line_count; i++) {
-        count += kmp_count_line(buf->lines[i], substr, lps, substr_len);
+/* 把数组容量收缩到恰好容纳现有记录 */
+static void undo_shrink(UndoJournal *j) {
+    if (j->count == 0) {
+        free(j->records);
+        j->records = NULL;
+        j->capacity = 0;
+    } else if (j->count < j->capacity) {
+        UndoRecord *records = (UndoRecord*)realloc(j->records, sizeof(UndoRecord) * j->count);
+        if (records != NULL) {
+            j->records = records;
+            j->capacity = j->count;
+        }
+    }
+    if (j->delta_count == 0) {
+        free(j->deltas);
+        j->deltas = NULL;
+        j->delta_capacity = 0;
+    } else if (j->delta_count < j->delta_capacity) {
+        CharStatistics *deltas = (CharStatistics*)realloc(j->deltas, sizeof(CharStatistics) * (size_t)j->delta_count);
+        if (deltas != NULL) {
+            j->deltas = deltas;
+            j->delta_capacity = j->delta_count;
+        }
     }
+}
 
-    free(lps);
-    return count;
+static void undo_set_image(UndoImage *image, const LinePiece *piece) {
+    if (piece == NULL) {
+        memset(image, 0, sizeof(*image));
+        return;
+    }
+    image->text = piece->text;
+    image->length = piece->length;
+    image->chars = piece->chars;
 }
 
 /*
- * 获取所有出现位置
+ * 记录一次行级修改（由 piece_replace、insert_piece、delete_line 调用）
+ * 不在命令组内的修改自成一条命令；开始新命令时丢弃可重做的历史
+ * 记录失败只会丢失撤销历史，不影响编辑本身
  */
-SearchResult* find_all_occurrences(TextBuffer *buf, const char *substr, int *count) {
-    if (buf == NULL || substr == NULL || count == NULL) return NULL;
+static void undo_record(TextBuffer *buf, int kind, int line, const LinePiece *before, const LinePiece *after) {
+    UndoJournal *j = undo_journal(buf);
+    if (j == NULL || j->replaying || j->overflow || j->limit == 0) return;
 
-    *count = find_substring_count(buf, substr);
-    if (*count == 0) return NULL;
-
-    SearchResult *results = (SearchResult*)malloc(sizeof(SearchResult) * (*count));
-    if (results == NULL) {
-        *count = 0;
-        return NULL;
+    if (!j->open) {
+        /* 新命令：丢弃可重做的部分 */
+        j->count = j->cursor;
+        j->delta_count = j->delta_cursor;
+        j->group_count = j->applied;
     }
-
-    size_t substr_len = strlen(substr);
-    int *lps = (int*)malloc(sizeof(int) * substr_len);
-    if (lps == NULL) {
-        free(results);
-        *count = 0;
-        return NULL;
+    if (j->count == j->capacity) {
+        /* 容量不超过上限能容纳的记录数，上限之外不预留内存 */
+        size_t cap = j->capacity > 0 ? j->capacity * 2 : 256;
+        size_t most = j->limit / sizeof(UndoRecord) + 1;
+        if (cap > most) cap = most;
+        if (cap <= j->count) cap = j->count + 1;
+        UndoRecord *grown = (UndoRecord*)realloc(j->records, sizeof(UndoRecord) * cap);
+        if (grown == NULL) {
+            undo_discard(j);
+            return;
+        }
+        j->records = grown;
+        j->capacity = cap;
     }
 
-    build_lps(substr, substr_len, lps);
-
-    int idx = 0;
-    for (int i = 0; i < buf->line_count && idx < *count; i++) {
-        idx += kmp_collect_line(buf->lines[i], substr, lps, substr_len, i, results, idx, *count);
+    UndoRecord *rec = &j->records[j->count];
+    rec->first = !j->open;
+    if (rec->first) {
+        j->applied = ++j->group_count;
+        j->open_first = j->count;
+        j->open = j->depth > 0;
     }
+    rec->kind = (unsigned char)kind;
+    rec->flags = before != NULL ? (unsigned char)before->flags : 0;
+    rec->has_delta = 0;
+    rec->line = line;
+    undo_set_image(&rec->before, before);
+    undo_set_image(&rec->after, after);
+    j->cursor = ++j->count;
+    undo_trim(j, 1);
+}
 
-    free(lps);
-    return results;
+/*
+ * 解除文件映射前调用：日志中仍指向映射的行复制到追加区
+ * 内存不足时放弃撤销历史
+ */
+static void undo_detach_views(TextBuffer *buf) {
+    UndoJournal *j = buf->undo;
+    if (j == NULL) return;
+    for (size_t k = 0; k < j->count; k++) {
+        UndoRecord *rec = &j->records[k];
+        if (!(rec->flags & LINE_FLAG_VIEW)) continue;
+        const char *copy = add_line_image(buf, rec->before.text, (size_t)rec->before.length, NULL, 0, NULL, 0);
+        if (copy == NULL) {
+            undo_discard(j);
+            return;
+        }
+        rec->before.text = copy;
+        rec->flags &= ~LINE_FLAG_VIEW;
+    }
 }
 
-/* ========================== 子串插入功能 ========================== */
+/* dst += sign * delta */
+static void undo_stats_add(CharStatistics *dst, const CharStatistics *delta, int sign) {
+    dst->letter_count += sign * delta->letter_count;
+    dst->digit_count += sign * delta->digit_count;
+    dst->space_count += sign * delta->space_count;
+    dst->total_count += sign * delta->total_count;
+    dst->punctuation_count += sign * delta->punctuation_count;
+    dst->other_count += sign * delta->other_count;
+    dst->chinese_count += sign * delta->chinese_count;
+}
 
 /*
- * 在指定行和列位置插入子串
+ * 重放记录 [first, last) 会改写的槽位范围 [*from, *to)：按重放顺序模拟间隙，
+ * 插入或删除一行时间隙移到该行，涉及新旧间隙之间的槽位；改写一行只涉及它自己的槽位
+ * 调用前间隙须已足够容纳要恢复的行
  */
-int insert_substring(TextBuffer *buf, int line, int col, const char *substr) {
-    if (buf == NULL || substr == NULL) return -1;
-    if (line < 0 || line >= buf->line_count) return -1;
+static void undo_replay_span(const TextBuffer *buf, size_t first, size_t last, int undo, int *from, int *to) {
+    const UndoJournal *j = buf->undo;
+    int gap = buf->gap_start;
+    int size = buf->gap_end - buf->gap_start;
+    int lo = buf->line_capacity;
+    int hi = 0;
 
-    int byte_col = utf8_byte_offset(buf->lines[line], col);
-    if (byte_col < 0) return -1;
+    for (size_t n = 0; n < last - first; n++) {
+        const UndoRecord *rec = &j->records[undo ? last - 1 - n : first + n];
+        int line = rec->line;
+        if (rec->kind == UNDO_SET) {
+            int slot = line < gap ? line : line + size;
+            if (slot < lo) lo = slot;
+            if (slot + 1 > hi) hi = slot + 1;
+            continue;
+        }
+        int start = line < gap ? line : gap;
+        int end = (line > gap ? line : gap) + size;
+        if (start < lo) lo = start;
+        if (end > hi) hi = end;
+        if (rec->kind == (undo ? UNDO_INSERT : UNDO_DELETE)) {
+            gap = line;
+            size++;
+        } else {
+            gap = line + 1;
+            size--;
+        }
+    }
+    *from = lo;
+    *to = hi;
+}
 
-    size_t line_len = strlen(buf->lines[line]);
-    size_t substr_len = strlen(substr);
+/*
+ * 重放记录 [first, last)：撤销时逆序执行各记录的逆操作，重做时顺序执行原操作
+ * 给出统计净变化 delta 时重放期间暂停逐行统计，结束后一次加减，重放只搬动行片段
+ * 先为要恢复的行预留间隙、让重放涉及的槽位所在块独占（与快照共享时复制），之后的步骤都不会失败
+ */
+static int undo_replay(TextBuffer *buf, size_t first, size_t last, int undo, const CharStatistics *delta) {
+    UndoJournal *j = buf->undo;
+    int use_delta = delta != NULL && buf->stats_valid;
 
-    /* 检查插入后是否超长（按字节限制） */
-    if (line_len + substr_len > MAX_LINE_LENGTH) {
-        return -1;
+    int inserts = 0;
+    for (size_t k = first; k < last; k++) {
+        if (j->records[k].kind == (undo ? UNDO_DELETE : UNDO_INSERT)) inserts++;
     }
+    if (inserts > 0 && ensure_gap(buf, inserts) != 0) return -1;
+    int from, to;
+    undo_replay_span(buf, first, last, undo, &from, &to);
+    if (lines_own(buf, from, to) != 0) return -1;
 
-    char temp[MAX_LINE_LENGTH + 1];
-    strncpy_s(temp, sizeof(temp), buf->lines[line], byte_col);
-    temp[byte_col] = '\0';
-    strcat_s(temp, sizeof(temp), substr);
-    strcat_s(temp, sizeof(temp), buf->lines[line] + byte_col);
+    j->replaying = 1;
+    if (use_delta) buf->stats_valid = 0;
+    for (size_t n = 0; n < last - first; n++) {
+        const UndoRecord *rec = &j->records[undo ? last - 1 - n : first + n];
+        const UndoImage *image = undo ? &rec->before : &rec->after;
+        int flags = undo ? rec->flags : 0;
 
-    strcpy_s(buf->lines[line], MAX_LINE_LENGTH + 1, temp);
+        if (rec->kind == UNDO_SET) {
+            LinePiece *piece = piece_replace(buf, rec->line, image->text, image->length, image->chars, 1);
+            piece->flags = flags;
+        } else if (rec->kind == (undo ? UNDO_INSERT : UNDO_DELETE)) {
+            delete_line(buf, rec->line);
+        } else {
+            insert_piece(buf, rec->line, image->text, image->length, flags, image->chars);
+        }
+    }
+    if (use_delta) {
+        buf->stats_valid = 1;
+        undo_stats_add(&buf->stats, delta, undo ? -1 : 1);
+    }
+    j->replaying = 0;
     buf->modified = 1;
+    return 0;
+}
+
+int undo_edit(TextBuffer *buf) {
+    if (buf == NULL || buf->undo == NULL) return -1;
+    UndoJournal *j = buf->undo;
+    if (j->depth > 0 || j->applied == 0) return -1;
 
+    size_t first = j->cursor - 1;
+    while (!j->records[first].first) first--;
+    int has_delta = j->records[first].has_delta;
+    const CharStatistics *delta = has_delta ? &j->deltas[j->delta_cursor - 1] : NULL;
+    if (undo_replay(buf, first, j->cursor, 1, delta) != 0) return -1;
+
+    j->cursor = first;
+    j->delta_cursor -= has_delta;
+    j->applied--;
+    return 0;
+}
+
+int redo_edit(TextBuffer *buf) {
+    if (buf == NULL || buf->undo == NULL) return -1;
+    UndoJournal *j = buf->undo;
+    if (j->depth > 0 || j->applied == j->group_count) return -1;
+
+    size_t last = undo_group_last(j, j->cursor);
+    int has_delta = j->records[j->cursor].has_delta;
+    const CharStatistics *delta = has_delta ? &j->deltas[j->delta_cursor] : NULL;
+    if (undo_replay(buf, j->cursor, last, 0, delta) != 0) return -1;
+
+    j->cursor = last;
+    j->delta_cursor += has_delta;
+    j->applied++;
     return 0;
 }
 
 /*
- * 在全局位置插入子串（按字符计），位置基于现有文本行及换行符顺序
+ * 把之后直到配对的 undo_group_end 为止的全部修改合并为一条命令，可以嵌套
  */
-int insert_at_position(TextBuffer *buf, int pos, const char *substr) {
-    if (buf == NULL || substr == NULL || pos < 0) return -1;
-
-    /* 空缓冲区时，直接作为第一行插入 */
-    if (buf->line_count == 0) {
-        return insert_line(buf, 0, substr);
+int undo_group_begin(TextBuffer *buf) {
+    if (buf == NULL) return -1;
+    UndoJournal *j = undo_journal(buf);
+    if (j == NULL) return -1;
+    if (j->depth++ == 0) {
+        j->group_stats = buf->stats;
+        j->group_stats_valid = buf->stats_valid;
     }
+    return 0;
+}
 
-    int cumulative = 0;
-    for (int i = 0; i < buf->line_count; ++i) {
-        int line_chars = utf8_strlen_chars(buf->lines[i]);
-        /* 命中当前行 */
-        if (pos <= cumulative + line_chars) {
-            int col = pos - cumulative;
-            return insert_substring(buf, i, col, substr);
-        }
-
-        cumulative += line_chars;
+void undo_group_end(TextBuffer *buf) {
+    if (buf == NULL || buf->undo == NULL || buf->undo->depth == 0) return;
+    UndoJournal *j = buf->undo;
+    if (--j->depth > 0) return;
 
-        /* 处理行与行之间的换行分隔（视为 1 个位置） */
-        if (i != buf->line_count - 1) {
-            if (pos == cumulative) {
-                return insert_substring(buf, i + 1, 0, substr);
+    /* 保存统计净变化；内存不足时不保存，重放时逐行统计 */
+    if (j->open && j->group_stats_valid && buf->stats_valid) {
+        if (j->delta_count == j->delta_capacity) {
+            int cap = j->delta_capacity > 0 ? j->delta_capacity * 2 : 16;
+            CharStatistics *grown = (CharStatistics*)realloc(j->deltas, sizeof(CharStatistics) * (size_t)cap);
+            if (grown != NULL) {
+                j->deltas = grown;
+                j->delta_capacity = cap;
             }
-            cumulative += 1;
+        }
+        if (j->delta_count < j->delta_capacity) {
+            CharStatistics *delta = &j->deltas[j->delta_count++];
+            *delta = buf->stats;
+            undo_stats_add(delta, &j->group_stats, -1);
+            j->delta_cursor = j->delta_count;
+            j->records[j->open_first].has_delta = 1;
         }
     }
+    j->open = 0;
+    j->overflow = 0;
+}
 
-    /* 允许在文本末尾追加 */
-    int last_line = buf->line_count - 1;
-    int tail_col = utf8_strlen_chars(buf->lines[last_line]);
-    if (pos == cumulative) {
-        return insert_substring(buf, last_line, tail_col, substr);
+/*
+ * 设置日志内存上限（字节），超出的最早命令立即丢弃；0 表示关闭撤销并清空日志
+ */
+int undo_set_limit(TextBuffer *buf, size_t bytes) {
+    if (buf == NULL) return -1;
+    UndoJournal *j = undo_journal(buf);
+    if (j == NULL) return -1;
+    j->limit = bytes;
+    if (bytes == 0) {
+        undo_discard(j);
+    } else {
+        undo_trim(j, 0);
+    }
+    if (j->capacity * sizeof(UndoRecord) > bytes) {
+        undo_shrink(j);
     }
+    return 0;
+}
 
-    return -1;
+/* 清空撤销和重做历史，保留内存上限设置 */
+void undo_clear(TextBuffer *buf) {
+    if (buf == NULL || buf->undo == NULL) return;
+    undo_discard(buf->undo);
+    undo_shrink(buf->undo);
 }
 
-/* ========================== 子串修改功能 ========================== */
+void get_undo_stats(const TextBuffer *buf, UndoStats *stats) {
+    if (stats == NULL) return;
+    memset(stats, 0, sizeof(*stats));
+    stats->limit_bytes = UNDO_LIMIT_DEFAULT;
+    if (buf == NULL || buf->undo == NULL) return;
+
+    const UndoJournal *j = buf->undo;
+    stats->undo_groups = j->applied;
+    stats->redo_groups = j->group_count - j->applied;
+    stats->records = j->count;
+    stats->memory_bytes = sizeof(UndoJournal) + j->capacity * sizeof(UndoRecord) +
+                          (size_t)j->delta_capacity * sizeof(CharStatistics);
+    stats->limit_bytes = j->limit;
+    stats->dropped_groups = j->dropped;
+}
+
+/* ========================== 只读快照 ========================== */
 
 /*
- * 在指定位置替换指定长度的内容
+ * 快照持有行表的一个引用，外加创建时的间隙位置和行数，按同样的方式把逻辑行换算成槽位；
+ * 缓冲区之后改写任何一块都会先复制（lines_own），快照看到的块因此不再变化
+ * 行内容指向的文本由 SnapshotStore 保证在最后一个快照释放前有效
  */
-int replace_at_position(TextBuffer *buf, int line, int col, int len, const char *newstr) {
-    if (buf == NULL || newstr == NULL) return -1;
-    if (line < 0 || line >= buf->line_count) return -1;
-    if (len < 0) return -1;
+struct TextSnapshot {
+    LineTable *lines;
+    int gap_start;
+    int gap_end;
+    int line_count;
+    int stats_valid;
+    CharStatistics stats;
+    unsigned long long revision;
+    SnapshotStore *store;
+};
 
-    int line_chars = utf8_strlen_chars(buf->lines[line]);
-    if (col < 0 || col >= line_chars) return -1;
-    if (col + len > line_chars) len = line_chars - col;
+TextSnapshot* snapshot_create(TextBuffer *buf) {
+    if (buf == NULL) return NULL;
 
-    int byte_start = utf8_byte_offset(buf->lines[line], col);
-    int byte_end = utf8_byte_offset(buf->lines[line], col + len);
-    if (byte_start < 0) return -1;
-    if (byte_end < 0) byte_end = (int)strlen(buf->lines[line]);
+    if (buf->snapshot_store == NULL) {
+        SnapshotStore *store = (SnapshotStore*)calloc(1, sizeof(SnapshotStore));
+        if (store == NULL) return NULL;
+        store->refs = 1;
+        buf->snapshot_store = store;
+    }
+    TextSnapshot *snap = (TextSnapshot*)malloc(sizeof(TextSnapshot));
+    if (snap == NULL) return NULL;
 
-    size_t line_len = strlen(buf->lines[line]);
-    size_t newstr_len = strlen(newstr);
+    /* 读取线程会用到的查表数据和指令集检测在这里完成 */
+    init_codepoint_classes();
+    simd_level();
 
-    /* 检查替换后是否超长（按字节限制） */
-    if (line_len - (size_t)(byte_end - byte_start) + newstr_len > MAX_LINE_LENGTH) {
-        return -1;
-    }
+    snap->lines = buf->lines;
+    if (snap->lines != NULL) text_atomic_add(&snap->lines->refs, 1);
+    snap->gap_start = buf->gap_start;
+    snap->gap_end = buf->gap_end;
+    snap->line_count = buf->line_count;
+    snap->stats_valid = buf->stats_valid;
+    snap->stats = buf->stats;
+    snap->revision = buf->revision;
+    snap->store = buf->snapshot_store;
+    text_atomic_add(&snap->store->refs, 1);
+    return snap;
+}
 
-    char temp[MAX_LINE_LENGTH + 1];
-    strncpy_s(temp, sizeof(temp), buf->lines[line], byte_start);
-    temp[byte_start] = '\0';
-    strcat_s(temp, sizeof(temp), newstr);
-    strcat_s(temp, sizeof(temp), buf->lines[line] + byte_end);
+void snapshot_release(TextSnapshot *snap) {
+    if (snap == NULL) return;
+    line_table_release(snap->lines);
+    snapshot_store_release(snap->store);
+    free(snap);
+}
 
-    strcpy_s(buf->lines[line], MAX_LINE_LENGTH + 1, temp);
-    buf->modified = 1;
+int snapshot_line_count(const TextSnapshot *snap) {
+    return snap ? snap->line_count : 0;
+}
 
-    return 0;
+/* 快照中逻辑行的行片段（只读取 text 和 length，其余字段可能正被缓冲区更新） */
+static const LinePiece* snapshot_piece(const TextSnapshot *snap, int line_num) {
+    int slot = line_num < snap->gap_start ? line_num : line_num + (snap->gap_end - snap->gap_start);
+    return &snap->lines->chunks[slot >> LINE_CHUNK_SHIFT]->slots[slot & LINE_CHUNK_MASK];
 }
 
 /*
- * 替换单个字符
+ * 零拷贝获取快照中的一行，返回的字节不保证以 '\0' 结尾，长度通过 length 返回
  */
-int replace_char(TextBuffer *buf, int line, int col, const char *newchar_utf8) {
-    if (buf == NULL || newchar_utf8 == NULL) return -1;
-    if (line < 0 || line >= buf->line_count) return -1;
-
-    int line_chars = utf8_strlen_chars(buf->lines[line]);
-    if (col < 0 || col >= line_chars) return -1;
-
-    int byte_start = utf8_byte_offset(buf->lines[line], col);
-    int byte_end = utf8_byte_offset(buf->lines[line], col + 1);
-    if (byte_start < 0) return -1;
-    if (byte_end < 0) byte_end = (int)strlen(buf->lines[line]);
+const char* snapshot_line(const TextSnapshot *snap, int line_num, int *length) {
+    if (snap == NULL || line_num < 0 || line_num >= snap->line_count) return NULL;
+    const LinePiece *piece = snapshot_piece(snap, line_num);
+    if (length) *length = piece->length;
+    return piece->text;
+}
 
-    size_t line_len = strlen(buf->lines[line]);
-    size_t new_len = strlen(newchar_utf8);
-    if (line_len - (size_t)(byte_end - byte_start) + new_len > MAX_LINE_LENGTH) return -1;
+unsigned long long snapshot_revision(const TextSnapshot *snap) {
+    return snap ? snap->revision : 0;
+}
 
-    char temp[MAX_LINE_LENGTH + 1];
-    strncpy_s(temp, sizeof(temp), buf->lines[line], byte_start);
-    temp[byte_start] = '\0';
-    strcat_s(temp, sizeof(temp), newchar_utf8);
-    strcat_s(temp, sizeof(temp), buf->lines[line] + byte_end);
+/*
+ * 快照的字符统计：创建时缓冲区的增量统计有效则直接返回，否则按行完整统计一次
+ */
+CharStatistics snapshot_statistics(const TextSnapshot *snap) {
+    CharStatistics stats = {0, 0, 0, 0, 0, 0, 0};
 
-    strcpy_s(buf->lines[line], MAX_LINE_LENGTH + 1, temp);
-    buf->modified = 1;
+    if (snap == NULL) return stats;
+    if (snap->stats_valid) return snap->stats;
 
-    return 0;
+    long long counts[CHAR_CLASS_COUNT] = {0};
+    for (int i = 0; i < snap->line_count; i++) {
+        const LinePiece *piece = snapshot_piece(snap, i);
+        const unsigned char *p = (const unsigned char *)piece->text;
+        classify_text(p, p + piece->length, counts);
+    }
+    return stats_from_counts(counts);
 }
 
 /*
- * 替换所有匹配的子串
+ * 在快照中查找子串（三元组索引和后缀数组属于缓冲区，这里逐行扫描）
+ * snapshot_find_count 返回出现次数；snapshot_find_occurrences 返回结果集中的匹配数，失败返回 -1
  */
-int replace_all(TextBuffer *buf, const char *oldstr, const char *newstr) {
+int snapshot_find_count(const TextSnapshot *snap, const char *substr) {
+    if (snap == NULL || substr == NULL || substr[0] == '\0') return 0;
+
+    Searcher searcher;
+    if (searcher_init(&searcher, substr, strlen(substr)) != 0) return 0;
     int count = 0;
+    for (int i = 0; i < snap->line_count; i++) {
+        const LinePiece *piece = snapshot_piece(snap, i);
+        count += searcher_count_line(&searcher, piece->text, (size_t)piece->length);
+    }
+    searcher_free(&searcher);
+    return count;
+}
 
-    if (buf == NULL || oldstr == NULL || newstr == NULL) return -1;
-    if (oldstr[0] == '\0') return 0;
+int snapshot_find_occurrences(const TextSnapshot *snap, const char *substr, SearchResults *results) {
+    if (snap == NULL || substr == NULL || results == NULL) return -1;
+    if (substr[0] == '\0') return 0;
 
-    size_t oldlen = strlen(oldstr);
-    size_t newlen = strlen(newstr);
+    Searcher searcher;
+    if (searcher_init(&searcher, substr, strlen(substr)) != 0) return -1;
+    int rc = 0;
+    for (int i = 0; i < snap->line_count && rc == 0; i++) {
+        /* 行的字符数缓存属于缓冲区，这里不读取，列号按非纯 ASCII 行换算 */
+        const LinePiece *piece = snapshot_piece(snap, i);
+        rc = searcher_collect_line(&searcher, piece->text, (size_t)piece->length, 0, i, results);
+    }
+    searcher_free(&searcher);
+    return rc < 0 ? -1 : results->count;
+}
 
-    for (int i = 0; i < buf->line_count; i++) {
-        char temp[MAX_LINE_LENGTH + 1] = "";
-        const char *p = buf->lines[i];
-        const char *last = p;
-        size_t temp_len = 0;
+/* 把 n 字节写到 out 的 total 处，超出 out_size - 1 的部分丢弃，返回新的总长度 */
+static size_t content_append(char *out, size_t out_size, size_t total, const char *src, size_t n) {
+    if (out != NULL && total + 1 < out_size) {
+        size_t room = out_size - 1 - total;
+        memcpy(out + total, src, n < room ? n : room);
+    }
+    return total + n;
+}
 
-        while ((p = strstr(p, oldstr)) != NULL) {
-            size_t prefix_len = (size_t)(p - last);
-            if (temp_len + prefix_len + newlen > MAX_LINE_LENGTH) {
-                /* 超长，停止本行替换，尽量保留到限制 */
-                strncat_s(temp, sizeof(temp), last, MAX_LINE_LENGTH - temp_len);
-                temp_len = MAX_LINE_LENGTH;
-                break;
-            }
+size_t get_buffer_content(const TextSnapshot *snap, char *out, size_t out_size) {
+    size_t total = 0;
 
-            strncat_s(temp, sizeof(temp), last, prefix_len);
-            temp_len += prefix_len;
+    for (int i = 0; snap != NULL && i < snap->line_count; i++) {
+        const LinePiece *piece = snapshot_piece(snap, i);
+        if (i > 0) total = content_append(out, out_size, total, "\n", 1);
+        total = content_append(out, out_size, total, piece->text, (size_t)piece->length);
+    }
+    if (out != NULL && out_size > 0) {
+        out[total < out_size ? total : out_size - 1] = '\0';
+    }
+    return total;
+}
 
-            strcat_s(temp, sizeof(temp), newstr);
-            temp_len += newlen;
+/* ========================== 批量编辑 ========================== */
 
-            count++;
-            p += oldlen;
-            last = p;
-        }
+int edit_batch_begin(EditBatch *batch, TextBuffer *buf) {
+    if (batch == NULL || buf == NULL) return -1;
+    memset(batch, 0, sizeof(*batch));
+    batch->buf = buf;
+    batch->revision = buf->revision;
+    return 0;
+}
 
-        if (temp_len < MAX_LINE_LENGTH && last != NULL) {
-            size_t remain = strlen(last);
-            if (temp_len + remain > MAX_LINE_LENGTH) remain = MAX_LINE_LENGTH - temp_len;
-            strncat_s(temp, sizeof(temp), last, remain);
-        }
+void edit_batch_abort(EditBatch *batch) {
+    if (batch == NULL) return;
+    free(batch->ops);
+    free(batch->text);
+    memset(batch, 0, sizeof(*batch));
+}
 
-        if (strcmp(buf->lines[i], temp) != 0) {
-            strcpy_s(buf->lines[i], MAX_LINE_LENGTH + 1, temp);
-            buf->modified = 1;
-        }
+/* 记录一项编辑；行号在这里检查，列号要到提交时对照行内容检查 */
+static int edit_batch_add(EditBatch *batch, int line, int col, int len, const char *text) {
+    if (batch == NULL || batch->buf == NULL) return -1;
+    if (text == NULL || line < 0 || line >= batch->buf->line_count || col < 0 || len < 0) {
+        batch->failed = 1;
+        return -1;
     }
 
-    if (count > 0) {
-        /* 若有替换但未超长覆盖，modified 已在上方设定，此处保持一致 */
-        buf->modified = 1;
+    size_t text_len = strlen(text);
+    if (batch->count == batch->capacity) {
+        int cap = batch->capacity ? batch->capacity * 2 : 64;
+        EditOp *grown = (EditOp*)realloc(batch->ops, sizeof(EditOp) * (size_t)cap);
+        if (grown == NULL) {
+            batch->failed = 1;
+            return -1;
+        }
+        batch->ops = grown;
+        batch->capacity = cap;
+    }
+    if (batch->text_len + text_len > batch->text_cap) {
+        size_t cap = batch->text_cap ? batch->text_cap : BUFFER_SIZE;
+        while (cap < batch->text_len + text_len) cap *= 2;
+        char *grown = (char*)realloc(batch->text, cap);
+        if (grown == NULL) {
+            batch->failed = 1;
+            return -1;
+        }
+        batch->text = grown;
+        batch->text_cap = cap;
     }
 
-    return count;
+    EditOp *op = &batch->ops[batch->count];
+    op->line = line;
+    op->col = col;
+    op->len = len;
+    op->seq = batch->count;
+    op->text_offset = batch->text_len;
+    op->text_len = text_len;
+    if (text_len) memcpy(batch->text + batch->text_len, text, text_len);
+    batch->text_len += text_len;
+    batch->count++;
+    return 0;
 }
 
-/* ========================== 子串删除功能 ========================== */
+int edit_batch_insert(EditBatch *batch, int line, int col, const char *text) {
+    return edit_batch_add(batch, line, col, 0, text);
+}
+
+int edit_batch_replace(EditBatch *batch, int line, int col, int len, const char *text) {
+    return edit_batch_add(batch, line, col, len, text);
+}
+
+int edit_batch_delete(EditBatch *batch, int line, int col, int len) {
+    return edit_batch_add(batch, line, col, len, "");
+}
+
+/* 按 (行, 列) 排序；同一位置的插入排在从该位置开始的替换之前，其余按加入顺序 */
+static int compare_edit_op(const void *a, const void *b) {
+    const EditOp *x = (const EditOp*)a;
+    const EditOp *y = (const EditOp*)b;
+    if (x->line != y->line) return x->line < y->line ? -1 : 1;
+    if (x->col != y->col) return x->col < y->col ? -1 : 1;
+    if ((x->len > 0) != (y->len > 0)) return x->len > 0 ? 1 : -1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
 
 /*
- * 删除所有匹配的子串
+ * 检查一行上的编辑 ops[0, n)（已按列排序）并换算出字节范围：
+ * 只从行首向后走一遍，纯 ASCII 行直接用列号；范围相互重叠或列号越界时返回 -1
+ * 成功时返回新行的字节长度
  */
-int delete_substring(TextBuffer *buf, const char *substr) {
-    if (buf == NULL || substr == NULL || substr[0] == '\0') return -1;
-    
-    /* 用空字符串替换实现删除 */
-    return replace_all(buf, substr, "");
+static long long edit_line_layout(LinePiece *piece, EditOp *ops, int n) {
+    int chars = piece_chars(piece);
+    int ascii = chars == piece->length;
+    const unsigned char *text = (const unsigned char*)piece->text;
+    int char_pos = 0;
+    int byte_pos = 0;
+    int prev_end = 0;
+    long long length = piece->length;
+
+    for (int k = 0; k < n; k++) {
+        EditOp *op = &ops[k];
+        if (op->len > 0 ? op->col >= chars : op->col > chars) return -1;
+        int len = op->len > chars - op->col ? chars - op->col : op->len;
+        if (op->col < prev_end) return -1;
+        prev_end = op->col + len;
+
+        if (ascii) {
+            op->byte_start = op->col;
+            op->byte_end = op->col + len;
+        } else {
+            while (char_pos < op->col) {
+                byte_pos += utf8_char_length(text[byte_pos]);
+                char_pos++;
+            }
+            if (byte_pos > piece->length) byte_pos = piece->length;
+            op->byte_start = byte_pos;
+            while (char_pos < op->col + len) {
+                byte_pos += utf8_char_length(text[byte_pos]);
+                char_pos++;
+            }
+            if (byte_pos > piece->length) byte_pos = piece->length;
+            op->byte_end = byte_pos;
+        }
+        length += (long long)op->text_len - (op->byte_end - op->byte_start);
+    }
+    return length;
 }
 
 /*
- * 删除指定位置的字符
+ * 排序后按行分组：先检查所有行并把新内容写进追加区，全部成功后才写回片段，
+ * 所以中途失败时缓冲区保持不变（追加区里写了一半的内容不会被引用）。
+ * 每个改动的行只重建一次，统计、树状数组和索引也只各维护一次
  */
-int delete_at_position(TextBuffer *buf, int line, int col, int len) {
-    if (buf == NULL) return -1;
-    if (line < 0 || line >= buf->line_count) return -1;
-    if (len < 0) return -1;
+int edit_batch_commit(EditBatch *batch) {
+    if (batch == NULL || batch->buf == NULL) return -1;
+    TextBuffer *buf = batch->buf;
+    int applied = batch->count;
+    /* 开始之后缓冲区被修改过，各项的行列坐标已经过时 */
+    if (batch->failed || buf->revision != batch->revision) {
+        edit_batch_abort(batch);
+        return -1;
+    }
+    if (batch->count == 0) {
+        edit_batch_abort(batch);
+        return 0;
+    }
 
-    int line_chars = utf8_strlen_chars(buf->lines[line]);
-    if (col < 0 || col >= line_chars) return -1;
-    if (col + len > line_chars) len = line_chars - col;
+    qsort(batch->ops, (size_t)batch->count, sizeof(EditOp), compare_edit_op);
 
-    int byte_start = utf8_byte_offset(buf->lines[line], col);
-    int byte_end = utf8_byte_offset(buf->lines[line], col + len);
-    if (byte_start < 0) return -1;
-    if (byte_end < 0) byte_end = (int)strlen(buf->lines[line]);
+    int line_count = 0;
+    for (int k = 0; k < batch->count; k++) {
+        if (k == 0 || batch->ops[k].line != batch->ops[k - 1].line) line_count++;
+    }
+    LineChange *changes = (LineChange*)malloc(sizeof(LineChange) * (size_t)line_count);
+    int failed = changes == NULL;
 
-    size_t line_len = strlen(buf->lines[line]);
-    memmove(buf->lines[line] + byte_start,
-            buf->lines[line] + byte_end,
-            line_len - byte_end + 1);
+    int change_count = 0;
+    for (int k = 0; k < batch->count && !failed; ) {
+        int line = batch->ops[k].line;
+        int n = 1;
+        while (k + n < batch->count && batch->ops[k + n].line == line) n++;
 
-    buf->modified = 1;
+        LinePiece *piece = line_at(buf, line);
+        EditOp *ops = &batch->ops[k];
+        long long length = edit_line_layout(piece, ops, n);
+        char *dst = NULL;
+        if (length < 0 || length > INT_MAX ||
+            (length > 0 && (dst = add_reserve(buf, (size_t)length + 1)) == NULL)) {
+            failed = 1;
+            break;
+        }
 
-    return 0;
-}
+        /* 一个输出游标：原内容的未改动片段与各项新文本交替写出 */
+        const char *text = piece->text;
+        size_t out = 0;
+        int last = 0;
+        for (int j = 0; j < n && dst != NULL; j++) {
+            memcpy(dst + out, text + last, (size_t)(ops[j].byte_start - last));
+            out += (size_t)(ops[j].byte_start - last);
+            if (ops[j].text_len) memcpy(dst + out, batch->text + ops[j].text_offset, ops[j].text_len);
+            out += ops[j].text_len;
+            last = ops[j].byte_end;
+        }
+        if (dst != NULL) {
+            memcpy(dst + out, text + last, (size_t)(piece->length - last));
+            out += (size_t)(piece->length - last);
+            dst[out] = '\0';
+            add_commit(buf, out + 1);
+        }
 
-/*
- * 删除指定行
- */
-int delete_line(TextBuffer *buf, int line_num) {
-    if (buf == NULL) return -1;
-    if (line_num < 0 || line_num >= buf->line_count) return -1;
-    
-    /* 移动后面的行 */
-    for (int i = line_num; i < buf->line_count - 1; i++) {
-        strcpy_s(buf->lines[i], MAX_LINE_LENGTH + 1, buf->lines[i + 1]);
+        changes[change_count].line = line;
+        changes[change_count].text = dst != NULL ? dst : g_empty_line;
+        changes[change_count].length = (int)length;
+        change_count++;
+        k += n;
     }
-    
-    buf->line_count--;
-    buf->modified = 1;
-    
-    return 0;
+
+    /* 改动的行所在块先全部独占，写回阶段不会失败，批次整体生效或整体不生效 */
+    for (int c = 0; c < change_count && !failed; c++) {
+        int slot = line_slot(buf, changes[c].line);
+        if (lines_own(buf, slot, slot + 1) != 0) failed = 1;
+    }
+
+    if (!failed) {
+        undo_group_begin(buf);
+        for (int c = 0; c < change_count; c++) {
+            piece_assign(buf, changes[c].line, changes[c].text, changes[c].length);
+        }
+        undo_group_end(buf);
+        buf->modified = 1;
+    }
+
+    free(changes);
+    edit_batch_abort(batch);
+    return failed ? -1 : applied;
 }
 
 /*
@@ -744,7 +4679,7 @@ int get_total_length(const TextBuffer *buf) {
     if (buf == NULL) return 0;
     
     for (int i = 0; i < buf->line_count; i++) {
-        total += (int)strlen(buf->lines[i]);
+        total += line_at(buf, i)->length;
     }
     
     return total;
@@ -11,12 +11,50 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include "file_map.h"
+#include "text_regex.h"
 
 /* 常量定义 */
-#define MAX_LINE_LENGTH     4096    /* 每行最大字符数，提升上限以减少限制感 */
-#define MAX_LINES           1000    /* 最大行数 */
+#define MAX_LINE_LENGTH     4096    /* 控制台单行输入上限（缓冲区本身不限制行长） */
 #define MAX_FILENAME        256     /* 文件名最大长度 */
 #define BUFFER_SIZE         4096    /* 缓冲区大小 */
+#define ADD_BLOCK_SIZE      (64 * 1024)  /* 追加区单块默认大小 */
+
+/* 行片段标志 */
+#define LINE_FLAG_VIEW      0x1     /* 指向只读文件映射，未以 '\0' 结尾 */
+
+/* 行片段按块存放，块是快照之间共享和写时复制的单位 */
+#define LINE_CHUNK_SHIFT    8
+#define LINE_CHUNK_SLOTS    (1 << LINE_CHUNK_SHIFT)    /* 每块的行片段槽位数 */
+
+/* 长行字节偏移检查点 */
+#define UTF8_CHECKPOINT_STRIDE      64      /* 每隔多少个字符记录一次字节偏移 */
+#define UTF8_CHECKPOINT_MIN_BYTES   256     /* 达到该字节数的非 ASCII 行才建立检查点 */
+
+/* 查找菜单最多列出的匹配数 */
+#define SEARCH_DISPLAY_LIMIT 1000
+
+/* 自动选择查找引擎时，不长于此字节数的模式使用 SIMD 引擎 */
+#define SEARCH_SIMD_MAX_PATTERN 32
+
+/* 流式文件查找每次读入的字节数 */
+#ifndef STREAM_CHUNK_SIZE
+#define STREAM_CHUNK_SIZE   (1024 * 1024)
+#endif
+
+/* 并行操作：每个线程至少分到的行数，行数太少时不值得开线程 */
+#define PARALLEL_MIN_LINES  4096
+
+/* 三元组查找索引：失效倒排条目超过该数且多于有效条目时整体重建 */
+#define SEARCH_INDEX_COMPACT_MIN    65536
+
+/* 向量化 UTF-8 计数 */
+#define UTF8_SIMD_MIN_BYTES         32      /* 不短于此长度的文本走向量化 UTF-8 计数 */
+
+/* 撤销日志默认内存上限（字节），超出后丢弃最早的命令 */
+#ifndef UNDO_LIMIT_DEFAULT
+#define UNDO_LIMIT_DEFAULT  (64u << 20)
+#endif
 
 /* 字符统计结构体 */
 typedef struct {
@@ -29,9 +67,128 @@ typedef struct {
     int chinese_count;      /* 中文字符数 */
 } CharStatistics;
 
-/* 文本缓冲区结构体 */
+/* 行索引构建统计（打开文件时按行切分的耗时） */
+typedef struct {
+    size_t bytes_scanned;   /* 扫描的字节数 */
+    int lines;              /* 建立索引的行数 */
+    double build_seconds;   /* 换行符扫描 + 行片段构建耗时（秒） */
+    int simd_level;         /* 使用的指令集（SimdLevel） */
+    int utf8_valid;         /* 文件是否为合法 UTF-8 */
+    size_t chars;           /* 文件字符数（含换行符） */
+    double validate_seconds;/* UTF-8 校验与字符计数耗时（秒） */
+} LineIndexStats;
+
+/* 三元组查找索引统计 */
+typedef struct {
+    int enabled;            /* 索引是否已建立 */
+    int lines;              /* 已索引的行数 */
+    int trigrams;           /* 不同三元组数 */
+    size_t postings;        /* 有效倒排条目数 */
+    size_t stale_postings;  /* 行被修改或删除后留下的失效条目数 */
+    size_t memory_bytes;    /* 索引占用的内存字节数 */
+    double build_seconds;   /* 最近一次完整构建耗时（秒） */
+    int builds;             /* 完整构建次数（含失效条目过多时的自动重建） */
+    int last_candidates;    /* 最近一次查询筛出的候选行数，-1 表示该次未经索引 */
+} SearchIndexStats;
+
+/* 三元组倒排索引（定义在 text_editor.c 中） */
+typedef struct TrigramIndex TrigramIndex;
+
+/* 后缀数组索引统计 */
+typedef struct {
+    int enabled;            /* 索引是否已建立 */
+    int stale;              /* 建立后缓冲区又被修改过（下次 suffix_index_* 查询时重建） */
+    size_t bytes;           /* 覆盖的文本字节数（行间换行符计 1 字节） */
+    size_t memory_bytes;    /* 索引占用的内存字节数 */
+    double build_seconds;   /* 最近一次构建耗时（秒） */
+    int builds;             /* 构建次数（含过期后的重建） */
+} SuffixIndexStats;
+
+/* 后缀数组索引（定义在 text_editor.c 中） */
+typedef struct SuffixIndex SuffixIndex;
+
+/* 撤销日志统计 */
+typedef struct {
+    int undo_groups;        /* 可撤销的命令数 */
+    int redo_groups;        /* 可重做的命令数 */
+    size_t records;         /* 日志中的行级记录数（含可重做部分） */
+    size_t memory_bytes;    /* 日志占用的内存字节数 */
+    size_t limit_bytes;     /* 内存上限，0 表示不记录撤销 */
+    int dropped_groups;     /* 因超出上限被丢弃的命令数 */
+} UndoStats;
+
+/* 撤销日志（定义在 text_editor.c 中） */
+typedef struct UndoJournal UndoJournal;
+
+/* 缓冲区只读快照，以及快照共享的文本存储（定义在 text_editor.c 中） */
+typedef struct TextSnapshot TextSnapshot;
+typedef struct SnapshotStore SnapshotStore;
+
+/* 追加区内存块：只追加、不移动，已发布的行指针在缓冲区清空前一直有效 */
+typedef struct AddBlock {
+    struct AddBlock *next;  /* 下一块 */
+    size_t used;            /* 已使用字节数 */
+    size_t capacity;        /* 块容量 */
+    char *data;             /* 数据区（紧跟在结构体之后分配） */
+} AddBlock;
+
+/*
+ * 行片段：指向原始区、文件映射或追加区中的一段字节（不含换行符）
+ * 除带 LINE_FLAG_VIEW 的映射视图外，行内容都以 '\0' 结尾
+ */
+typedef struct {
+    const char *text;       /* 行内容起始地址 */
+    int length;             /* 字节长度 */
+    int flags;              /* LINE_FLAG_* */
+    int chars;              /* 缓存的字符数，-1 表示尚未计算 */
+    int index_id;           /* 在三元组查找索引中的行编号，-1 表示未索引 */
+    const int *checkpoints; /* 第 k 项为第 k*UTF8_CHECKPOINT_STRIDE 个字符的字节偏移，按需建立 */
+} LinePiece;
+
+/* 行片段块：被多个行表引用时只读，写入前先复制一份 */
+typedef struct {
+    volatile long refs;                     /* 引用该块的行表数 */
+    LinePiece slots[LINE_CHUNK_SLOTS];
+} LineChunk;
+
+/* 行表：按物理槽位顺序排列的块指针，被缓冲区和快照共享，引用计数归零时释放 */
 typedef struct {
-    char lines[MAX_LINES][MAX_LINE_LENGTH + 1];  /* 文本行数组 */
+    volatile long refs;     /* 缓冲区与各快照的引用数 */
+    int count;              /* 块数 */
+    LineChunk **chunks;     /* 块指针数组（紧跟在结构体之后分配） */
+} LineTable;
+
+/*
+ * 文本缓冲区结构体（piece table）
+ * 原始区保存打开文件时读入的内容，追加区保存之后所有新写入的文本；
+ * 两者都只读/只追加，编辑只改变行片段的指向，不搬动已有文本。
+ * 行片段保存在带间隙的数组中：逻辑行 i 在间隙之前时位于槽位 i，
+ * 否则位于槽位 i + 间隙长度；在间隙处插入/删除行为 O(1)。
+ * 槽位按 LINE_CHUNK_SLOTS 个一块分块存放，快照只增加行表的引用计数，
+ * 之后缓冲区改写某一块时才复制该块（写时复制）。
+ * 全局字符位置与 (行, 列) 的换算使用按物理槽位建立的树状数组（Fenwick），
+ * 间隙槽位权重为 0，首次换算时建立，之后随编辑增量维护。
+ */
+typedef struct {
+    char *original;                               /* 原始区（文件内容） */
+    size_t original_size;                         /* 原始区字节数 */
+    FileMapping mapping;                          /* 映射方式打开时的只读视图 */
+    LineIndexStats index_stats;                   /* 最近一次打开文件的行索引统计 */
+    AddBlock *add_head;                           /* 追加区首块 */
+    AddBlock *add_tail;                           /* 追加区当前写入块 */
+    LineTable *lines;                             /* 行片段间隙数组（分块，可与快照共享） */
+    int line_capacity;                            /* 槽位总数（块数 * LINE_CHUNK_SLOTS） */
+    int gap_start;                                /* 间隙起点（物理下标） */
+    int gap_end;                                  /* 间隙终点（不含） */
+    long long *char_tree;                         /* 按物理槽位的字符数树状数组（每行字符数 + 1） */
+    int char_tree_valid;                          /* 树状数组是否与行内容一致 */
+    CharStatistics stats;                         /* 增量维护的全文字符统计 */
+    int stats_valid;                              /* stats 是否与行内容一致（打开文件后首次查询时统计） */
+    TrigramIndex *search_index;                   /* 可选的三元组查找索引，NULL 表示未建立 */
+    SuffixIndex *suffix_index;                    /* 可选的后缀数组索引，NULL 表示未建立 */
+    unsigned long long revision;                  /* 内容版本号，任何一行内容变化或清空都加 1，不会归零 */
+    UndoJournal *undo;                            /* 撤销日志，NULL 表示尚未记录 */
+    SnapshotStore *snapshot_store;                /* 快照共享的文本存储，NULL 表示尚未建立快照 */
     int line_count;                               /* 当前行数 */
     int modified;                                 /* 是否被修改 */
     char filename[MAX_FILENAME];                  /* 当前文件名 */
@@ -43,6 +200,76 @@ typedef struct {
     int column;     /* 列号 */
 } SearchResult;
 
+/* 子串查找引擎 */
+typedef enum {
+    SEARCH_ENGINE_AUTO = 0,     /* 按模式长度自动选择 */
+    SEARCH_ENGINE_KMP,          /* 逐字节 KMP，最坏情况线性 */
+    SEARCH_ENGINE_SIMD,         /* 首尾字节向量过滤 + memcmp 校验 */
+    SEARCH_ENGINE_BMH           /* Horspool 跳跃表 + Two-Way 校验，适合长模式 */
+} SearchEngine;
+
+/* 搜索结果集：自行增长的数组，或调用方提供的固定容量缓冲区 */
+typedef struct {
+    SearchResult *items;    /* 结果数组 */
+    int count;              /* 已收集的结果数 */
+    int capacity;           /* 数组容量 */
+    int limit;              /* 最多收集的结果数，<= 0 表示不限 */
+    int owns_items;         /* items 是否由结果集分配（search_results_free 负责释放） */
+    int truncated;          /* 达到上限或缓冲区已满后仍有未收集的匹配（扫描已提前停止） */
+} SearchResults;
+
+/*
+ * 多模式查找自动机（Aho-Corasick），multi_pattern_init 建立后可反复用于查找和替换
+ * ASCII 字节走稠密转移表，非 ASCII 字节走稀疏子边 + 失败链
+ */
+typedef struct {
+    int pattern_count;      /* 模式数 */
+    int *lengths;           /* 各模式的字节长度 */
+    int *same_next;         /* 与该模式完全相同的下一个模式，-1 结束 */
+    int max_length;         /* 最长模式的字节数 */
+    unsigned char first_byte[256];      /* 模式首字节集合，根状态下据此跳过不可能开始匹配的字节 */
+    int node_count;         /* 结点数，0 号为根 */
+    unsigned char ascii_class[128];     /* ASCII 字节到列号的映射，不出现在模式中的字节共用第 0 列 */
+    int class_count;        /* 转移表列数 */
+    int *ascii_next;        /* node_count * class_count 稠密转移表 */
+    int *fail;              /* 失败链 */
+    int *out;               /* 在该结点结束的第一个模式，-1 表示无 */
+    int *dict;              /* 沿失败链最近的有输出结点，-1 表示无 */
+    int *high_first;        /* 结点的非 ASCII 子边在 high_byte/high_child 中的起点（node_count + 1 项） */
+    unsigned char *high_byte;
+    int *high_child;
+} MultiPattern;
+
+/* 批量编辑中的一项：把第 line 行 [col, col + len) 个字符替换为 text（len 为 0 即插入，text 为空即删除） */
+typedef struct {
+    int line;               /* 行号（begin 时的行号，批量编辑不增删行） */
+    int col;                /* 起始字符列 */
+    int len;                /* 替换的字符数，超出行尾的部分截断 */
+    int seq;                /* 加入顺序，同一位置的多项按此先后写入 */
+    size_t text_offset;     /* 新文本在 EditBatch.text 中的起点 */
+    size_t text_len;        /* 新文本字节数 */
+    int byte_start;         /* 提交时换算出的字节范围 */
+    int byte_end;
+} EditOp;
+
+/*
+ * 批量编辑事务：edit_batch_begin 之后加入的编辑都按开始时的行列坐标给出，
+ * 提交时按位置排序，同一行的编辑合并后一次写出，字符统计、树状数组和查找索引
+ * 每个改动的行只维护一次；任何一项无效或相互重叠时整批放弃，缓冲区保持不变
+ * 开始之后缓冲区被其他调用修改过（坐标已经过时）时，提交同样整批放弃并返回 -1
+ */
+typedef struct {
+    TextBuffer *buf;
+    EditOp *ops;
+    int count;
+    int capacity;
+    char *text;             /* 各项新文本依次存放（加入时复制） */
+    size_t text_len;
+    size_t text_cap;
+    int failed;             /* 加入时参数无效或内存不足，提交时整批放弃 */
+    unsigned long long revision;    /* 开始时缓冲区的内容版本号 */
+} EditBatch;
+
 /* ========================== 函数声明 ========================== */
 
 /* 初始化和清理函数 */
@@ -52,19 +279,25 @@ void buffer_clear(TextBuffer *buf);
 /* 缓冲区查询函数 */
 int get_line_count(const TextBuffer *buf);
 const char* get_line(const TextBuffer *buf, int line_num);
+const char* get_line_view(const TextBuffer *buf, int line_num, int *length);
 const char* get_filename(const TextBuffer *buf);
 int is_modified(const TextBuffer *buf);
 
 /* 文本输入功能 */
 int insert_line(TextBuffer *buf, int line_num, const char *text);
+int replace_line(TextBuffer *buf, int line_num, const char *text);
 
 /* 文件操作功能 */
 int file_open(TextBuffer *buf, const char *filename);
+int file_open_mapped(TextBuffer *buf, const char *filename);
 int file_save(TextBuffer *buf, const char *filename);
 int file_save_current(TextBuffer *buf);
+void get_line_index_stats(const TextBuffer *buf, LineIndexStats *stats);
 
-/* 字符统计功能 */
+/* 字符统计功能：count_characters 完整重新统计，get_char_statistics 返回增量维护的结果 */
 CharStatistics count_characters(const TextBuffer *buf);
+CharStatistics count_characters_parallel(const TextBuffer *buf, int threads);
+CharStatistics get_char_statistics(TextBuffer *buf);
 int is_letter(char c);
 int is_digit_char(char c);
 int is_space_char(char c);
@@ -72,22 +305,134 @@ int is_punctuation(char c);
 
 /* UTF-8 辅助函数 */
 int utf8_strlen_chars(const char *s);
+int get_line_char_count(const TextBuffer *buf, int line_num);
 
 /* 子串查找功能 */
 int find_substring_count(TextBuffer *buf, const char *substr);
 SearchResult* find_all_occurrences(TextBuffer *buf, const char *substr, int *count);
+int find_occurrences(TextBuffer *buf, const char *substr, SearchResults *results);
+
+/*
+ * 忽略大小写的查找（ASCII 字母和全角拉丁字母 Ａ-Ｚ / ａ-ｚ），
+ * 文本在比较时现场折叠，不生成小写副本；三元组索引和后缀数组不参与
+ */
+int find_substring_count_nocase(TextBuffer *buf, const char *substr);
+SearchResult* find_all_occurrences_nocase(TextBuffer *buf, const char *substr, int *count);
+int find_occurrences_nocase(TextBuffer *buf, const char *substr, SearchResults *results);
+long long stream_search_file(const char *filename, const char *substr, SearchResults *results);
+
+/* 搜索结果集 */
+void search_results_init(SearchResults *results, int limit);
+void search_results_init_buffer(SearchResults *results, SearchResult *storage, int capacity);
+void search_results_free(SearchResults *results);
+
+/*
+ * 三元组查找索引（可选）：建立后长度不小于 3 字节的查找与替换先按索引筛出候选行再逐行校验；
+ * 随行编辑增量维护，打开文件或清空缓冲区时释放
+ */
+int search_index_build(TextBuffer *buf);
+void search_index_free(TextBuffer *buf);
+void get_search_index_stats(const TextBuffer *buf, SearchIndexStats *stats);
+
+/*
+ * 后缀数组索引（可选，SA-IS 线性时间构建）：计数 O(m log n)，列出位置的耗时只与匹配数有关
+ * 编辑后索引只标记为过期，不立即重建：suffix_index_count / suffix_index_occurrences
+ * 在过期时先重建再查询；find_substring_count / find_occurrences 只在索引未过期时使用它
+ */
+int suffix_index_build(TextBuffer *buf);
+void suffix_index_free(TextBuffer *buf);
+void get_suffix_index_stats(const TextBuffer *buf, SuffixIndexStats *stats);
+int suffix_index_count(TextBuffer *buf, const char *substr);
+int suffix_index_occurrences(TextBuffer *buf, const char *substr, SearchResults *results);
+
+/* 查找引擎选择（影响查找、替换和删除子串），默认 SEARCH_ENGINE_AUTO */
+void set_search_engine(SearchEngine engine);
+SearchEngine get_search_engine(void);
+const char* search_engine_name(SearchEngine engine);
+
+/* 多模式查找和替换（单遍扫描） */
+int multi_pattern_init(MultiPattern *mp, const char *const *patterns, int count);
+void multi_pattern_free(MultiPattern *mp);
+int find_multi_occurrences(TextBuffer *buf, const MultiPattern *mp, int *counts, SearchResults *results);
+int replace_all_multi(TextBuffer *buf, const MultiPattern *mp, const char *const *replacements, int *counts);
+
+/* 正则查找和替换（模式由 regex_compile 编译，同一 Regex 不能在多个线程中同时使用） */
+int find_regex_count(TextBuffer *buf, Regex *re);
+int find_regex_occurrences(TextBuffer *buf, Regex *re, SearchResults *results);
+int replace_regex(TextBuffer *buf, Regex *re, const char *replacement);
 
 /* 子串插入功能 */
 int insert_substring(TextBuffer *buf, int line, int col, const char *substr);
 int insert_at_position(TextBuffer *buf, int pos, const char *substr);
 
+/* 全局字符位置换算（行间换行符计 1 个位置），O(log n) */
+int position_to_line_col(const TextBuffer *buf, int pos, int *line, int *col);
+int line_col_to_position(const TextBuffer *buf, int line, int col);
+
 /* 子串修改功能 */
 int replace_at_position(TextBuffer *buf, int line, int col, int len, const char *newstr);
 int replace_char(TextBuffer *buf, int line, int col, const char *newchar_utf8);
 int replace_all(TextBuffer *buf, const char *oldstr, const char *newstr);
+int replace_all_nocase(TextBuffer *buf, const char *oldstr, const char *newstr);
+
+/*
+ * 多线程替换/删除：按行区间分给 threads 个线程（<= 0 时使用 text_thread_count()），
+ * 各线程把新内容写进自己的追加区，结束后统一写回并合并计数、统计和修改标志；
+ * 结果与单线程版本相同，调用期间不得从其他线程访问 buf
+ */
+int replace_all_parallel(TextBuffer *buf, const char *oldstr, const char *newstr, int threads);
+
+/*
+ * 批量编辑：begin 之后用 insert/replace/delete 加入编辑（参数同 insert_substring、
+ * replace_at_position、delete_at_position；len 为 0 的替换即插入，len 为 0 的删除不改变内容），
+ * commit 一次性写入并释放批次；
+ * commit 返回写入的编辑数，失败返回 -1（缓冲区不变）；abort 直接丢弃
+ */
+int edit_batch_begin(EditBatch *batch, TextBuffer *buf);
+int edit_batch_insert(EditBatch *batch, int line, int col, const char *text);
+int edit_batch_replace(EditBatch *batch, int line, int col, int len, const char *text);
+int edit_batch_delete(EditBatch *batch, int line, int col, int len);
+int edit_batch_commit(EditBatch *batch);
+void edit_batch_abort(EditBatch *batch);
+
+/*
+ * 撤销与重做：一次公开修改函数的调用（或一对 undo_group_begin/undo_group_end 之间的全部修改）为一条命令
+ * 日志只记录行片段修改前后的指向，不复制文本；超出内存上限时丢弃最早的命令
+ * 清空缓冲区或打开文件时日志一并清空，上限恢复为 UNDO_LIMIT_DEFAULT
+ * undo_edit/redo_edit 成功返回 0，没有可撤销/重做的命令或正处于命令组内返回 -1
+ */
+int undo_edit(TextBuffer *buf);
+int redo_edit(TextBuffer *buf);
+int undo_group_begin(TextBuffer *buf);
+void undo_group_end(TextBuffer *buf);
+int undo_set_limit(TextBuffer *buf, size_t bytes);
+void undo_clear(TextBuffer *buf);
+void get_undo_stats(const TextBuffer *buf, UndoStats *stats);
+
+/*
+ * 只读快照：snapshot_create 为 O(1)，只增加引用计数，之后缓冲区的修改按块写时复制，
+ * 快照始终看到创建时的完整内容；清空缓冲区或打开新文件后快照仍然有效
+ * snapshot_create 须在修改缓冲区的线程中调用，之后快照可以交给任意一个线程读取和释放
+ * （同一快照不要在多个线程中同时释放）；有快照存在时不能覆盖保存以映射方式打开的文件
+ */
+TextSnapshot* snapshot_create(TextBuffer *buf);
+void snapshot_release(TextSnapshot *snap);
+int snapshot_line_count(const TextSnapshot *snap);
+const char* snapshot_line(const TextSnapshot *snap, int line_num, int *length);
+unsigned long long snapshot_revision(const TextSnapshot *snap);
+CharStatistics snapshot_statistics(const TextSnapshot *snap);
+int snapshot_find_count(const TextSnapshot *snap, const char *substr);
+int snapshot_find_occurrences(const TextSnapshot *snap, const char *substr, SearchResults *results);
+
+/*
+ * 把快照的全部内容（行间以 '\n' 分隔）写入 out，out_size 不为 0 时总以 '\0' 结尾
+ * 返回完整内容的字节数（不含 '\0'），大于等于 out_size 时表示被截断
+ */
+size_t get_buffer_content(const TextSnapshot *snap, char *out, size_t out_size);
 
 /* 子串删除功能 */
 int delete_substring(TextBuffer *buf, const char *substr);
+int delete_substring_parallel(TextBuffer *buf, const char *substr, int threads);
 int delete_at_position(TextBuffer *buf, int line, int col, int len);
 int delete_line(TextBuffer *buf, int line_num);
 
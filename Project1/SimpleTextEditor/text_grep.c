@@ -0,0 +1,362 @@
+/*
+ * 简易文本编辑器 - 目录批量查找实现
+ */
+
+#include <time.h>
+#include "text_grep.h"
+#include "text_editor.h"
+#include "text_simd.h"
+#include "text_thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_SEPARATOR '\\'
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#define PATH_SEPARATOR '/'
+#endif
+
+/* 遍历得到的路径列表 */
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} PathList;
+
+/* 单个文件的查找结果：输出先写入 text，轮到该文件时再整体写出 */
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    long long matches;
+    long long lines;
+    int skipped;
+    int done;
+} GrepSlot;
+
+typedef struct {
+    const GrepOptions *options;
+    PathList files;
+    GrepSlot *slots;
+    TextMutex out_lock;
+    int next_output;        /* 下一个应写出的文件下标 */
+} GrepJob;
+
+/* 每个线程的上下文：缓冲区、编译好的正则和结果集在该线程处理的各文件间复用 */
+typedef struct {
+    GrepJob *job;
+    TextBuffer buf;
+    Regex *re;
+    SearchResults results;
+} GrepWorker;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* ========================== 目录遍历 ========================== */
+
+static int path_list_push(PathList *list, char *path) {
+    if (list->count == list->capacity) {
+        int cap = list->capacity ? list->capacity * 2 : 64;
+        char **grown = (char**)realloc(list->paths, sizeof(char*) * (size_t)cap);
+        if (grown == NULL) return -1;
+        list->paths = grown;
+        list->capacity = cap;
+    }
+    list->paths[list->count++] = path;
+    return 0;
+}
+
+static void path_list_free(PathList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static char* join_path(const char *dir, const char *name) {
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    char *path = (char*)malloc(dlen + nlen + 2);
+    if (path == NULL) return NULL;
+    memcpy(path, dir, dlen);
+    if (dlen > 0 && dir[dlen - 1] != '/' && dir[dlen - 1] != PATH_SEPARATOR) {
+        path[dlen++] = PATH_SEPARATOR;
+    }
+    memcpy(path + dlen, name, nlen + 1);
+    return path;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* 取出目录中除 . 和 .. 以外的全部路径，按名称排序；目录无法读取时返回空列表 */
+static int list_directory(const char *dir, PathList *entries) {
+#ifdef _WIN32
+    char *pattern = join_path(dir, "*");
+    if (pattern == NULL) return -1;
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    free(pattern);
+    if (find == INVALID_HANDLE_VALUE) return 0;
+    int rc = 0;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        char *path = join_path(dir, data.cFileName);
+        if (path == NULL || path_list_push(entries, path) != 0) {
+            free(path);
+            rc = -1;
+            break;
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir);
+    if (d == NULL) return 0;
+    int rc = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        char *path = join_path(dir, ent->d_name);
+        if (path == NULL || path_list_push(entries, path) != 0) {
+            free(path);
+            rc = -1;
+            break;
+        }
+    }
+    closedir(d);
+#endif
+    if (entries->count > 1) {
+        qsort(entries->paths, (size_t)entries->count, sizeof(char*), compare_paths);
+    }
+    return rc;
+}
+
+/* 路径类型：1 为目录，0 为普通文件，-1 为其他（含符号链接，不跟随以免循环） */
+static int path_kind(const char *path) {
+#ifdef _WIN32
+    DWORD attr = GetFileAttributesA(path);
+    if (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_REPARSE_POINT)) return -1;
+    return (attr & FILE_ATTRIBUTE_DIRECTORY) ? 1 : 0;
+#else
+    struct stat st;
+    if (lstat(path, &st) != 0) return -1;
+    if (S_ISDIR(st.st_mode)) return 1;
+    return S_ISREG(st.st_mode) ? 0 : -1;
+#endif
+}
+
+/* 深度优先收集 dir 下的全部普通文件，路径的所有权转给 files */
+static int walk_directory(const char *dir, PathList *files) {
+    PathList entries = { NULL, 0, 0 };
+    int rc = list_directory(dir, &entries);
+    for (int i = 0; i < entries.count && rc == 0; i++) {
+        int kind = path_kind(entries.paths[i]);
+        if (kind == 1) {
+            rc = walk_directory(entries.paths[i], files);
+        } else if (kind == 0) {
+            if (path_list_push(files, entries.paths[i]) != 0) {
+                rc = -1;
+                break;
+            }
+            entries.paths[i] = NULL;
+        }
+    }
+    path_list_free(&entries);
+    return rc;
+}
+
+/* ========================== 并行查找 ========================== */
+
+static int slot_append(GrepSlot *slot, const char *text, size_t len) {
+    if (slot->length + len > slot->capacity) {
+        size_t cap = slot->capacity ? slot->capacity : BUFFER_SIZE;
+        while (cap < slot->length + len) cap *= 2;
+        char *grown = (char*)realloc(slot->text, cap);
+        if (grown == NULL) return -1;
+        slot->text = grown;
+        slot->capacity = cap;
+    }
+    memcpy(slot->text + slot->length, text, len);
+    slot->length += len;
+    return 0;
+}
+
+/* 每个含匹配的行输出一次，列号取该行第一处匹配 */
+static int format_matches(GrepSlot *slot, const char *path, const TextBuffer *buf,
+                          const SearchResults *results) {
+    int last_line = -1;
+    for (int i = 0; i < results->count; i++) {
+        const SearchResult *r = &results->items[i];
+        if (r->line == last_line) continue;
+        last_line = r->line;
+
+        char prefix[64];
+        int length = 0;
+        const char *text = get_line_view(buf, r->line, &length);
+        int n = snprintf(prefix, sizeof(prefix), ":%d:%d:", r->line + 1, r->column + 1);
+        if (slot_append(slot, path, strlen(path)) != 0 ||
+            slot_append(slot, prefix, (size_t)n) != 0 ||
+            slot_append(slot, text, (size_t)length) != 0 ||
+            slot_append(slot, "\n", 1) != 0) {
+            return -1;
+        }
+        slot->lines++;
+    }
+    return 0;
+}
+
+/* 文件 index 查找完毕：若它正是下一个应输出的文件，把连续已完成的文件一并写出 */
+static void grep_finish(GrepJob *job, int index) {
+    text_mutex_lock(&job->out_lock);
+    job->slots[index].done = 1;
+    while (job->next_output < job->files.count && job->slots[job->next_output].done) {
+        GrepSlot *slot = &job->slots[job->next_output];
+        if (slot->length > 0) {
+            fwrite(slot->text, 1, slot->length, job->options->out);
+        }
+        free(slot->text);
+        slot->text = NULL;
+        job->next_output++;
+    }
+    text_mutex_unlock(&job->out_lock);
+}
+
+static void grep_task(void *arg, int task) {
+    GrepWorker *w = (GrepWorker*)arg;
+    GrepJob *job = w->job;
+    GrepSlot *slot = &job->slots[task];
+    const char *path = job->files.paths[task];
+
+    /* 映射打开，文件内容不复制；开头含 '\0' 的按二进制文件跳过 */
+    if (file_open_mapped(&w->buf, path) != 0 ||
+        (w->buf.mapping.data != NULL &&
+         memchr(w->buf.mapping.data, '\0',
+                w->buf.mapping.size < GREP_BINARY_PROBE ? w->buf.mapping.size : GREP_BINARY_PROBE) != NULL)) {
+        slot->skipped = 1;
+    } else {
+        w->results.count = 0;
+        w->results.truncated = 0;
+        int n = job->options->use_regex
+              ? find_regex_occurrences(&w->buf, w->re, &w->results)
+              : find_occurrences(&w->buf, job->options->pattern, &w->results);
+        if (n < 0 || format_matches(slot, path, &w->buf, &w->results) != 0) {
+            slot->skipped = 1;
+            slot->length = 0;
+            slot->lines = 0;
+        } else {
+            slot->matches = n;
+        }
+    }
+    buffer_clear(&w->buf);
+    grep_finish(job, task);
+}
+
+int grep_path(const char *root, const GrepOptions *options, GrepStats *stats, const char **error) {
+    const char *dummy;
+    if (error == NULL) error = &dummy;
+    *error = NULL;
+    if (stats != NULL) memset(stats, 0, sizeof(*stats));
+    if (root == NULL || options == NULL || options->pattern == NULL || options->out == NULL) {
+        *error = "参数无效";
+        return -1;
+    }
+    if (options->pattern[0] == '\0') {
+        *error = "查找内容不能为空";
+        return -1;
+    }
+
+    double start = now_seconds();
+    int worker_count = options->threads > 0 ? options->threads : text_thread_count();
+    if (worker_count > MAX_WORKER_THREADS) worker_count = MAX_WORKER_THREADS;
+
+    GrepJob job;
+    memset(&job, 0, sizeof(job));
+    job.options = options;
+
+    int kind = path_kind(root);
+    int rc = 0;
+    if (kind == 1) {
+        rc = walk_directory(root, &job.files);
+    } else if (kind == 0) {
+        size_t len = strlen(root);
+        char *copy = (char*)malloc(len + 1);
+        if (copy != NULL) memcpy(copy, root, len + 1);
+        rc = copy != NULL && path_list_push(&job.files, copy) == 0 ? 0 : -1;
+        if (rc != 0) free(copy);
+    } else {
+        *error = "无法访问路径";
+        return -1;
+    }
+    if (rc != 0) {
+        path_list_free(&job.files);
+        *error = "内存不足";
+        return -1;
+    }
+
+    if (worker_count > job.files.count) worker_count = job.files.count > 0 ? job.files.count : 1;
+    GrepWorker *workers = (GrepWorker*)calloc((size_t)worker_count, sizeof(GrepWorker));
+    job.slots = (GrepSlot*)calloc((size_t)job.files.count + 1, sizeof(GrepSlot));
+    if (workers == NULL || job.slots == NULL) {
+        free(workers);
+        free(job.slots);
+        path_list_free(&job.files);
+        *error = "内存不足";
+        return -1;
+    }
+
+    /* 同一个 Regex 不能跨线程使用，每个线程各编译一份 */
+    for (int i = 0; i < worker_count && rc == 0; i++) {
+        workers[i].job = &job;
+        buffer_init(&workers[i].buf);
+        search_results_init(&workers[i].results, 0);
+        if (options->use_regex) {
+            workers[i].re = regex_compile(options->pattern, error);
+            if (workers[i].re == NULL) rc = -1;
+        }
+    }
+
+    int steals = 0;
+    if (rc == 0) {
+        simd_level();   /* 指令集检测在启动线程前完成 */
+        text_mutex_init(&job.out_lock);
+        steals = text_parallel_steal(grep_task, workers, sizeof(GrepWorker), worker_count, job.files.count);
+        text_mutex_destroy(&job.out_lock);
+        fflush(options->out);
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        regex_free(workers[i].re);
+        search_results_free(&workers[i].results);
+        buffer_clear(&workers[i].buf);
+    }
+    if (stats != NULL && rc == 0) {
+        stats->steals = steals;
+        for (int i = 0; i < job.files.count; i++) {
+            if (job.slots[i].skipped) {
+                stats->skipped++;
+                continue;
+            }
+            stats->files++;
+            stats->matches += job.slots[i].matches;
+            stats->matched_lines += job.slots[i].lines;
+            if (job.slots[i].matches > 0) stats->matched_files++;
+        }
+        stats->seconds = now_seconds() - start;
+    }
+    for (int i = 0; i < job.files.count; i++) {
+        free(job.slots[i].text);
+    }
+    free(job.slots);
+    free(workers);
+    path_list_free(&job.files);
+    return rc;
+}
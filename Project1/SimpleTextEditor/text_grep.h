@@ -0,0 +1,40 @@
+/*
+ * 简易文本编辑器 - 目录批量查找（grep）
+ * 遍历目录树，用工作窃取线程池并行查找每个文件，按文件顺序流式输出匹配行
+ */
+
+#ifndef TEXT_GREP_H
+#define TEXT_GREP_H
+
+#include <stdio.h>
+
+#define GREP_BINARY_PROBE   8000    /* 文件开头这么多字节内出现 '\0' 即视为二进制文件并跳过 */
+
+/* 查找选项 */
+typedef struct {
+    const char *pattern;    /* 子串或正则表达式 */
+    int use_regex;          /* 非 0 时按正则表达式查找 */
+    int threads;            /* 线程数，<= 0 表示使用 text_thread_count() */
+    FILE *out;              /* 匹配行的输出位置 */
+} GrepOptions;
+
+/* 查找统计 */
+typedef struct {
+    int files;              /* 查找过的文件数 */
+    int skipped;            /* 无法打开或判定为二进制而跳过的文件数 */
+    int matched_files;      /* 含匹配的文件数 */
+    long long matched_lines;/* 含匹配的行数（即输出行数） */
+    long long matches;      /* 匹配总数 */
+    int steals;             /* 工作窃取次数 */
+    double seconds;         /* 总耗时（秒，含目录遍历） */
+} GrepStats;
+
+/*
+ * 查找 root（目录则递归遍历，同一目录内按名称排序；也可以是单个文件）
+ * 每个匹配行输出为 "路径:行:列:内容"，行号和列号从 1 开始，列为该行第一处匹配；
+ * 各文件并行查找，输出严格按遍历顺序
+ * 成功返回 0；正则表达式无效、root 无法访问或内存不足返回 -1（error 指向说明，可为 NULL）
+ */
+int grep_path(const char *root, const GrepOptions *options, GrepStats *stats, const char **error);
+
+#endif /* TEXT_GREP_H */
@@ -0,0 +1,1436 @@
+/*
+ * 简易文本编辑器 - 正则表达式引擎实现
+ *
+ * 编译：模式 -> 语法树 -> 正向、反向两份字节级指令序列（Thompson NFA），
+ *       Unicode 字符类按 UTF-8 编码拆成若干字节区间序列
+ * 查找：两个惰性 DFA 共用一张字节分类表
+ *   reverse 反向、不锚定，从行尾扫到行首，标出所有可能的匹配起点；没有起点的行到此为止
+ *   first   正向、锚定，从最左起点开始，按优先级（最左优先）求匹配终点
+ * DFA 状态是按优先级排列的 NFA 指令集合，第一次经过某条转移时才计算并缓存，
+ * 之后的扫描只查表；缓存超过上限时整体清空，扫描继续
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "text_regex.h"
+
+/* ========================== 语法树 ========================== */
+
+typedef enum {
+    NODE_EMPTY,
+    NODE_CLASS,         /* 字符集合（单个字面字符也用它表示） */
+    NODE_CONCAT,
+    NODE_ALT,
+    NODE_REPEAT,
+    NODE_GROUP,         /* 捕获分组 */
+    NODE_BOL,           /* ^ */
+    NODE_EOL            /* $ */
+} NodeType;
+
+typedef struct {
+    unsigned int lo;
+    unsigned int hi;
+} CodeRange;
+
+typedef struct {
+    NodeType type;
+    int left;           /* 子结点；REPEAT、GROUP 只用 left */
+    int right;
+    int min;            /* REPEAT：最少次数 */
+    int max;            /* REPEAT：最多次数，-1 表示不限 */
+    int greedy;
+    int group;          /* GROUP：分组号 */
+    int range_first;    /* CLASS：在 ranges 中的起点和个数 */
+    int range_count;
+} Node;
+
+#define PARSE_MAX_DEPTH 200     /* 括号嵌套上限，防止递归过深 */
+#define UNICODE_MAX     0x10FFFFu
+
+typedef struct {
+    const unsigned char *p;
+    Node *nodes;
+    int node_count;
+    int node_cap;
+    CodeRange *ranges;
+    int range_count;
+    int range_cap;
+    int groups;
+    int depth;
+    const char *error;
+} Parser;
+
+static int new_node(Parser *P, NodeType type) {
+    if (P->node_count == P->node_cap) {
+        int cap = P->node_cap ? P->node_cap * 2 : 64;
+        Node *grown = (Node*)realloc(P->nodes, sizeof(Node) * (size_t)cap);
+        if (grown == NULL) {
+            P->error = "内存不足";
+            return -1;
+        }
+        P->nodes = grown;
+        P->node_cap = cap;
+    }
+    Node *node = &P->nodes[P->node_count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = node->right = -1;
+    return P->node_count++;
+}
+
+static int add_range(Parser *P, unsigned int lo, unsigned int hi) {
+    if (P->range_count == P->range_cap) {
+        int cap = P->range_cap ? P->range_cap * 2 : 64;
+        CodeRange *grown = (CodeRange*)realloc(P->ranges, sizeof(CodeRange) * (size_t)cap);
+        if (grown == NULL) {
+            P->error = "内存不足";
+            return -1;
+        }
+        P->ranges = grown;
+        P->range_cap = cap;
+    }
+    P->ranges[P->range_count].lo = lo;
+    P->ranges[P->range_count].hi = hi;
+    P->range_count++;
+    return 0;
+}
+
+static int compare_ranges(const void *a, const void *b) {
+    unsigned int x = ((const CodeRange*)a)->lo;
+    unsigned int y = ((const CodeRange*)b)->lo;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* 把 ranges[first, range_count) 排序合并，negate 时取补集；返回区间数，失败返回 -1 */
+static int finish_ranges(Parser *P, int first, int negate) {
+    int count = P->range_count - first;
+    CodeRange *r = P->ranges + first;
+    qsort(r, (size_t)count, sizeof(CodeRange), compare_ranges);
+
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged > 0 && r[i].lo <= r[merged - 1].hi + 1) {
+            if (r[i].hi > r[merged - 1].hi) r[merged - 1].hi = r[i].hi;
+        } else {
+            r[merged++] = r[i];
+        }
+    }
+    P->range_count = first + merged;
+    if (!negate) return merged;
+
+    /* 补集最多比原集合多一个区间，先记下原区间再依次写回 */
+    CodeRange *copy = (CodeRange*)malloc(sizeof(CodeRange) * (size_t)(merged + 1));
+    if (copy == NULL) {
+        P->error = "内存不足";
+        return -1;
+    }
+    memcpy(copy, P->ranges + first, sizeof(CodeRange) * (size_t)merged);
+    P->range_count = first;
+    unsigned int next = 0;
+    int failed = 0;
+    for (int i = 0; i < merged && !failed; i++) {
+        if (copy[i].lo > next) failed = add_range(P, next, copy[i].lo - 1) != 0;
+        next = copy[i].hi + 1;
+    }
+    if (!failed && next <= UNICODE_MAX) failed = add_range(P, next, UNICODE_MAX) != 0;
+    free(copy);
+    return failed ? -1 : P->range_count - first;
+}
+
+/* 解码模式中的一个 UTF-8 字符 */
+static int parse_char(Parser *P, unsigned int *cp) {
+    const unsigned char *p = P->p;
+    unsigned int c = p[0];
+    unsigned int v;
+    int len;
+
+    if (c < 0x80) {
+        len = 1;
+        v = c;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+        v = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        len = 3;
+        v = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        v = c & 0x07;
+    } else {
+        P->error = "模式不是有效的 UTF-8";
+        return -1;
+    }
+    for (int i = 1; i < len; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            P->error = "模式不是有效的 UTF-8";
+            return -1;
+        }
+        v = (v << 6) | (p[i] & 0x3F);
+    }
+    if ((len == 3 && (v < 0x800 || (v >= 0xD800 && v <= 0xDFFF))) ||
+        (len == 4 && (v < 0x10000 || v > UNICODE_MAX))) {
+        P->error = "模式不是有效的 UTF-8";
+        return -1;
+    }
+    P->p += len;
+    *cp = v;
+    return 0;
+}
+
+/* \d \w \s 及其大写形式；不是类转义返回 0 */
+static int add_class_escape(Parser *P, unsigned char c) {
+    static const CodeRange digit[] = { { '0', '9' } };
+    static const CodeRange word[] = { { '0', '9' }, { 'A', 'Z' }, { '_', '_' }, { 'a', 'z' } };
+    static const CodeRange space[] = { { '\t', '\r' }, { ' ', ' ' } };
+    const CodeRange *set;
+    int count;
+
+    switch (c) {
+        case 'd': case 'D': set = digit; count = 1; break;
+        case 'w': case 'W': set = word;  count = 4; break;
+        case 's': case 'S': set = space; count = 2; break;
+        default: return 0;
+    }
+
+    if (c >= 'a') {
+        for (int i = 0; i < count; i++) {
+            if (add_range(P, set[i].lo, set[i].hi) != 0) return -1;
+        }
+    } else {
+        unsigned int next = 0;
+        for (int i = 0; i < count; i++) {
+            if (set[i].lo > next && add_range(P, next, set[i].lo - 1) != 0) return -1;
+            next = set[i].hi + 1;
+        }
+        if (add_range(P, next, UNICODE_MAX) != 0) return -1;
+    }
+    return 1;
+}
+
+/* 单字符转义（P->p 指向反斜杠之后） */
+static int parse_escape_char(Parser *P, unsigned int *cp) {
+    unsigned char c = *P->p;
+    switch (c) {
+        case '\0': P->error = "模式以单独的 \\ 结尾"; return -1;
+        case 't': *cp = '\t'; break;
+        case 'n': *cp = '\n'; break;
+        case 'r': *cp = '\r'; break;
+        case 'f': *cp = '\f'; break;
+        case 'v': *cp = '\v'; break;
+        default:
+            if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+                P->error = "不支持的转义序列";
+                return -1;
+            }
+            if (c >= 0x80) return parse_char(P, cp);
+            *cp = c;
+            break;
+    }
+    P->p++;
+    return 0;
+}
+
+/* [...]：P->p 指向 '[' */
+static int parse_class(Parser *P) {
+    int first = P->range_count;
+    int negate = 0;
+    P->p++;
+    if (*P->p == '^') {
+        negate = 1;
+        P->p++;
+    }
+
+    for (int initial = 1; ; initial = 0) {
+        unsigned int lo, hi;
+        if (*P->p == '\0') {
+            P->error = "字符类缺少 ]";
+            return -1;
+        }
+        if (*P->p == ']' && !initial) {
+            P->p++;
+            break;
+        }
+
+        if (*P->p == '\\') {
+            P->p++;
+            int rc = add_class_escape(P, *P->p);
+            if (rc < 0) return -1;
+            if (rc > 0) {
+                P->p++;
+                continue;
+            }
+            if (parse_escape_char(P, &lo) != 0) return -1;
+        } else if (parse_char(P, &lo) != 0) {
+            return -1;
+        }
+
+        hi = lo;
+        if (P->p[0] == '-' && P->p[1] != ']' && P->p[1] != '\0') {
+            P->p++;
+            if (*P->p == '\\') {
+                P->p++;
+                if (add_class_escape(P, *P->p) != 0) {
+                    P->error = "字符类范围的端点不能是 \\d \\w \\s";
+                    return -1;
+                }
+                if (parse_escape_char(P, &hi) != 0) return -1;
+            } else if (parse_char(P, &hi) != 0) {
+                return -1;
+            }
+            if (hi < lo) {
+                P->error = "字符类范围的起点大于终点";
+                return -1;
+            }
+        }
+        if (add_range(P, lo, hi) != 0) return -1;
+    }
+
+    int count = finish_ranges(P, first, negate);
+    if (count < 0) return -1;
+    int node = new_node(P, NODE_CLASS);
+    if (node < 0) return -1;
+    P->nodes[node].range_first = first;
+    P->nodes[node].range_count = count;
+    return node;
+}
+
+static int class_node(Parser *P, int first) {
+    int count = finish_ranges(P, first, 0);
+    if (count < 0) return -1;
+    int node = new_node(P, NODE_CLASS);
+    if (node < 0) return -1;
+    P->nodes[node].range_first = first;
+    P->nodes[node].range_count = count;
+    return node;
+}
+
+static int parse_alt(Parser *P);
+
+static int parse_atom(Parser *P) {
+    int first = P->range_count;
+    unsigned int cp;
+
+    switch (*P->p) {
+        case '(': {
+            int group = 0;
+            P->p++;
+            if (P->p[0] == '?' && P->p[1] == ':') {
+                P->p += 2;
+            } else {
+                if (P->groups >= REGEX_MAX_GROUPS) {
+                    P->error = "捕获分组过多";
+                    return -1;
+                }
+                group = ++P->groups;
+            }
+            if (++P->depth > PARSE_MAX_DEPTH) {
+                P->error = "括号嵌套过深";
+                return -1;
+            }
+            int inner = parse_alt(P);
+            P->depth--;
+            if (inner < 0) return -1;
+            if (*P->p != ')') {
+                P->error = "缺少 )";
+                return -1;
+            }
+            P->p++;
+            if (group == 0) return inner;
+            int node = new_node(P, NODE_GROUP);
+            if (node < 0) return -1;
+            P->nodes[node].left = inner;
+            P->nodes[node].group = group;
+            return node;
+        }
+        case '[':
+            return parse_class(P);
+        case '.':
+            P->p++;
+            if (add_range(P, 0, '\n' - 1) != 0 || add_range(P, '\n' + 1, UNICODE_MAX) != 0) return -1;
+            return class_node(P, first);
+        case '^':
+            P->p++;
+            return new_node(P, NODE_BOL);
+        case '$':
+            P->p++;
+            return new_node(P, NODE_EOL);
+        case '*':
+        case '+':
+        case '?':
+            P->error = "量词前没有可重复的内容";
+            return -1;
+        case '\\': {
+            P->p++;
+            int rc = add_class_escape(P, *P->p);
+            if (rc < 0) return -1;
+            if (rc > 0) {
+                P->p++;
+                return class_node(P, first);
+            }
+            if (parse_escape_char(P, &cp) != 0) return -1;
+            break;
+        }
+        default:
+            if (parse_char(P, &cp) != 0) return -1;
+            break;
+    }
+
+    if (add_range(P, cp, cp) != 0) return -1;
+    return class_node(P, first);
+}
+
+static int parse_count(Parser *P, int *value) {
+    int v = 0;
+    if (*P->p < '0' || *P->p > '9') {
+        P->error = "重复次数格式错误";
+        return -1;
+    }
+    while (*P->p >= '0' && *P->p <= '9') {
+        v = v * 10 + (*P->p - '0');
+        if (v > REGEX_MAX_REPEAT) {
+            P->error = "重复次数过大";
+            return -1;
+        }
+        P->p++;
+    }
+    *value = v;
+    return 0;
+}
+
+static int parse_repeat(Parser *P) {
+    int atom = parse_atom(P);
+    if (atom < 0) return -1;
+
+    for (;;) {
+        int min, max;
+        unsigned char c = *P->p;
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            P->p++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            P->p++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            P->p++;
+        } else if (c == '{' && P->p[1] >= '0' && P->p[1] <= '9') {
+            P->p++;
+            if (parse_count(P, &min) != 0) return -1;
+            max = min;
+            if (*P->p == ',') {
+                P->p++;
+                max = -1;
+                if (*P->p != '}' && parse_count(P, &max) != 0) return -1;
+            }
+            if (*P->p != '}') {
+                P->error = "重复次数缺少 }";
+                return -1;
+            }
+            P->p++;
+            if (max >= 0 && max < min) {
+                P->error = "重复次数的下限大于上限";
+                return -1;
+            }
+        } else {
+            return atom;
+        }
+
+        int node = new_node(P, NODE_REPEAT);
+        if (node < 0) return -1;
+        P->nodes[node].left = atom;
+        P->nodes[node].min = min;
+        P->nodes[node].max = max;
+        P->nodes[node].greedy = 1;
+        if (*P->p == '?') {
+            P->nodes[node].greedy = 0;
+            P->p++;
+        }
+        atom = node;
+    }
+}
+
+static int parse_concat(Parser *P) {
+    int result = -1;
+    while (*P->p != '\0' && *P->p != '|' && *P->p != ')') {
+        int item = parse_repeat(P);
+        if (item < 0) return -1;
+        if (result < 0) {
+            result = item;
+        } else {
+            int node = new_node(P, NODE_CONCAT);
+            if (node < 0) return -1;
+            P->nodes[node].left = result;
+            P->nodes[node].right = item;
+            result = node;
+        }
+    }
+    return result >= 0 ? result : new_node(P, NODE_EMPTY);
+}
+
+static int parse_alt(Parser *P) {
+    int left = parse_concat(P);
+    while (left >= 0 && *P->p == '|') {
+        P->p++;
+        int right = parse_concat(P);
+        if (right < 0) return -1;
+        int node = new_node(P, NODE_ALT);
+        if (node < 0) return -1;
+        P->nodes[node].left = left;
+        P->nodes[node].right = right;
+        left = node;
+    }
+    return left;
+}
+
+/* ========================== 编译为指令序列 ========================== */
+
+enum {
+    OP_RANGE,       /* 读入一个落在 [lo, hi] 的字节 */
+    OP_SPLIT,       /* 分叉，x 优先于 y */
+    OP_JMP,
+    OP_SAVE,        /* 记录分组位置到槽 x */
+    OP_MATCH,
+    OP_BOL,         /* 行首断言 */
+    OP_EOL          /* 行尾断言 */
+};
+
+typedef struct {
+    unsigned char op;
+    unsigned char lo;
+    unsigned char hi;
+    int x;
+    int y;
+} RegexInst;
+
+/* 一段 UTF-8 字节区间序列，依次匹配 1 ~ 4 个字节 */
+typedef struct {
+    unsigned char lo[4];
+    unsigned char hi[4];
+    int len;
+} Utf8Seq;
+
+typedef struct {
+    const Parser *parser;
+    RegexInst *prog;
+    int len;
+    int cap;
+    int reverse;            /* 生成反向匹配用的指令：连接顺序、UTF-8 字节顺序和 ^ $ 均颠倒 */
+    Utf8Seq *seqs;          /* 字符类拆分的临时结果 */
+    int seq_count;
+    int seq_cap;
+    const char *error;
+} Compiler;
+
+static int emit(Compiler *C, unsigned char op, unsigned char lo, unsigned char hi, int x, int y) {
+    if (C->len >= REGEX_MAX_PROGRAM) {
+        C->error = "模式过长";
+        return -1;
+    }
+    if (C->len == C->cap) {
+        int cap = C->cap ? C->cap * 2 : 64;
+        RegexInst *grown = (RegexInst*)realloc(C->prog, sizeof(RegexInst) * (size_t)cap);
+        if (grown == NULL) {
+            C->error = "内存不足";
+            return -1;
+        }
+        C->prog = grown;
+        C->cap = cap;
+    }
+    RegexInst *in = &C->prog[C->len];
+    in->op = op;
+    in->lo = lo;
+    in->hi = hi;
+    in->x = x;
+    in->y = y;
+    return C->len++;
+}
+
+static int utf8_encode(unsigned int cp, unsigned char *out) {
+    if (cp < 0x80) {
+        out[0] = (unsigned char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (unsigned char)(0xC0 | (cp >> 6));
+        out[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (unsigned char)(0xE0 | (cp >> 12));
+        out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (unsigned char)(0xF0 | (cp >> 18));
+    out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/*
+ * 把码点区间 [lo, hi] 拆成若干字节区间序列：先按编码长度和代理区切开，
+ * 再切到每个后续字节都取满 0x80~0xBF 或首字节相同为止，此时逐字节取区间即可
+ */
+static int utf8_split(Compiler *C, unsigned int lo, unsigned int hi) {
+    static const unsigned int max_cp[] = { 0x7F, 0x7FF, 0xFFFF };
+    if (lo > hi) return 0;
+
+    if (lo <= 0xDFFF && hi >= 0xD800) {
+        if (lo < 0xD800 && utf8_split(C, lo, 0xD7FF) != 0) return -1;
+        return hi > 0xDFFF ? utf8_split(C, 0xE000, hi) : 0;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (lo <= max_cp[i] && hi > max_cp[i]) {
+            if (utf8_split(C, lo, max_cp[i]) != 0) return -1;
+            return utf8_split(C, max_cp[i] + 1, hi);
+        }
+    }
+    for (int i = 1; i < 4; i++) {
+        unsigned int m = (1u << (6 * i)) - 1;
+        if ((lo & ~m) != (hi & ~m)) {
+            if ((lo & m) != 0) {
+                if (utf8_split(C, lo, lo | m) != 0) return -1;
+                return utf8_split(C, (lo | m) + 1, hi);
+            }
+            if ((hi & m) != m) {
+                if (utf8_split(C, lo, (hi & ~m) - 1) != 0) return -1;
+                return utf8_split(C, hi & ~m, hi);
+            }
+        }
+    }
+
+    if (C->seq_count == C->seq_cap) {
+        int cap = C->seq_cap ? C->seq_cap * 2 : 16;
+        Utf8Seq *grown = (Utf8Seq*)realloc(C->seqs, sizeof(Utf8Seq) * (size_t)cap);
+        if (grown == NULL) {
+            C->error = "内存不足";
+            return -1;
+        }
+        C->seqs = grown;
+        C->seq_cap = cap;
+    }
+    Utf8Seq *seq = &C->seqs[C->seq_count++];
+    seq->len = utf8_encode(lo, seq->lo);
+    utf8_encode(hi, seq->hi);
+    return 0;
+}
+
+/* 字符类：各字节序列之间用 SPLIT 串成选择 */
+static int compile_class(Compiler *C, const CodeRange *ranges, int count) {
+    C->seq_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (utf8_split(C, ranges[i].lo, ranges[i].hi) != 0) return -1;
+    }
+    if (C->seq_count == 0) {
+        /* 空集合（如 [^\s\S]）永远不匹配：跳转到自身，展开时不会留下任何线程 */
+        return emit(C, OP_JMP, 0, 0, C->len, 0) < 0 ? -1 : 0;
+    }
+
+    int pending = -1;   /* 各分支末尾的 JMP 串成链表，x 暂存下一个 */
+    for (int k = 0; k < C->seq_count; k++) {
+        int split = -1;
+        if (k + 1 < C->seq_count) {
+            split = emit(C, OP_SPLIT, 0, 0, C->len + 1, -1);
+            if (split < 0) return -1;
+        }
+        const Utf8Seq *seq = &C->seqs[k];
+        for (int b = 0; b < seq->len; b++) {
+            int i = C->reverse ? seq->len - 1 - b : b;
+            if (emit(C, OP_RANGE, seq->lo[i], seq->hi[i], 0, 0) < 0) return -1;
+        }
+        if (split >= 0) {
+            int jmp = emit(C, OP_JMP, 0, 0, pending, 0);
+            if (jmp < 0) return -1;
+            pending = jmp;
+            C->prog[split].y = C->len;
+        }
+    }
+    while (pending >= 0) {
+        int next = C->prog[pending].x;
+        C->prog[pending].x = C->len;
+        pending = next;
+    }
+    return 0;
+}
+
+static int compile_node(Compiler *C, int idx) {
+    const Node *node = &C->parser->nodes[idx];
+    switch (node->type) {
+        case NODE_EMPTY:
+            return 0;
+        case NODE_CLASS:
+            return compile_class(C, C->parser->ranges + node->range_first, node->range_count);
+        case NODE_CONCAT:
+            if (compile_node(C, C->reverse ? node->right : node->left) != 0) return -1;
+            return compile_node(C, C->reverse ? node->left : node->right);
+        case NODE_ALT: {
+            int split = emit(C, OP_SPLIT, 0, 0, C->len + 1, -1);
+            if (split < 0 || compile_node(C, node->left) != 0) return -1;
+            int jmp = emit(C, OP_JMP, 0, 0, -1, 0);
+            if (jmp < 0) return -1;
+            C->prog[split].y = C->len;
+            if (compile_node(C, node->right) != 0) return -1;
+            C->prog[jmp].x = C->len;
+            return 0;
+        }
+        case NODE_GROUP:
+            if (!C->reverse && emit(C, OP_SAVE, 0, 0, 2 * node->group, 0) < 0) return -1;
+            if (compile_node(C, node->left) != 0) return -1;
+            if (!C->reverse && emit(C, OP_SAVE, 0, 0, 2 * node->group + 1, 0) < 0) return -1;
+            return 0;
+        case NODE_BOL:
+            return emit(C, C->reverse ? OP_EOL : OP_BOL, 0, 0, 0, 0) < 0 ? -1 : 0;
+        case NODE_EOL:
+            return emit(C, C->reverse ? OP_BOL : OP_EOL, 0, 0, 0, 0) < 0 ? -1 : 0;
+        case NODE_REPEAT:
+            break;
+    }
+
+    /* 重复：先展开 min 次（不限次数时最后一次改为循环），再接 max - min 个可选副本 */
+    int fixed = node->max < 0 && node->min > 0 ? node->min - 1 : node->min;
+    for (int i = 0; i < fixed; i++) {
+        if (compile_node(C, node->left) != 0) return -1;
+    }
+
+    if (node->max < 0) {
+        if (node->min > 0) {
+            /* L: body; SPLIT L, next */
+            int loop = C->len;
+            if (compile_node(C, node->left) != 0) return -1;
+            int split = emit(C, OP_SPLIT, 0, 0, 0, 0);
+            if (split < 0) return -1;
+            C->prog[split].x = node->greedy ? loop : C->len;
+            C->prog[split].y = node->greedy ? C->len : loop;
+        } else {
+            /* L: SPLIT body, next; body; JMP L */
+            int split = emit(C, OP_SPLIT, 0, 0, 0, 0);
+            if (split < 0 || compile_node(C, node->left) != 0) return -1;
+            if (emit(C, OP_JMP, 0, 0, split, 0) < 0) return -1;
+            C->prog[split].x = node->greedy ? split + 1 : C->len;
+            C->prog[split].y = node->greedy ? C->len : split + 1;
+        }
+        return 0;
+    }
+
+    int optional = node->max - node->min;
+    int *splits = optional > 0 ? (int*)malloc(sizeof(int) * (size_t)optional) : NULL;
+    if (optional > 0 && splits == NULL) {
+        C->error = "内存不足";
+        return -1;
+    }
+    for (int i = 0; i < optional; i++) {
+        splits[i] = emit(C, OP_SPLIT, 0, 0, 0, 0);
+        if (splits[i] < 0 || compile_node(C, node->left) != 0) {
+            free(splits);
+            return -1;
+        }
+    }
+    for (int i = 0; i < optional; i++) {
+        RegexInst *in = &C->prog[splits[i]];
+        in->x = node->greedy ? splits[i] + 1 : C->len;
+        in->y = node->greedy ? C->len : splits[i] + 1;
+    }
+    free(splits);
+    return 0;
+}
+
+/*
+ * 生成完整指令序列：开头是非贪婪的“任意字节”循环，用于不锚定查找
+ *   0: SPLIT 3, 1    1: RANGE 00-FF    2: JMP 0    3: 正文
+ * 正向序列的正文包在 SAVE 0 / SAVE 1 中
+ */
+#define PROGRAM_BODY 3
+
+static RegexInst* compile_program(const Parser *P, int root, int reverse, int *len, const char **error) {
+    Compiler C;
+    memset(&C, 0, sizeof(C));
+    C.parser = P;
+    C.reverse = reverse;
+
+    int ok = emit(&C, OP_SPLIT, 0, 0, PROGRAM_BODY, 1) >= 0 &&
+             emit(&C, OP_RANGE, 0x00, 0xFF, 0, 0) >= 0 &&
+             emit(&C, OP_JMP, 0, 0, 0, 0) >= 0;
+    if (ok && !reverse) ok = emit(&C, OP_SAVE, 0, 0, 0, 0) >= 0;
+    if (ok) ok = compile_node(&C, root) == 0;
+    if (ok && !reverse) ok = emit(&C, OP_SAVE, 0, 0, 1, 0) >= 0;
+    if (ok) ok = emit(&C, OP_MATCH, 0, 0, 0, 0) >= 0;
+
+    free(C.seqs);
+    if (!ok) {
+        free(C.prog);
+        *error = C.error;
+        return NULL;
+    }
+    *len = C.len;
+    return C.prog;
+}
+
+/* ========================== 惰性 DFA ========================== */
+
+#define DFA_DEAD        0       /* 0 号状态：没有存活的线程 */
+#define DFA_UNKNOWN     (-1)    /* 转移尚未计算 */
+
+/*
+ * 转移表中存放的是目标状态的行偏移（状态号 * stride）左移一位、最低位为是否匹配，
+ * 扫描时下一次查表不必再做乘法，也不必另查匹配标志
+ */
+#define DFA_ROW(entry)      ((size_t)((entry) >> 1))
+#define DFA_MATCHED(entry)  ((entry) & 1)
+
+typedef struct {
+    const RegexInst *prog;
+    int start_pc;
+    int cut;                /* 遇到匹配后丢弃优先级更低的线程（最左优先） */
+    int stride;             /* 每个状态的转移数：字节类数 + 1（行尾） */
+    int count;
+    int cap;
+    int *trans;             /* count * stride，编码见 DFA_ROW */
+    unsigned char *match;   /* 到达该状态时是否已匹配 */
+    int *list_first;        /* 状态的指令列表在 pcs 中的位置 */
+    int *list_len;
+    int *pcs;
+    size_t pcs_len;
+    size_t pcs_cap;
+    int *hash;              /* 开放寻址，存放状态号 + 1，0 为空 */
+    size_t hash_cap;
+    int start[2];           /* 非行首 / 行首的起始状态，-1 表示尚未计算 */
+    size_t bytes;           /* 缓存占用 */
+} Dfa;
+
+struct Regex {
+    RegexInst *fwd;
+    int fwd_len;
+    RegexInst *rev;
+    int rev_len;
+    int groups;
+    int nslots;
+
+    unsigned char byte_class[256];
+    unsigned char class_rep[256];   /* 每个字节类的代表字节 */
+    int class_count;
+
+    Dfa first;
+    Dfa reverse;
+
+    /* DFA 构造用的临时空间，按较长的指令序列分配 */
+    int *stack;
+    int *set_dense;
+    int *set_sparse;
+    int set_size;
+    int *cur_list;
+    int *next_list;
+
+    unsigned char *starts;  /* 当前行各位置是否可能是匹配起点 */
+    size_t starts_cap;
+
+    /* Pike VM */
+    int *pike_dense[2];
+    int *pike_sparse[2];
+    int pike_size[2];
+    size_t *pike_slots[2];
+    int *frame_pc;
+    int *frame_slot;
+    size_t *frame_old;
+    size_t *caps;
+};
+
+static void set_clear(Regex *re) {
+    re->set_size = 0;
+}
+
+/* 已在集合中返回 1，否则加入并返回 0 */
+static int set_insert(Regex *re, int pc) {
+    int i = re->set_sparse[pc];
+    if (i < re->set_size && re->set_dense[i] == pc) return 1;
+    re->set_sparse[pc] = re->set_size;
+    re->set_dense[re->set_size++] = pc;
+    return 0;
+}
+
+/*
+ * 从 pc 出发沿空转移展开，读字节的指令和尚未满足的行尾断言按优先级追加到 list
+ * cut 模式下遇到 MATCH 就不再展开，返回 1 通知调用方丢弃后面的线程
+ */
+static int dfa_closure(Regex *re, const Dfa *d, int pc, int bol, int eol, int *list, int *len, int *matched) {
+    int *stack = re->stack;
+    int top = 0;
+    stack[top++] = pc;
+    while (top > 0) {
+        pc = stack[--top];
+        if (set_insert(re, pc)) continue;
+        const RegexInst *in = &d->prog[pc];
+        switch (in->op) {
+            case OP_RANGE:
+                list[(*len)++] = pc;
+                break;
+            case OP_MATCH:
+                *matched = 1;
+                if (d->cut) return 1;
+                break;
+            case OP_JMP:
+                stack[top++] = in->x;
+                break;
+            case OP_SPLIT:
+                stack[top++] = in->y;
+                stack[top++] = in->x;
+                break;
+            case OP_SAVE:
+                stack[top++] = pc + 1;
+                break;
+            case OP_BOL:
+                if (bol) stack[top++] = pc + 1;
+                break;
+            case OP_EOL:
+                if (eol) {
+                    stack[top++] = pc + 1;
+                } else {
+                    list[(*len)++] = pc;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+static size_t dfa_hash(const int *list, int len, int matched) {
+    size_t h = (size_t)2166136261u ^ (size_t)matched;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (size_t)list[i]) * (size_t)16777619u;
+    }
+    return h;
+}
+
+static void dfa_release(Dfa *d) {
+    free(d->trans);
+    free(d->match);
+    free(d->list_first);
+    free(d->list_len);
+    free(d->pcs);
+    free(d->hash);
+}
+
+/* 清空缓存，只保留死状态 */
+static void dfa_reset(Dfa *d) {
+    d->count = 1;
+    d->pcs_len = 0;
+    memset(d->hash, 0, sizeof(int) * d->hash_cap);
+    for (int i = 0; i < d->stride; i++) d->trans[i] = DFA_DEAD;
+    d->match[0] = 0;
+    d->list_first[0] = 0;
+    d->list_len[0] = 0;
+    d->start[0] = d->start[1] = -1;
+    d->bytes = 0;
+}
+
+static int dfa_init(Dfa *d, const RegexInst *prog, int start_pc, int cut, int stride) {
+    memset(d, 0, sizeof(*d));
+    d->prog = prog;
+    d->start_pc = start_pc;
+    d->cut = cut;
+    d->stride = stride;
+    d->cap = 16;
+    d->hash_cap = 64;
+    d->trans = (int*)malloc(sizeof(int) * (size_t)d->cap * (size_t)stride);
+    d->match = (unsigned char*)malloc((size_t)d->cap);
+    d->list_first = (int*)malloc(sizeof(int) * (size_t)d->cap);
+    d->list_len = (int*)malloc(sizeof(int) * (size_t)d->cap);
+    d->hash = (int*)malloc(sizeof(int) * d->hash_cap);
+    d->pcs_cap = 256;
+    d->pcs = (int*)malloc(sizeof(int) * d->pcs_cap);
+    if (!d->trans || !d->match || !d->list_first || !d->list_len || !d->hash || !d->pcs) return -1;
+    dfa_reset(d);
+    return 0;
+}
+
+static int dfa_grow_hash(Dfa *d) {
+    size_t cap = d->hash_cap * 2;
+    int *table = (int*)calloc(cap, sizeof(int));
+    if (table == NULL) return -1;
+    for (int s = 1; s < d->count; s++) {
+        size_t h = dfa_hash(d->pcs + d->list_first[s], d->list_len[s], d->match[s]) & (cap - 1);
+        while (table[h] != 0) h = (h + 1) & (cap - 1);
+        table[h] = s + 1;
+    }
+    free(d->hash);
+    d->hash = table;
+    d->hash_cap = cap;
+    return 0;
+}
+
+/*
+ * 查找或新建状态，返回状态号，内存不足返回 -1
+ * 缓存超限时先清空，*flushed 置 1（此前的状态号全部失效）
+ */
+static int dfa_intern(Dfa *d, const int *list, int len, int matched, int *flushed) {
+    if (len == 0 && !matched) return DFA_DEAD;
+
+    size_t h = dfa_hash(list, len, matched);
+    for (size_t i = h & (d->hash_cap - 1); d->hash[i] != 0; i = (i + 1) & (d->hash_cap - 1)) {
+        int s = d->hash[i] - 1;
+        if (d->match[s] == matched && d->list_len[s] == len &&
+            memcmp(d->pcs + d->list_first[s], list, sizeof(int) * (size_t)len) == 0) {
+            return s;
+        }
+    }
+
+    size_t cost = sizeof(int) * ((size_t)d->stride + (size_t)len + 3) + 1;
+    if (d->bytes + cost > REGEX_DFA_CACHE_BYTES && d->count > 1) {
+        dfa_reset(d);
+        *flushed = 1;
+    }
+
+    if (d->count == d->cap) {
+        int cap = d->cap * 2;
+        int *trans = (int*)realloc(d->trans, sizeof(int) * (size_t)cap * (size_t)d->stride);
+        if (trans == NULL) return -1;
+        d->trans = trans;
+        unsigned char *match = (unsigned char*)realloc(d->match, (size_t)cap);
+        if (match == NULL) return -1;
+        d->match = match;
+        int *first = (int*)realloc(d->list_first, sizeof(int) * (size_t)cap);
+        if (first == NULL) return -1;
+        d->list_first = first;
+        int *lens = (int*)realloc(d->list_len, sizeof(int) * (size_t)cap);
+        if (lens == NULL) return -1;
+        d->list_len = lens;
+        d->cap = cap;
+    }
+    if (d->pcs_len + (size_t)len > d->pcs_cap) {
+        size_t cap = d->pcs_cap;
+        while (cap < d->pcs_len + (size_t)len) cap *= 2;
+        int *pcs = (int*)realloc(d->pcs, sizeof(int) * cap);
+        if (pcs == NULL) return -1;
+        d->pcs = pcs;
+        d->pcs_cap = cap;
+    }
+    if ((size_t)d->count * 2 >= d->hash_cap && dfa_grow_hash(d) != 0) return -1;
+
+    int s = d->count++;
+    for (int i = 0; i < d->stride; i++) d->trans[(size_t)s * d->stride + i] = DFA_UNKNOWN;
+    d->match[s] = (unsigned char)matched;
+    d->list_first[s] = (int)d->pcs_len;
+    d->list_len[s] = len;
+    memcpy(d->pcs + d->pcs_len, list, sizeof(int) * (size_t)len);
+    d->pcs_len += (size_t)len;
+    d->bytes += cost;
+
+    size_t i = dfa_hash(list, len, matched) & (d->hash_cap - 1);
+    while (d->hash[i] != 0) i = (i + 1) & (d->hash_cap - 1);
+    d->hash[i] = s + 1;
+    return s;
+}
+
+static int dfa_encode(const Dfa *d, int state) {
+    return (int)(((size_t)state * d->stride) << 1) | d->match[state];
+}
+
+static int dfa_start(Regex *re, Dfa *d, int bol) {
+    if (d->start[bol] >= 0) return d->start[bol];
+    int len = 0;
+    int matched = 0;
+    int flushed = 0;
+    set_clear(re);
+    dfa_closure(re, d, d->start_pc, bol, 0, re->next_list, &len, &matched);
+    int s = dfa_intern(d, re->next_list, len, matched, &flushed);
+    if (s >= 0) d->start[bol] = s;
+    return s;
+}
+
+/*
+ * 计算 state 读入符号 sym（字节类，class_count 表示行尾）后的状态并缓存
+ * bol 为 1 表示行尾同时也是行首（空行），展开行尾之后遇到的行首断言同样成立；
+ * 这只发生在空行上，与一般的行尾转移不同，结果不缓存
+ */
+static int dfa_compute(Regex *re, Dfa *d, int state, int sym, int bol) {
+    int cur_len = d->list_len[state];
+    memcpy(re->cur_list, d->pcs + d->list_first[state], sizeof(int) * (size_t)cur_len);
+
+    int at_end = sym == re->class_count;
+    unsigned char b = at_end ? 0 : re->class_rep[sym];
+    int len = 0;
+    int matched = 0;
+    set_clear(re);
+    for (int i = 0; i < cur_len; i++) {
+        const RegexInst *in = &d->prog[re->cur_list[i]];
+        int cut = 0;
+        if (in->op == OP_RANGE) {
+            if (!at_end && b >= in->lo && b <= in->hi) {
+                cut = dfa_closure(re, d, re->cur_list[i] + 1, 0, 0, re->next_list, &len, &matched);
+            }
+        } else if (at_end) {
+            cut = dfa_closure(re, d, re->cur_list[i] + 1, bol, 1, re->next_list, &len, &matched);
+        }
+        if (cut) break;
+    }
+
+    int flushed = 0;
+    int next = dfa_intern(d, re->next_list, len, matched, &flushed);
+    if (next >= 0 && !flushed && !bol) d->trans[(size_t)state * d->stride + sym] = dfa_encode(d, next);
+    return next;
+}
+
+/* 行尾转移；bol 含义同 dfa_compute */
+static int dfa_end(Regex *re, Dfa *d, int state, int bol) {
+    if (bol) return dfa_compute(re, d, state, re->class_count, 1);
+    int entry = d->trans[(size_t)state * d->stride + re->class_count];
+    return entry != DFA_UNKNOWN ? (int)(DFA_ROW(entry) / (size_t)d->stride)
+                                : dfa_compute(re, d, state, re->class_count, 0);
+}
+
+/* 从行尾反向扫描，starts[i] 表示存在以 i 开头的匹配；返回是否存在任何匹配，内存不足返回 -1 */
+static int dfa_mark_starts(Regex *re, const unsigned char *text, size_t n) {
+    if (n + 1 > re->starts_cap) {
+        size_t cap = re->starts_cap ? re->starts_cap : 256;
+        while (cap < n + 1) cap *= 2;
+        unsigned char *grown = (unsigned char*)realloc(re->starts, cap);
+        if (grown == NULL) return -1;
+        re->starts = grown;
+        re->starts_cap = cap;
+    }
+
+    Dfa *d = &re->reverse;
+    int state = dfa_start(re, d, 1);
+    if (state < 0) return -1;
+    unsigned char *starts = re->starts;
+    const unsigned char *classes = re->byte_class;
+    int any = d->match[state];
+    size_t row = (size_t)state * d->stride;
+    starts[n] = (unsigned char)any;
+    for (size_t i = n; i-- > 0; ) {
+        int entry = d->trans[row + classes[text[i]]];
+        if (entry == DFA_UNKNOWN) {
+            int next = dfa_compute(re, d, (int)(row / (size_t)d->stride), classes[text[i]], 0);
+            if (next < 0) return -1;
+            entry = dfa_encode(d, next);
+        }
+        row = DFA_ROW(entry);
+        starts[i] = (unsigned char)DFA_MATCHED(entry);
+        any |= DFA_MATCHED(entry);
+    }
+    /* 反向扫描的终点是行首，空行上它同时也是起点所在的行尾 */
+    state = dfa_end(re, d, (int)(row / (size_t)d->stride), n == 0);
+    if (state < 0) return -1;
+    if (d->match[state]) {
+        starts[0] = 1;
+        any = 1;
+    }
+    return any;
+}
+
+/* 求起点为 start 的最左优先匹配的终点；没有匹配返回 0，找到返回 1，内存不足返回 -1 */
+static int dfa_match_end(Regex *re, const unsigned char *text, size_t n, size_t start, size_t *end) {
+    Dfa *d = &re->first;
+    int state = dfa_start(re, d, start == 0);
+    if (state < 0) return -1;
+    int found = d->match[state];
+    *end = start;
+
+    const unsigned char *classes = re->byte_class;
+    size_t row = (size_t)state * d->stride;
+    size_t i = start;
+    for (; i < n && row != DFA_DEAD; i++) {
+        int entry = d->trans[row + classes[text[i]]];
+        if (entry == DFA_UNKNOWN) {
+            int next = dfa_compute(re, d, (int)(row / (size_t)d->stride), classes[text[i]], 0);
+            if (next < 0) return -1;
+            entry = dfa_encode(d, next);
+        }
+        row = DFA_ROW(entry);
+        if (DFA_MATCHED(entry)) {
+            found = 1;
+            *end = i + 1;
+        }
+    }
+    state = (int)(row / (size_t)d->stride);
+    if (i == n && state != DFA_DEAD) {
+        state = dfa_end(re, d, state, n == 0);
+        if (state < 0) return -1;
+        if (d->match[state]) {
+            found = 1;
+            *end = n;
+        }
+    }
+    return found;
+}
+
+/* ========================== Pike VM（求分组位置） ========================== */
+
+/* 把 pc 及其空转移闭包加入第 k 个线程表，caps 为当前线程的分组位置 */
+static void pike_add(Regex *re, int k, int pc, size_t pos, size_t n) {
+    int *dense = re->pike_dense[k];
+    int *sparse = re->pike_sparse[k];
+    size_t *caps = re->caps;
+    int top = 0;
+
+    re->frame_pc[top] = pc;
+    re->frame_slot[top++] = -1;
+    while (top > 0) {
+        top--;
+        pc = re->frame_pc[top];
+        if (pc < 0) {
+            caps[re->frame_slot[top]] = re->frame_old[top];     /* 回溯时恢复分组位置 */
+            continue;
+        }
+        int i = sparse[pc];
+        if (i < re->pike_size[k] && dense[i] == pc) continue;
+        i = re->pike_size[k]++;
+        sparse[pc] = i;
+        dense[i] = pc;
+
+        const RegexInst *in = &re->fwd[pc];
+        switch (in->op) {
+            case OP_JMP:
+                re->frame_pc[top] = in->x;
+                re->frame_slot[top++] = -1;
+                break;
+            case OP_SPLIT:
+                re->frame_pc[top] = in->y;
+                re->frame_slot[top++] = -1;
+                re->frame_pc[top] = in->x;
+                re->frame_slot[top++] = -1;
+                break;
+            case OP_SAVE:
+                re->frame_pc[top] = -1;
+                re->frame_slot[top] = in->x;
+                re->frame_old[top++] = caps[in->x];
+                caps[in->x] = pos;
+                re->frame_pc[top] = pc + 1;
+                re->frame_slot[top++] = -1;
+                break;
+            case OP_BOL:
+                if (pos == 0) {
+                    re->frame_pc[top] = pc + 1;
+                    re->frame_slot[top++] = -1;
+                }
+                break;
+            case OP_EOL:
+                if (pos == n) {
+                    re->frame_pc[top] = pc + 1;
+                    re->frame_slot[top++] = -1;
+                }
+                break;
+            default:
+                memcpy(re->pike_slots[k] + (size_t)i * re->nslots, caps, sizeof(size_t) * (size_t)re->nslots);
+                break;
+        }
+    }
+}
+
+int regex_captures(Regex *re, const char *text, size_t n, size_t start, size_t *slots) {
+    if (re == NULL || text == NULL || slots == NULL || start > n) return -1;
+    const unsigned char *s = (const unsigned char*)text;
+    int found = 0;
+    int k = 0;
+
+    for (int i = 0; i < re->nslots; i++) re->caps[i] = (size_t)-1;
+    re->pike_size[0] = re->pike_size[1] = 0;
+    pike_add(re, k, PROGRAM_BODY, start, n);
+
+    for (size_t pos = start; re->pike_size[k] > 0; pos++) {
+        int nk = 1 - k;
+        re->pike_size[nk] = 0;
+        for (int i = 0; i < re->pike_size[k]; i++) {
+            const RegexInst *in = &re->fwd[re->pike_dense[k][i]];
+            const size_t *thread = re->pike_slots[k] + (size_t)i * re->nslots;
+            if (in->op == OP_MATCH) {
+                /* 优先级更低的线程不再考虑 */
+                memcpy(slots, thread, sizeof(size_t) * (size_t)re->nslots);
+                found = 1;
+                break;
+            }
+            if (pos < n && s[pos] >= in->lo && s[pos] <= in->hi) {
+                memcpy(re->caps, thread, sizeof(size_t) * (size_t)re->nslots);
+                pike_add(re, nk, re->pike_dense[k][i] + 1, pos + 1, n);
+            }
+        }
+        k = nk;
+        if (pos >= n) break;
+    }
+    return found ? 0 : -1;
+}
+
+/* ========================== 对外接口 ========================== */
+
+/* 字节类：所有 RANGE 指令的端点把 0~255 切成若干段，同一段内的字节转移完全相同 */
+static void build_byte_classes(Regex *re) {
+    unsigned char boundary[257];
+    memset(boundary, 0, sizeof(boundary));
+    const RegexInst *progs[2] = { re->fwd, re->rev };
+    int lens[2] = { re->fwd_len, re->rev_len };
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < lens[p]; i++) {
+            if (progs[p][i].op == OP_RANGE) {
+                boundary[progs[p][i].lo] = 1;
+                boundary[progs[p][i].hi + 1] = 1;
+            }
+        }
+    }
+    int c = 0;
+    for (int b = 0; b < 256; b++) {
+        if (b > 0 && boundary[b]) c++;
+        re->byte_class[b] = (unsigned char)c;
+        if (b == 0 || boundary[b]) re->class_rep[c] = (unsigned char)b;
+    }
+    re->class_count = c + 1;
+}
+
+Regex* regex_compile(const char *pattern, const char **error) {
+    const char *dummy;
+    if (error == NULL) error = &dummy;
+    *error = NULL;
+    if (pattern == NULL) {
+        *error = "模式为空";
+        return NULL;
+    }
+
+    Parser P;
+    memset(&P, 0, sizeof(P));
+    P.p = (const unsigned char*)pattern;
+    int root = parse_alt(&P);
+    if (root >= 0 && *P.p != '\0') {
+        P.error = "多余的 )";
+        root = -1;
+    }
+
+    Regex *re = NULL;
+    if (root >= 0) {
+        re = (Regex*)calloc(1, sizeof(Regex));
+        if (re == NULL) P.error = "内存不足";
+    }
+    if (re != NULL) {
+        re->groups = P.groups;
+        re->nslots = 2 * (P.groups + 1);
+        re->fwd = compile_program(&P, root, 0, &re->fwd_len, &P.error);
+        if (re->fwd != NULL) re->rev = compile_program(&P, root, 1, &re->rev_len, &P.error);
+        if (re->rev == NULL) {
+            regex_free(re);
+            re = NULL;
+        }
+    }
+    free(P.nodes);
+    free(P.ranges);
+    if (re == NULL) {
+        *error = P.error ? P.error : "内存不足";
+        return NULL;
+    }
+
+    build_byte_classes(re);
+    int stride = re->class_count + 1;
+    size_t len = (size_t)(re->fwd_len > re->rev_len ? re->fwd_len : re->rev_len);
+    int ok = dfa_init(&re->first, re->fwd, PROGRAM_BODY, 1, stride) == 0 &&
+             dfa_init(&re->reverse, re->rev, 0, 0, stride) == 0;
+
+    re->stack = (int*)malloc(sizeof(int) * (2 * len + 2));
+    re->set_dense = (int*)malloc(sizeof(int) * len);
+    re->set_sparse = (int*)calloc(len, sizeof(int));
+    re->cur_list = (int*)malloc(sizeof(int) * len);
+    re->next_list = (int*)malloc(sizeof(int) * len);
+    re->frame_pc = (int*)malloc(sizeof(int) * (2 * len + 2));
+    re->frame_slot = (int*)malloc(sizeof(int) * (2 * len + 2));
+    re->frame_old = (size_t*)malloc(sizeof(size_t) * (2 * len + 2));
+    re->caps = (size_t*)malloc(sizeof(size_t) * (size_t)re->nslots);
+    ok = ok && re->stack && re->set_dense && re->set_sparse && re->cur_list && re->next_list &&
+         re->frame_pc && re->frame_slot && re->frame_old && re->caps;
+    for (int k = 0; k < 2 && ok; k++) {
+        re->pike_dense[k] = (int*)malloc(sizeof(int) * len);
+        re->pike_sparse[k] = (int*)calloc(len, sizeof(int));
+        re->pike_slots[k] = (size_t*)malloc(sizeof(size_t) * len * (size_t)re->nslots);
+        ok = re->pike_dense[k] && re->pike_sparse[k] && re->pike_slots[k];
+    }
+    if (!ok) {
+        regex_free(re);
+        *error = "内存不足";
+        return NULL;
+    }
+    return re;
+}
+
+void regex_free(Regex *re) {
+    if (re == NULL) return;
+    free(re->fwd);
+    free(re->rev);
+    dfa_release(&re->first);
+    dfa_release(&re->reverse);
+    free(re->stack);
+    free(re->set_dense);
+    free(re->set_sparse);
+    free(re->cur_list);
+    free(re->next_list);
+    free(re->starts);
+    for (int k = 0; k < 2; k++) {
+        free(re->pike_dense[k]);
+        free(re->pike_sparse[k]);
+        free(re->pike_slots[k]);
+    }
+    free(re->frame_pc);
+    free(re->frame_slot);
+    free(re->frame_old);
+    free(re->caps);
+    free(re);
+}
+
+int regex_group_count(const Regex *re) {
+    return re ? re->groups : 0;
+}
+
+/* 空匹配之后前进一个 UTF-8 字符 */
+static size_t step_char(const unsigned char *text, size_t n, size_t pos) {
+    unsigned char c = text[pos];
+    size_t len = c < 0xC0 ? 1 : (c < 0xE0 ? 2 : (c < 0xF0 ? 3 : 4));
+    return pos + len < n ? pos + len : n;
+}
+
+int regex_scan_line(Regex *re, const char *text, size_t n, RegexMatchFunc func, void *ctx) {
+    if (re == NULL || (text == NULL && n > 0)) return -1;
+    const unsigned char *s = (const unsigned char*)text;
+
+    int rc = dfa_mark_starts(re, s, n);
+    if (rc <= 0) return rc;
+
+    int count = 0;
+    size_t pos = 0;
+    size_t prev_end = (size_t)-1;
+    while (pos <= n) {
+        size_t start = pos;
+        while (start <= n && !re->starts[start]) start++;
+        if (start > n) break;
+
+        size_t end;
+        rc = dfa_match_end(re, s, n, start, &end);
+        if (rc < 0) return -1;
+        if (rc == 0 || (end == start && start == prev_end)) {
+            if (start >= n) break;
+            pos = step_char(s, n, start);
+            continue;
+        }
+
+        count++;
+        if (func != NULL && func(ctx, start, end)) break;
+        prev_end = end;
+        if (end > start) {
+            pos = end;
+        } else {
+            if (start >= n) break;
+            pos = step_char(s, n, start);
+        }
+    }
+    return count;
+}
+
+void regex_cache_stats(const Regex *re, int *states, size_t *bytes) {
+    int count = 0;
+    size_t total = 0;
+    if (re != NULL) {
+        const Dfa *dfas[2] = { &re->first, &re->reverse };
+        for (int i = 0; i < 2; i++) {
+            count += dfas[i]->count;
+            total += dfas[i]->bytes;
+        }
+    }
+    if (states) *states = count;
+    if (bytes) *bytes = total;
+}
@@ -0,0 +1,57 @@
+/*
+ * 简易文本编辑器 - 正则表达式引擎
+ * 模式先编译成字节级 NFA，查找时按需构造 DFA 状态并缓存转移，
+ * 扫描只查表，时间与文本长度成线性；分组位置由 Pike VM 在已确定的匹配上单独求出
+ */
+
+#ifndef TEXT_REGEX_H
+#define TEXT_REGEX_H
+
+#include <stddef.h>
+
+#define REGEX_MAX_GROUPS        9           /* 捕获分组上限（$1 ~ $9） */
+#define REGEX_MAX_PROGRAM       20000       /* 编译后指令数上限 */
+#define REGEX_MAX_REPEAT        1000        /* {n,m} 计数上限 */
+#ifndef REGEX_DFA_CACHE_BYTES
+#define REGEX_DFA_CACHE_BYTES   (4u << 20)  /* 每个 DFA 的状态缓存上限，超出后清空重建 */
+#endif
+
+/*
+ * 支持的语法（按 UTF-8 字符匹配）：
+ *   字面字符、.、[...] / [^...]（可含中文范围）、\d \w \s \D \W \S、
+ *   \t \n \r \f \v 及转义的元字符、* + ? {n} {n,} {n,m} 及其非贪婪形式、
+ *   | 、( ) 捕获分组、(?: ) 非捕获分组、^ $（行首/行尾）
+ * 匹配语义与 RE2 相同：取最左的匹配，同一起点按分支和量词的优先级选择（leftmost-first）；
+ * 重复的一轮若没有消耗字符则直接丢弃，而 Perl 会在这一轮结束循环，
+ * 因此循环体可以匹配空串时结果可能与 Perl 不同，如 (x*?|a)* 在 "a1" 上得到 [0,1) 而不是 [0,0)
+ */
+typedef struct Regex Regex;
+
+/* 每找到一处匹配 [start, end) 调用一次，返回非 0 时停止扫描 */
+typedef int (*RegexMatchFunc)(void *ctx, size_t start, size_t end);
+
+/* 编译模式，失败返回 NULL，error（可为 NULL）指向静态错误说明 */
+Regex* regex_compile(const char *pattern, const char **error);
+void regex_free(Regex *re);
+
+/* 捕获分组数（不含整体匹配） */
+int regex_group_count(const Regex *re);
+
+/*
+ * 依次找出一行 text[0, n) 中所有不重叠的匹配；空匹配之后从下一个字符继续，
+ * 紧跟在上一处匹配之后的空匹配不报告
+ * func 为 NULL 时只计数；返回报告的匹配数，内存不足返回 -1
+ */
+int regex_scan_line(Regex *re, const char *text, size_t n, RegexMatchFunc func, void *ctx);
+
+/*
+ * 求起点为 start 的匹配的分组位置（只能在 regex_scan_line 报告的起点上调用）
+ * slots 至少 2 * (regex_group_count + 1) 项，未参与匹配的分组为 (size_t)-1
+ * 成功返回 0，没有匹配返回 -1
+ */
+int regex_captures(Regex *re, const char *text, size_t n, size_t start, size_t *slots);
+
+/* 目前缓存的 DFA 状态数和占用的字节数（正向、反向 DFA 合计） */
+void regex_cache_stats(const Regex *re, int *states, size_t *bytes);
+
+#endif /* TEXT_REGEX_H */
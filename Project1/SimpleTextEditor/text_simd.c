@@ -0,0 +1,862 @@
+/*
+ * 简易文本编辑器 - SIMD 文本扫描内核实现
+ */
+
+#include <string.h>
+#include "text_simd.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXT_SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* GCC/Clang 需要为单个函数打开 AVX2 代码生成，MSVC 无需额外标记 */
+#if defined(TEXT_SIMD_X86) && !defined(_MSC_VER)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+/* ========================== CPU 检测 ========================== */
+
+static int g_detected_level = -1;
+static SimdLevel g_max_level = SIMD_LEVEL_AVX2;
+
+static SimdLevel detect_level(void) {
+#ifdef TEXT_SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    int has_sse2 = (info[3] & (1 << 26)) != 0;
+    int has_osxsave = (info[2] & (1 << 27)) != 0;
+    int has_avx = (info[2] & (1 << 28)) != 0;
+    int has_avx2 = 0;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    /* 操作系统必须保存 YMM 寄存器状态 */
+    if (has_osxsave && has_avx && has_avx2 && (_xgetbv(0) & 0x6) == 0x6) {
+        return SIMD_LEVEL_AVX2;
+    }
+    return has_sse2 ? SIMD_LEVEL_SSE2 : SIMD_LEVEL_SCALAR;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_LEVEL_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_LEVEL_SSE2;
+    return SIMD_LEVEL_SCALAR;
+#endif
+#else
+    return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+SimdLevel simd_level(void) {
+    if (g_detected_level < 0) {
+        g_detected_level = (int)detect_level();
+    }
+    SimdLevel level = (SimdLevel)g_detected_level;
+    return level < g_max_level ? level : g_max_level;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SIMD_LEVEL_AVX2: return "AVX2";
+        case SIMD_LEVEL_SSE2: return "SSE2";
+        default:              return "scalar";
+    }
+}
+
+void simd_set_max_level(SimdLevel level) {
+    g_max_level = level;
+}
+
+/* 统计 1 的个数（仅在已确认支持 AVX2 的路径中使用硬件指令） */
+SIMD_TARGET_AVX2
+static int popcount32(unsigned int mask) {
+#ifdef _MSC_VER
+    return (int)__popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+/* 取最低位 1 的下标 */
+static int lowest_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (int)idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* ========================== 字节计数 ========================== */
+
+static size_t count_byte_scalar(const char *data, size_t size, char target) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += (data[i] == target);
+    }
+    return count;
+}
+
+#ifdef TEXT_SIMD_X86
+
+/*
+ * 比较结果为 0xFF（即 -1），用减法累加到 8 位计数器中；
+ * 每 255 轮用 SAD 把计数器横向求和，避免溢出
+ */
+static size_t count_byte_sse2(const char *data, size_t size, char target) {
+    const __m128i needle = _mm_set1_epi8(target);
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0;
+    size_t i = 0;
+
+    while (size - i >= 16) {
+        __m128i acc = zero;
+        for (int round = 0; round < 255 && size - i >= 16; round++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+        }
+        unsigned long long lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, _mm_sad_epu8(acc, zero));
+        count += (size_t)(lanes[0] + lanes[1]);
+    }
+    return count + count_byte_scalar(data + i, size - i, target);
+}
+
+SIMD_TARGET_AVX2
+static size_t count_byte_avx2(const char *data, size_t size, char target) {
+    const __m256i needle = _mm256_set1_epi8(target);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t count = 0;
+    size_t i = 0;
+
+    while (size - i >= 32) {
+        __m256i acc = zero;
+        for (int round = 0; round < 255 && size - i >= 32; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+        unsigned long long lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, _mm256_sad_epu8(acc, zero));
+        count += (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+    return count + count_byte_scalar(data + i, size - i, target);
+}
+
+#endif
+
+size_t simd_count_byte(const char *data, size_t size, char target) {
+    if (data == NULL || size == 0) return 0;
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: return count_byte_avx2(data, size, target);
+        case SIMD_LEVEL_SSE2: return count_byte_sse2(data, size, target);
+        default: break;
+    }
+#endif
+    return count_byte_scalar(data, size, target);
+}
+
+/* ========================== 字节定位 ========================== */
+
+static size_t find_byte_scalar(const char *data, size_t size, char target, size_t start,
+                               size_t *positions, size_t max_positions, size_t found,
+                               size_t *consumed) {
+    size_t i = start;
+    for (; i < size && found < max_positions; i++) {
+        if (data[i] == target) {
+            positions[found++] = i;
+        }
+    }
+    *consumed = i;
+    return found;
+}
+
+#ifdef TEXT_SIMD_X86
+
+static size_t find_byte_sse2(const char *data, size_t size, char target,
+                             size_t *positions, size_t max_positions, size_t *consumed) {
+    const __m128i needle = _mm_set1_epi8(target);
+    size_t found = 0;
+    size_t i = 0;
+
+    /* 每块最多 16 个命中，剩余空间不足时停在块边界 */
+    for (; size - i >= 16 && max_positions - found >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        while (mask) {
+            positions[found++] = i + (size_t)lowest_bit(mask);
+            mask &= mask - 1;
+        }
+    }
+    if (size - i >= 16) {
+        *consumed = i;
+        return found;
+    }
+    return find_byte_scalar(data, size, target, i, positions, max_positions, found, consumed);
+}
+
+SIMD_TARGET_AVX2
+static size_t find_byte_avx2(const char *data, size_t size, char target,
+                             size_t *positions, size_t max_positions, size_t *consumed) {
+    const __m256i needle = _mm256_set1_epi8(target);
+    size_t found = 0;
+    size_t i = 0;
+
+    for (; size - i >= 32 && max_positions - found >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        while (mask) {
+            positions[found++] = i + (size_t)lowest_bit(mask);
+            mask &= mask - 1;
+        }
+    }
+    if (size - i >= 32) {
+        *consumed = i;
+        return found;
+    }
+    return find_byte_scalar(data, size, target, i, positions, max_positions, found, consumed);
+}
+
+#endif
+
+size_t simd_find_byte(const char *data, size_t size, char target,
+                      size_t *positions, size_t max_positions, size_t *consumed) {
+    size_t dummy;
+    if (consumed == NULL) consumed = &dummy;
+    *consumed = 0;
+    if (data == NULL || size == 0 || positions == NULL || max_positions == 0) {
+        *consumed = (positions == NULL || max_positions == 0) ? 0 : size;
+        return 0;
+    }
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2:
+            return find_byte_avx2(data, size, target, positions, max_positions, consumed);
+        case SIMD_LEVEL_SSE2:
+            return find_byte_sse2(data, size, target, positions, max_positions, consumed);
+        default:
+            break;
+    }
+#endif
+    return find_byte_scalar(data, size, target, 0, positions, max_positions, 0, consumed);
+}
+
+/* ========================== 子串定位 ========================== */
+
+static size_t find_pattern_scalar(const char *data, size_t size, const char *pattern, size_t m) {
+    if (m > size) return size;
+    const char *last = data + (size - m);
+    for (const char *p = data; p <= last; p++) {
+        p = (const char*)memchr(p, (unsigned char)pattern[0], (size_t)(last - p) + 1);
+        if (p == NULL) break;
+        if (memcmp(p + 1, pattern + 1, m - 1) == 0) return (size_t)(p - data);
+    }
+    return size;
+}
+
+#ifdef TEXT_SIMD_X86
+
+/*
+ * 一次取 16 个候选起点：first 比较 data[i..i+15]，last 比较 data[i+m-1..i+m+14]，
+ * 与运算后每个置位的候选只需校验中间 m-2 个字节
+ */
+static size_t find_pattern_sse2(const char *data, size_t size, const char *pattern, size_t m) {
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= size; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(data + i + m - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t pos = i + (size_t)lowest_bit(mask);
+            if (m <= 2 || memcmp(data + pos + 1, pattern + 1, m - 2) == 0) return pos;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_pattern_scalar(data + i, size - i, pattern, m);
+    return rest == size - i ? size : i + rest;
+}
+
+SIMD_TARGET_AVX2
+static size_t find_pattern_avx2(const char *data, size_t size, const char *pattern, size_t m) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= size; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*)(data + i + m - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t pos = i + (size_t)lowest_bit(mask);
+            if (m <= 2 || memcmp(data + pos + 1, pattern + 1, m - 2) == 0) return pos;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_pattern_scalar(data + i, size - i, pattern, m);
+    return rest == size - i ? size : i + rest;
+}
+
+#endif
+
+size_t simd_find_pattern(const char *data, size_t size, const char *pattern, size_t m) {
+    if (data == NULL || pattern == NULL || m == 0 || m > size) return size;
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: return find_pattern_avx2(data, size, pattern, m);
+        case SIMD_LEVEL_SSE2: return find_pattern_sse2(data, size, pattern, m);
+        default: break;
+    }
+#endif
+    return find_pattern_scalar(data, size, pattern, m);
+}
+
+/* ========================== 忽略大小写的子串定位 ========================== */
+
+/*
+ * 模式已由调用方折叠为小写，文本逐字节现场折叠后比较：
+ * ASCII 大写字母 | 0x20 即为小写；全角大写 U+FF21..U+FF3A 编码为 EF BC A1..BA，
+ * 对应的小写 U+FF41..U+FF5A 编码为 EF BD 81..9A，两者长度相同，匹配仍按字节对齐
+ */
+static int fold_equal(const unsigned char *t, const unsigned char *p, size_t m) {
+    for (size_t j = 0; j < m; j++) {
+        unsigned char a = t[j], b = p[j];
+        if (a == b) continue;
+        if ((unsigned char)(a - 'A') < 26 && (a | 0x20) == b) continue;
+        if (a == 0xBC && b == 0xBD && j > 0 && p[j - 1] == 0xEF && j + 1 < m &&
+            (unsigned char)(p[j + 1] - 0x81) < 26 && t[j + 1] == (unsigned char)(p[j + 1] + 0x20)) {
+            j++;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * 向量过滤用的首尾字节：可折叠的字节在比较前先 | 0x20，
+ * 'a' 只与 'A'/'a' 相等，全角小写末字节 81..9A 只与自身和对应的大写末字节 A1..BA 相等
+ */
+typedef struct {
+    unsigned char first, first_mask;
+    unsigned char last, last_mask;
+} FoldProbe;
+
+static void fold_probe_init(const unsigned char *p, size_t m, FoldProbe *probe) {
+    unsigned char a = p[0], z = p[m - 1];
+    probe->first_mask = (unsigned char)(a - 'a') < 26 ? 0x20 : 0;
+    probe->first = a;
+    probe->last_mask = 0;
+    if ((unsigned char)(z - 'a') < 26) {
+        probe->last_mask = 0x20;
+    } else if (m >= 3 && p[m - 3] == 0xEF && p[m - 2] == 0xBD && (unsigned char)(z - 0x81) < 26) {
+        probe->last_mask = 0x20;
+    }
+    probe->last = (unsigned char)(z | probe->last_mask);
+}
+
+static size_t find_nocase_scalar(const char *data, size_t size, const char *pattern, size_t m,
+                                 const FoldProbe *probe) {
+    if (m > size) return size;
+    const unsigned char *t = (const unsigned char*)data;
+    const unsigned char *p = (const unsigned char*)pattern;
+    for (size_t i = 0; i + m <= size; i++) {
+        if ((t[i] | probe->first_mask) != probe->first) continue;
+        if ((t[i + m - 1] | probe->last_mask) != probe->last) continue;
+        if (fold_equal(t + i, p, m)) return i;
+    }
+    return size;
+}
+
+#ifdef TEXT_SIMD_X86
+
+static size_t find_nocase_sse2(const char *data, size_t size, const char *pattern, size_t m,
+                               const FoldProbe *probe) {
+    const __m128i first = _mm_set1_epi8((char)probe->first);
+    const __m128i first_mask = _mm_set1_epi8((char)probe->first_mask);
+    const __m128i last = _mm_set1_epi8((char)probe->last);
+    const __m128i last_mask = _mm_set1_epi8((char)probe->last_mask);
+    const unsigned char *p = (const unsigned char*)pattern;
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= size; i += 16) {
+        __m128i block_first = _mm_or_si128(_mm_loadu_si128((const __m128i*)(data + i)), first_mask);
+        __m128i block_last = _mm_or_si128(_mm_loadu_si128((const __m128i*)(data + i + m - 1)), last_mask);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t pos = i + (size_t)lowest_bit(mask);
+            if (fold_equal((const unsigned char*)data + pos, p, m)) return pos;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_nocase_scalar(data + i, size - i, pattern, m, probe);
+    return rest == size - i ? size : i + rest;
+}
+
+SIMD_TARGET_AVX2
+static size_t find_nocase_avx2(const char *data, size_t size, const char *pattern, size_t m,
+                               const FoldProbe *probe) {
+    const __m256i first = _mm256_set1_epi8((char)probe->first);
+    const __m256i first_mask = _mm256_set1_epi8((char)probe->first_mask);
+    const __m256i last = _mm256_set1_epi8((char)probe->last);
+    const __m256i last_mask = _mm256_set1_epi8((char)probe->last_mask);
+    const unsigned char *p = (const unsigned char*)pattern;
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= size; i += 32) {
+        __m256i block_first = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(data + i)), first_mask);
+        __m256i block_last = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(data + i + m - 1)), last_mask);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t pos = i + (size_t)lowest_bit(mask);
+            if (fold_equal((const unsigned char*)data + pos, p, m)) {
+                _mm256_zeroupper();
+                return pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+    /*
+     * 行通常较短，剩余部分先用 16 字节一块处理，避免逐字节比较占大头。
+     * GCC 在调用同文件的静态函数前后不一定插入 vzeroupper，这里显式清空 YMM 高位，
+     * 免得之后的每条 SSE 指令都付出状态切换的代价
+     */
+    _mm256_zeroupper();
+    size_t rest = find_nocase_sse2(data + i, size - i, pattern, m, probe);
+    return rest == size - i ? size : i + rest;
+}
+
+#endif
+
+size_t simd_find_pattern_nocase(const char *data, size_t size, const char *pattern, size_t m) {
+    if (data == NULL || pattern == NULL || m == 0 || m > size) return size;
+    FoldProbe probe;
+    fold_probe_init((const unsigned char*)pattern, m, &probe);
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: return find_nocase_avx2(data, size, pattern, m, &probe);
+        case SIMD_LEVEL_SSE2: return find_nocase_sse2(data, size, pattern, m, &probe);
+        default: break;
+    }
+#endif
+    return find_nocase_scalar(data, size, pattern, m, &probe);
+}
+
+/* ========================== ASCII 字符分类 ========================== */
+
+#ifdef TEXT_SIMD_X86
+
+/* 8 位计数器横向求和 */
+static size_t sum_bytes_sse2(__m128i acc) {
+    unsigned long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_sad_epu8(acc, _mm_setzero_si128()));
+    return (size_t)(lanes[0] + lanes[1]);
+}
+
+SIMD_TARGET_AVX2
+static size_t sum_bytes_avx2(__m256i acc) {
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+/* 末尾不足一块时，从 tail_mask + 剩余字节数处取掩码，只保留重叠加载中尚未统计的字节 */
+static const signed char g_tail_mask[64] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+ * ASCII 字节均为非负的有符号数，各类别用区间比较得到掩码：
+ * 字母先 | 0x20 折叠大小写；标点 = 可见字符中去掉字母和数字。
+ * 被掩码清零的字节是 NUL，不属于任何一类
+ */
+typedef struct {
+    __m128i letters, digits, spaces, punct;
+} AsciiAccSse2;
+
+static void classify_block_sse2(__m128i v, AsciiAccSse2 *acc) {
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    __m128i lower = _mm_or_si128(v, case_bit);
+    __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+    __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                     _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+    __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    __m128i is_print = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('!' - 1)),
+                                     _mm_cmpgt_epi8(_mm_set1_epi8('~' + 1), v));
+    __m128i is_punct = _mm_andnot_si128(_mm_or_si128(is_letter, is_digit), is_print);
+    acc->letters = _mm_sub_epi8(acc->letters, is_letter);
+    acc->digits = _mm_sub_epi8(acc->digits, is_digit);
+    acc->spaces = _mm_sub_epi8(acc->spaces, is_space);
+    acc->punct = _mm_sub_epi8(acc->punct, is_punct);
+}
+
+static void flush_acc_sse2(AsciiAccSse2 *acc, AsciiClassCounts *counts) {
+    counts->letters += sum_bytes_sse2(acc->letters);
+    counts->digits += sum_bytes_sse2(acc->digits);
+    counts->spaces += sum_bytes_sse2(acc->spaces);
+    counts->punctuation += sum_bytes_sse2(acc->punct);
+    acc->letters = acc->digits = acc->spaces = acc->punct = _mm_setzero_si128();
+}
+
+static size_t classify_ascii_sse2(const char *data, size_t size, AsciiClassCounts *counts) {
+    AsciiAccSse2 acc;
+    size_t i = 0;
+    if (size < 16) return 0;
+
+    acc.letters = acc.digits = acc.spaces = acc.punct = _mm_setzero_si128();
+    while (size - i >= 16) {
+        for (int round = 0; round < 255 && size - i >= 16; round++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            if (_mm_movemask_epi8(v) != 0) {
+                flush_acc_sse2(&acc, counts);
+                return i;
+            }
+            classify_block_sse2(v, &acc);
+        }
+        flush_acc_sse2(&acc, counts);
+    }
+    if (i < size) {
+        /* 与前一块重叠加载最后 16 字节，屏蔽已统计的部分 */
+        __m128i mask = _mm_loadu_si128((const __m128i*)(g_tail_mask + 32 - 16 + (size - i)));
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + size - 16)), mask);
+        if (_mm_movemask_epi8(v) == 0) {
+            classify_block_sse2(v, &acc);
+            flush_acc_sse2(&acc, counts);
+            i = size;
+        }
+    }
+    return i;
+}
+
+typedef struct {
+    __m256i letters, digits, spaces, punct;
+} AsciiAccAvx2;
+
+SIMD_TARGET_AVX2
+static void classify_block_avx2(__m256i v, AsciiAccAvx2 *acc) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    __m256i lower = _mm256_or_si256(v, case_bit);
+    __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i is_space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    __m256i is_print = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('!' - 1)),
+                                        _mm256_cmpgt_epi8(_mm256_set1_epi8('~' + 1), v));
+    __m256i is_punct = _mm256_andnot_si256(_mm256_or_si256(is_letter, is_digit), is_print);
+    acc->letters = _mm256_sub_epi8(acc->letters, is_letter);
+    acc->digits = _mm256_sub_epi8(acc->digits, is_digit);
+    acc->spaces = _mm256_sub_epi8(acc->spaces, is_space);
+    acc->punct = _mm256_sub_epi8(acc->punct, is_punct);
+}
+
+SIMD_TARGET_AVX2
+static void flush_acc_avx2(AsciiAccAvx2 *acc, AsciiClassCounts *counts) {
+    counts->letters += sum_bytes_avx2(acc->letters);
+    counts->digits += sum_bytes_avx2(acc->digits);
+    counts->spaces += sum_bytes_avx2(acc->spaces);
+    counts->punctuation += sum_bytes_avx2(acc->punct);
+    acc->letters = acc->digits = acc->spaces = acc->punct = _mm256_setzero_si256();
+}
+
+SIMD_TARGET_AVX2
+static size_t classify_ascii_avx2(const char *data, size_t size, AsciiClassCounts *counts) {
+    AsciiAccAvx2 acc;
+    size_t i = 0;
+    if (size < 32) return 0;
+
+    acc.letters = acc.digits = acc.spaces = acc.punct = _mm256_setzero_si256();
+    while (size - i >= 32) {
+        for (int round = 0; round < 255 && size - i >= 32; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            if (_mm256_movemask_epi8(v) != 0) {
+                flush_acc_avx2(&acc, counts);
+                return i;
+            }
+            classify_block_avx2(v, &acc);
+        }
+        flush_acc_avx2(&acc, counts);
+    }
+    if (i < size) {
+        /* 与前一块重叠加载最后 32 字节，屏蔽已统计的部分 */
+        __m256i mask = _mm256_loadu_si256((const __m256i*)(g_tail_mask + (size - i)));
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(data + size - 32)), mask);
+        if (_mm256_movemask_epi8(v) == 0) {
+            classify_block_avx2(v, &acc);
+            flush_acc_avx2(&acc, counts);
+            i = size;
+        }
+    }
+    return i;
+}
+
+#endif
+
+size_t simd_classify_ascii(const char *data, size_t size, AsciiClassCounts *counts) {
+    if (data == NULL || counts == NULL) return 0;
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: return classify_ascii_avx2(data, size, counts);
+        case SIMD_LEVEL_SSE2: return classify_ascii_sse2(data, size, counts);
+        default: break;
+    }
+#endif
+    (void)size;
+    return 0;
+}
+
+/* ========================== UTF-8 计数与校验 ========================== */
+
+/*
+ * 校验从 p 开始的一个 UTF-8 序列，返回其字节数，非法时返回 0
+ */
+static size_t utf8_sequence_length(const unsigned char *p, size_t remain) {
+    unsigned char c = p[0];
+    if (c < 0x80) return 1;
+    if (c >= 0xC2 && c <= 0xDF) {
+        return (remain >= 2 && (p[1] & 0xC0) == 0x80) ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        if (remain < 3) return 0;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c == 0xE0) lo = 0xA0;       /* 超长编码 */
+        if (c == 0xED) hi = 0x9F;       /* UTF-16 代理区 */
+        if (p[1] < lo || p[1] > hi || (p[2] & 0xC0) != 0x80) return 0;
+        return 3;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        if (remain < 4) return 0;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c == 0xF0) lo = 0x90;       /* 超长编码 */
+        if (c == 0xF4) hi = 0x8F;       /* 超过 U+10FFFF */
+        if (p[1] < lo || p[1] > hi || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+static size_t count_non_continuation(const char *data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += ((unsigned char)data[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+static size_t utf8_count_scalar(const char *data, size_t size, int *valid) {
+    const unsigned char *p = (const unsigned char*)data;
+    size_t count = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t len = utf8_sequence_length(p + i, size - i);
+        if (len == 0) {
+            *valid = 0;
+            return count + count_non_continuation(data + i, size - i);
+        }
+        i += len;
+        count++;
+    }
+    *valid = 1;
+    return count;
+}
+
+#ifdef TEXT_SIMD_X86
+
+/* SSE2 没有字节查表指令：整块 ASCII 一次跳过 16 字节，其余按序列标量校验 */
+static size_t utf8_count_sse2(const char *data, size_t size, int *valid) {
+    const unsigned char *p = (const unsigned char*)data;
+    size_t count = 0;
+    size_t i = 0;
+    while (i < size) {
+        if (size - i >= 16 &&
+            _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i))) == 0) {
+            i += 16;
+            count += 16;
+            continue;
+        }
+        size_t len = utf8_sequence_length(p + i, size - i);
+        if (len == 0) {
+            *valid = 0;
+            return count + count_non_continuation(data + i, size - i);
+        }
+        i += len;
+        count++;
+    }
+    *valid = 1;
+    return count;
+}
+
+/*
+ * AVX2 查表校验（Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"）
+ * 用前一字节的高/低半字节和当前字节的高半字节各查一次表，三者按位与得到
+ * 两字节组合的错误类别；再与“必须是第 3/4 个续字节”的位置异或，捕获长度错误
+ */
+#define UTF8_TOO_SHORT      0x01
+#define UTF8_TOO_LONG       0x02
+#define UTF8_OVERLONG_3     0x04
+#define UTF8_TOO_LARGE      0x08
+#define UTF8_SURROGATE      0x10
+#define UTF8_OVERLONG_2     0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4     0x40
+#define UTF8_TWO_CONTS      0x80
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    _mm256_setr_epi8((char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), (char)(g), (char)(h), \
+                     (char)(i), (char)(j), (char)(k), (char)(l), (char)(m), (char)(n), (char)(o), (char)(p), \
+                     (char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), (char)(g), (char)(h), \
+                     (char)(i), (char)(j), (char)(k), (char)(l), (char)(m), (char)(n), (char)(o), (char)(p))
+
+/* 取 input 之前第 n 个字节组成的向量（跨 128 位通道） */
+#define UTF8_PREV(input, prev_input, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev_input), (input), 0x21), 16 - (n))
+
+SIMD_TARGET_AVX2
+static __m256i utf8_check_block_avx2(__m256i input, __m256i prev_input) {
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    const __m256i byte_1_high_table = UTF8_TABLE(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m256i byte_1_low_table = UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high_table = UTF8_TABLE(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+    __m256i prev1 = UTF8_PREV(input, prev_input, 1);
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table,
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, low_nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table,
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    /* 三/四字节序列的第 3、4 字节必须是续字节 */
+    __m256i prev2 = UTF8_PREV(input, prev_input, 2);
+    __m256i prev3 = UTF8_PREV(input, prev_input, 3);
+    __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_be_cont = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                                            _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_be_cont, special);
+}
+
+/* 块末尾还缺后续字节的多字节序列 */
+SIMD_TARGET_AVX2
+static __m256i utf8_incomplete_avx2(__m256i input) {
+    const __m256i max_value = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm256_subs_epu8(input, max_value);
+}
+
+SIMD_TARGET_AVX2
+static size_t utf8_count_avx2(const char *data, size_t size, int *valid) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i cont_limit = _mm256_set1_epi8(-64);  /* 有符号比较：续字节 < -64 */
+    __m256i error = zero;
+    __m256i prev_input = zero;
+    __m256i prev_incomplete = zero;
+    size_t count = 0;
+    size_t i = 0;
+    unsigned char tail[32];
+
+    while (i < size) {
+        __m256i input;
+        if (size - i >= 32) {
+            input = _mm256_loadu_si256((const __m256i*)(data + i));
+        } else {
+            /* 末尾不足一块时补 0（ASCII），补齐部分不计数 */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data + i, size - i);
+            input = _mm256_loadu_si256((const __m256i*)tail);
+        }
+        size_t block = size - i >= 32 ? 32 : size - i;
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            /* 纯 ASCII 块：只需确认上一块没有未完成的序列 */
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = zero;
+            count += block;
+        } else {
+            error = _mm256_or_si256(error, utf8_check_block_avx2(input, prev_input));
+            prev_incomplete = utf8_incomplete_avx2(input);
+            unsigned int cont = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(cont_limit, input));
+            count += 32 - (size_t)popcount32(cont) - (32 - block);
+        }
+        prev_input = input;
+        i += block;
+    }
+    /* 文件末尾不允许残缺序列 */
+    error = _mm256_or_si256(error, prev_incomplete);
+
+    *valid = _mm256_testz_si256(error, error);
+    return count;
+}
+
+#endif
+
+size_t simd_utf8_count(const char *data, size_t size, int *valid) {
+    int dummy;
+    if (valid == NULL) valid = &dummy;
+    *valid = 1;
+    if (data == NULL || size == 0) return 0;
+#ifdef TEXT_SIMD_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: return utf8_count_avx2(data, size, valid);
+        case SIMD_LEVEL_SSE2: return utf8_count_sse2(data, size, valid);
+        default: break;
+    }
+#endif
+    return utf8_count_scalar(data, size, valid);
+}
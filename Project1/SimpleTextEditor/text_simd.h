@@ -0,0 +1,69 @@
+/*
+ * 简易文本编辑器 - SIMD 文本扫描内核
+ * 运行时检测 CPU 指令集（AVX2 / SSE2），不支持时回退到标量实现
+ */
+
+#ifndef TEXT_SIMD_H
+#define TEXT_SIMD_H
+
+#include <stddef.h>
+
+/* 指令集级别 */
+typedef enum {
+    SIMD_LEVEL_SCALAR = 0,  /* 标量回退 */
+    SIMD_LEVEL_SSE2,        /* 16 字节/次 */
+    SIMD_LEVEL_AVX2         /* 32 字节/次 */
+} SimdLevel;
+
+/* 当前使用的指令集级别（首次调用时检测） */
+SimdLevel simd_level(void);
+const char* simd_level_name(SimdLevel level);
+
+/* 强制使用不高于 level 的指令集，便于对比测试；传入 SIMD_LEVEL_AVX2 恢复自动检测 */
+void simd_set_max_level(SimdLevel level);
+
+/* 统计 data[0, size) 中字节 target 出现的次数 */
+size_t simd_count_byte(const char *data, size_t size, char target);
+
+/*
+ * 查找字节 target 的位置，最多写入 max_positions 个偏移（max_positions 至少为 64）
+ * 返回写入个数；*consumed 返回已完整扫描的字节数，下一次从 data + *consumed 继续
+ */
+size_t simd_find_byte(const char *data, size_t size, char target,
+                      size_t *positions, size_t max_positions, size_t *consumed);
+
+/*
+ * 查找 pattern（m 字节）在 data 中第一次出现的位置，未找到返回 size。
+ * 向量比较每个候选位置的首字节和尾字节，两者都相同时再用 memcmp 校验中间部分
+ */
+size_t simd_find_pattern(const char *data, size_t size, const char *pattern, size_t m);
+
+/*
+ * 忽略大小写查找 pattern（m 字节）第一次出现的位置，未找到返回 size。
+ * pattern 须已折叠为小写（ASCII 字母，以及全角拉丁字母 U+FF21..U+FF3A → U+FF41..U+FF5A），
+ * 文本在比较时现场折叠，不生成小写副本；折叠不改变字节长度，匹配长度恒为 m
+ */
+size_t simd_find_pattern_nocase(const char *data, size_t size, const char *pattern, size_t m);
+
+/*
+ * 一次扫描同时统计 UTF-8 字符数（非续字节 10xxxxxx 的个数）并校验编码
+ * *valid 返回是否为严格合法的 UTF-8（拒绝超长编码、代理区和 U+10FFFF 以上）
+ */
+size_t simd_utf8_count(const char *data, size_t size, int *valid);
+
+/* 纯 ASCII 字节的分类计数；不属于这四类的字节由调用方用总数相减得到 */
+typedef struct {
+    size_t letters;         /* A-Z a-z */
+    size_t digits;          /* 0-9 */
+    size_t spaces;          /* 空格、制表符 */
+    size_t punctuation;     /* 除字母数字外的可见字符 '!'..'~' */
+} AsciiClassCounts;
+
+/*
+ * 从 data 起按整块（16/32 字节）分类统计纯 ASCII 字节，结果累加到 *counts；
+ * 遇到含非 ASCII 字节的块即停止，返回已统计的字节数。
+ * 末尾不足一块时与前一块重叠加载；size 小于一块或标量级别时返回 0，由调用方逐字节处理
+ */
+size_t simd_classify_ascii(const char *data, size_t size, AsciiClassCounts *counts);
+
+#endif /* TEXT_SIMD_H */
@@ -0,0 +1,281 @@
+/*
+ * 简易文本编辑器 - 线程封装实现
+ */
+
+#include <stdlib.h>
+#include "text_thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+static int g_thread_count = 0;
+
+#ifdef _WIN32
+
+static unsigned __stdcall thread_entry(void *arg) {
+    TextThread *thread = (TextThread*)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+int text_thread_start(TextThread *thread, TextThreadFunc func, void *arg) {
+    if (thread == NULL || func == NULL) return -1;
+    thread->func = func;
+    thread->arg = arg;
+    uintptr_t handle = _beginthreadex(NULL, 0, thread_entry, thread, 0, NULL);
+    if (handle == 0) return -1;
+    thread->handle = (void*)handle;
+    return 0;
+}
+
+void text_thread_join(TextThread *thread) {
+    if (thread == NULL || thread->handle == NULL) return;
+    WaitForSingleObject((HANDLE)thread->handle, INFINITE);
+    CloseHandle((HANDLE)thread->handle);
+    thread->handle = NULL;
+}
+
+int text_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+void text_mutex_init(TextMutex *mutex) {
+    InitializeSRWLock((PSRWLOCK)&mutex->lock);
+}
+
+void text_mutex_destroy(TextMutex *mutex) {
+    (void)mutex;    /* SRWLOCK 无需释放 */
+}
+
+void text_mutex_lock(TextMutex *mutex) {
+    AcquireSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+void text_mutex_unlock(TextMutex *mutex) {
+    ReleaseSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+long text_atomic_add(volatile long *value, long delta) {
+    return InterlockedExchangeAdd(value, delta) + delta;
+}
+
+long text_atomic_load(volatile long *value) {
+    return InterlockedCompareExchange(value, 0, 0);
+}
+
+#else
+
+static void* thread_entry(void *arg) {
+    TextThread *thread = (TextThread*)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+int text_thread_start(TextThread *thread, TextThreadFunc func, void *arg) {
+    if (thread == NULL || func == NULL) return -1;
+    thread->func = func;
+    thread->arg = arg;
+    return pthread_create(&thread->handle, NULL, thread_entry, thread) == 0 ? 0 : -1;
+}
+
+void text_thread_join(TextThread *thread) {
+    if (thread == NULL) return;
+    pthread_join(thread->handle, NULL);
+}
+
+int text_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+void text_mutex_init(TextMutex *mutex) {
+    pthread_mutex_init(&mutex->lock, NULL);
+}
+
+void text_mutex_destroy(TextMutex *mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+}
+
+void text_mutex_lock(TextMutex *mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void text_mutex_unlock(TextMutex *mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+long text_atomic_add(volatile long *value, long delta) {
+    return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
+long text_atomic_load(volatile long *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+#endif
+
+void text_set_thread_count(int n) {
+    g_thread_count = n > MAX_WORKER_THREADS ? MAX_WORKER_THREADS : n;
+}
+
+int text_thread_count(void) {
+    int n = g_thread_count > 0 ? g_thread_count : text_cpu_count();
+    return n > MAX_WORKER_THREADS ? MAX_WORKER_THREADS : n;
+}
+
+void text_parallel_run(TextThreadFunc func, void *tasks, size_t task_size, int count) {
+    TextThread threads[MAX_WORKER_THREADS];
+    int started[MAX_WORKER_THREADS];
+    char *base = (char*)tasks;
+
+    if (func == NULL || tasks == NULL || count <= 0) return;
+    if (count > MAX_WORKER_THREADS) count = MAX_WORKER_THREADS;
+
+    for (int i = 1; i < count; i++) {
+        started[i] = text_thread_start(&threads[i], func, base + (size_t)i * task_size) == 0;
+    }
+    func(base);
+    for (int i = 1; i < count; i++) {
+        if (started[i]) {
+            text_thread_join(&threads[i]);
+        } else {
+            func(base + (size_t)i * task_size);
+        }
+    }
+}
+
+/* ========================== 工作窃取 ========================== */
+
+/* 每个线程的任务队列：剩余任务为下标区间 [head, tail) */
+typedef struct {
+    TextMutex lock;
+    int head;
+    int tail;
+} StealQueue;
+
+typedef struct StealPool StealPool;
+
+typedef struct {
+    StealPool *pool;
+    int index;
+} StealWorker;
+
+struct StealPool {
+    TextTaskFunc func;
+    char *workers;
+    size_t worker_size;
+    int count;
+    StealQueue queues[MAX_WORKER_THREADS];
+    StealWorker args[MAX_WORKER_THREADS];
+    TextMutex stats_lock;
+    int steals;
+};
+
+/* 从自己的队列头部取一个任务，队列为空返回 -1 */
+static int steal_pop(StealQueue *q) {
+    int task = -1;
+    text_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        task = q->head++;
+    }
+    text_mutex_unlock(&q->lock);
+    return task;
+}
+
+/*
+ * 依次查看其他线程，把第一个非空队列的后一半搬到自己的队列；
+ * 任务不会再产生新任务，所以一轮都为空时全部任务都已被领取
+ */
+static int steal_from_others(StealPool *pool, int self) {
+    for (int k = 1; k < pool->count; k++) {
+        StealQueue *victim = &pool->queues[(self + k) % pool->count];
+        int from = 0, to = 0;
+        text_mutex_lock(&victim->lock);
+        int left = victim->tail - victim->head;
+        if (left > 0) {
+            to = victim->tail;
+            from = to - (left + 1) / 2;
+            victim->tail = from;
+        }
+        text_mutex_unlock(&victim->lock);
+        if (to > from) {
+            StealQueue *own = &pool->queues[self];
+            text_mutex_lock(&own->lock);
+            own->head = from;
+            own->tail = to;
+            text_mutex_unlock(&own->lock);
+            text_mutex_lock(&pool->stats_lock);
+            pool->steals++;
+            text_mutex_unlock(&pool->stats_lock);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void steal_worker(void *arg) {
+    StealWorker *w = (StealWorker*)arg;
+    StealPool *pool = w->pool;
+    void *ctx = pool->workers + (size_t)w->index * pool->worker_size;
+    for (;;) {
+        int task = steal_pop(&pool->queues[w->index]);
+        if (task < 0) {
+            if (steal_from_others(pool, w->index) != 0) break;
+            continue;
+        }
+        pool->func(ctx, task);
+    }
+}
+
+int text_parallel_steal(TextTaskFunc func, void *workers, size_t worker_size,
+                        int worker_count, int task_count) {
+    if (func == NULL || workers == NULL || task_count <= 0) return 0;
+    if (worker_count > MAX_WORKER_THREADS) worker_count = MAX_WORKER_THREADS;
+    if (worker_count > task_count) worker_count = task_count;
+    if (worker_count < 1) worker_count = 1;
+
+    StealPool *pool = (StealPool*)malloc(sizeof(StealPool));
+    if (pool == NULL) {
+        /* 退化为在调用线程中顺序执行 */
+        for (int t = 0; t < task_count; t++) func(workers, t);
+        return 0;
+    }
+    pool->func = func;
+    pool->workers = (char*)workers;
+    pool->worker_size = worker_size;
+    pool->count = worker_count;
+    pool->steals = 0;
+    text_mutex_init(&pool->stats_lock);
+    for (int i = 0; i < worker_count; i++) {
+        text_mutex_init(&pool->queues[i].lock);
+        pool->queues[i].head = (int)((long long)task_count * i / worker_count);
+        pool->queues[i].tail = (int)((long long)task_count * (i + 1) / worker_count);
+        pool->args[i].pool = pool;
+        pool->args[i].index = i;
+    }
+
+    /* 启动失败的线程留下的任务会被其他线程窃取 */
+    TextThread threads[MAX_WORKER_THREADS];
+    int started[MAX_WORKER_THREADS];
+    for (int i = 1; i < worker_count; i++) {
+        started[i] = text_thread_start(&threads[i], steal_worker, &pool->args[i]) == 0;
+    }
+    steal_worker(&pool->args[0]);
+    for (int i = 1; i < worker_count; i++) {
+        if (started[i]) text_thread_join(&threads[i]);
+    }
+
+    int steals = pool->steals;
+    for (int i = 0; i < worker_count; i++) {
+        text_mutex_destroy(&pool->queues[i].lock);
+    }
+    text_mutex_destroy(&pool->stats_lock);
+    free(pool);
+    return steals;
+}
@@ -0,0 +1,88 @@
+/*
+ * 简易文本编辑器 - 线程封装
+ * 封装 Windows 线程与 POSIX pthread，供并行统计、搜索等按行区间分片的操作使用
+ */
+
+#ifndef TEXT_THREAD_H
+#define TEXT_THREAD_H
+
+#include <stddef.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define MAX_WORKER_THREADS  64      /* 并行操作的线程数上限 */
+
+typedef void (*TextThreadFunc)(void *arg);
+
+/* 单个工作线程 */
+typedef struct {
+#ifdef _WIN32
+    void *handle;           /* HANDLE */
+#else
+    pthread_t handle;
+#endif
+    TextThreadFunc func;
+    void *arg;
+} TextThread;
+
+/* 互斥锁（Windows 为 SRWLOCK，只占一个指针） */
+typedef struct {
+#ifdef _WIN32
+    void *lock;             /* SRWLOCK */
+#else
+    pthread_mutex_t lock;
+#endif
+} TextMutex;
+
+/* 静态互斥锁的初始值（全 0 的 SRWLOCK 即为未锁定） */
+#ifdef _WIN32
+#define TEXT_MUTEX_INIT { NULL }
+#else
+#define TEXT_MUTEX_INIT { PTHREAD_MUTEX_INITIALIZER }
+#endif
+
+/* 工作窃取中的任务：worker 为该线程的上下文，task 为任务下标 */
+typedef void (*TextTaskFunc)(void *worker, int task);
+
+/* 启动线程，成功返回 0 */
+int text_thread_start(TextThread *thread, TextThreadFunc func, void *arg);
+
+/* 等待线程结束并释放句柄 */
+void text_thread_join(TextThread *thread);
+
+/* 逻辑 CPU 数（至少为 1） */
+int text_cpu_count(void);
+
+/* 设置并行操作的默认线程数；n <= 0 表示使用 CPU 数 */
+void text_set_thread_count(int n);
+int text_thread_count(void);
+
+/*
+ * 对 count 个任务并行调用 func(tasks + i * task_size)：
+ * 调用线程自己执行第 0 个任务，其余各开一个线程；线程创建失败时改为在调用线程中执行
+ */
+void text_parallel_run(TextThreadFunc func, void *tasks, size_t task_size, int count);
+
+void text_mutex_init(TextMutex *mutex);
+void text_mutex_destroy(TextMutex *mutex);
+void text_mutex_lock(TextMutex *mutex);
+void text_mutex_unlock(TextMutex *mutex);
+
+/* 原子地把 delta 加到 *value 上并返回新值（引用计数用，带获取-释放语义） */
+long text_atomic_add(volatile long *value, long delta);
+
+/* 原子读取（获取语义） */
+long text_atomic_load(volatile long *value);
+
+/*
+ * 工作窃取：task_count 个任务按下标连续分给 worker_count 个线程，
+ * 每个线程按下标从小到大执行自己的任务，做完后从其他线程的剩余区间尾部窃取一半；
+ * workers 为各线程的上下文数组（每项 worker_size 字节），调用线程自己作为第 0 个
+ * 返回窃取次数
+ */
+int text_parallel_steal(TextTaskFunc func, void *workers, size_t worker_size,
+                        int worker_count, int task_count);
+
+#endif /* TEXT_THREAD_H */